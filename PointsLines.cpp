@@ -3,6 +3,210 @@
  * @brief This file contains a simple OpenGL program with vertex and fragment shaders.
  */
 #include "framework.h"
+#include <memory>
+#include <deque>
+#include <unordered_map>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <map>
+#include <climits>
+#include <functional>
+#if defined(__linux__)
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <cerrno>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sched.h>
+#include <linux/mempolicy.h>
+#endif
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#define GEOMETRY_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+#if defined(SHARD_WORKERS) && !defined(__linux__)
+#error "SHARD_WORKERS needs fork, pipes and /proc/self/exe, which are only available on Linux"
+#endif
+#if defined(SCENE_SHARING) && !defined(__linux__)
+#error "SCENE_SHARING uses Unix domain sockets, which are only supported on Linux"
+#endif
+#if defined(__GNUC__) || defined(__clang__)
+#define KERNEL_TARGET(isa) __attribute__((target(isa)))
+#else
+#define KERNEL_TARGET(isa)
+#endif
+
+#ifdef TRACK_ALLOCATIONS
+#include <new>
+
+/**
+ * @struct AllocStats
+ * @brief Number and total size of heap allocations.
+ */
+struct AllocStats {
+    unsigned long count; /**< Number of allocations. */
+    unsigned long bytes; /**< Number of bytes allocated. */
+};
+
+/**
+ * @struct AllocCounter
+ * @brief AllocStats updated by every thread that allocates.
+ */
+struct AllocCounter {
+    std::atomic<unsigned long> count; /**< Number of allocations. */
+    std::atomic<unsigned long> bytes; /**< Number of bytes allocated. */
+
+    /**
+     * @brief Records an allocation.
+     */
+    void add(size_t n) {
+        count.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Returns the current values.
+     */
+    AllocStats get() const {
+        AllocStats stats = {count.load(std::memory_order_relaxed), bytes.load(std::memory_order_relaxed)};
+        return stats;
+    }
+
+    /**
+     * @brief Returns the current values and starts again from zero.
+     */
+    AllocStats take() {
+        AllocStats stats = {count.exchange(0, std::memory_order_relaxed), bytes.exchange(0, std::memory_order_relaxed)};
+        return stats;
+    }
+};
+
+thread_local int allocSite; /**< Index of the call site active on this thread plus one, 0 outside any scope. */
+thread_local AllocStats threadAllocs; /**< Allocations made by this thread. */
+
+/**
+ * @struct AllocationTracker
+ * @brief Counts the allocations of the global operator new per frame and per call site.
+ *
+ * Call sites are the labels of the innermost AllocScope of the allocating thread; scopes are
+ * only opened in the GLUT handlers, so the site table belongs to the main thread, while the frame
+ * and total counters include the producer and worker threads. The tracker itself never
+ * allocates: sites live in a fixed table and are compared by label address.
+ * It has no constructor, so it is zero-initialized before any static constructor runs.
+ */
+struct AllocationTracker {
+    static const int maxSites = 32; /**< Size of the call site table. */
+    const char *siteNames[maxSites]; /**< Labels of the call sites seen so far. */
+    AllocStats sites[maxSites]; /**< Allocations per call site. */
+    int siteCount; /**< Number of call sites in the table. */
+    AllocCounter frame; /**< Allocations in the current frame. */
+    AllocStats lastFrame; /**< Allocations in the last finished frame. */
+    AllocCounter total; /**< Allocations since the start of the program. */
+
+    /**
+     * @brief Returns the index of a call site, adding it to the table if needed.
+     * @param name Label of the call site.
+     */
+    int site(const char *name) {
+        for (int s = 0; s < siteCount; s++) {
+            if (siteNames[s] == name) return s;
+        }
+        if (siteCount == maxSites) return maxSites - 1;
+        siteNames[siteCount] = name;
+        return siteCount++;
+    }
+
+    /**
+     * @brief Records an allocation of the calling thread.
+     * @param n Size of the allocation.
+     */
+    void onAlloc(size_t n) {
+        frame.add(n);
+        total.add(n);
+        threadAllocs.count++;
+        threadAllocs.bytes += n;
+        if (allocSite > 0) {
+            sites[allocSite - 1].count++;
+            sites[allocSite - 1].bytes += n;
+        }
+    }
+
+    /**
+     * @brief Closes the current frame.
+     */
+    void endFrame() {
+        lastFrame = frame.take();
+    }
+
+    /**
+     * @brief Prints the allocation report to the console.
+     */
+    void print() const {
+        AllocStats all = total.get();
+        printf("Allocations: last frame %lu (%lu bytes), total %lu (%lu bytes)\n",
+               lastFrame.count, lastFrame.bytes, all.count, all.bytes);
+        for (int s = 0; s < siteCount; s++) {
+            printf("\t%-16s %8lu allocations %10lu bytes\n", siteNames[s], sites[s].count, sites[s].bytes);
+        }
+    }
+};
+
+AllocationTracker allocTracker; /**< Global allocation tracker. */
+
+/**
+ * @class AllocScope
+ * @brief Attributes the allocations made by the calling thread during its lifetime to a call site.
+ */
+class AllocScope {
+    int previous; /**< Call site active before this scope. */
+
+public:
+    /**
+     * @brief Constructor for the AllocScope class.
+     * @param name Label of the call site, compared by address.
+     */
+    AllocScope(const char *name) {
+        previous = allocSite;
+        allocSite = allocTracker.site(name) + 1;
+    }
+
+    /**
+     * @brief Destructor, restores the enclosing call site.
+     */
+    ~AllocScope() {
+        allocSite = previous;
+    }
+};
+
+void *operator new(size_t n) {
+    allocTracker.onAlloc(n);
+    void *p = malloc(n > 0 ? n : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+#define ALLOC_SCOPE(name) AllocScope allocScope(name)
+#else
+#define ALLOC_SCOPE(name)
+#endif
 
 /**
  * @brief Vertex shader source code in GLSL.
@@ -41,401 +245,7265 @@ const char *const fragmentSource = R"(
 )";
 
 GPUProgram gpuProgram; /**< GPUProgram object for vertex and fragment shaders. */
+int screenWidth = windowWidth; /**< Current width of the window framebuffer in pixels. */
+int screenHeight = windowHeight; /**< Current height of the window framebuffer in pixels. */
+int clientWidth = windowWidth; /**< Current width of the window in the coordinates of mouse events. */
+int clientHeight = windowHeight; /**< Current height of the window in the coordinates of mouse events. */
+float pixelRatio = 1.0f; /**< Framebuffer pixels per window coordinate, above 1 on high-DPI displays. */
 unsigned int vao; /**< Virtual world on the GPU. */
 
 /**
- * @class Object
- * @brief Represents an object with vertices stored in a vector and associated OpenGL buffers.
+ * @struct FrameStats
+ * @brief Per-frame counters of the renderer.
  */
-class Object {
-    std::vector<vec3> vtx; /**< Vector storing the vertices of the object. */
-    unsigned int vao; /**< Vertex Array Object (VAO) ID. */
-    unsigned int vbo; /**< Vertex Buffer Object (VBO) ID. */
+struct FrameStats {
+    unsigned long drawCalls = 0; /**< Draw calls issued in the current frame. */
+    unsigned long uploadBytes = 0; /**< Bytes uploaded to the GPU in the current frame. */
+    unsigned long perfWarnings = 0; /**< Performance messages of the driver in the current frame. */
+    unsigned long lastDrawCalls = 0; /**< Draw calls of the last finished frame. */
+    unsigned long lastUploadBytes = 0; /**< Bytes uploaded in the last finished frame. */
+    unsigned long lastPerfWarnings = 0; /**< Performance messages of the last finished frame. */
 
-public:
     /**
-     * @brief Constructor for the Object class.
-     * Initializes VAO and VBO, and sets up vertex attribute pointers.
+     * @brief Closes the current frame.
      */
-    Object() {
-        glGenVertexArrays(1, &vao);
-        glBindVertexArray(vao);
-        glGenBuffers(1, &vbo);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+    void endFrame() {
+        lastDrawCalls = drawCalls;
+        lastUploadBytes = uploadBytes;
+        lastPerfWarnings = perfWarnings;
+        drawCalls = uploadBytes = perfWarnings = 0;
     }
+};
+
+FrameStats frameStats; /**< Counters of the renderer. */
+
+/**
+ * @class GlDebug
+ * @brief KHR_debug message callback with severity filtering, deduplication and rate limiting,
+ * plus helpers for debug groups and object labels.
+ *
+ * Every distinct message is printed once; repeats are only counted. At most maxPerSecond
+ * new messages are printed per second, the rest are counted as suppressed.
+ */
+class GlDebug {
+    static const int maxMessages = 64; /**< Size of the deduplication table. */
+    static const int maxPerSecond = 10; /**< Printed messages allowed per second. */
+
+    bool available = false; /**< Whether KHR_debug is supported by the context. */
+    unsigned long long keys[maxMessages] = {}; /**< Hashes of the messages seen. */
+    unsigned long counts[maxMessages] = {}; /**< Occurrences of each message. */
+    int messageCount = 0; /**< Number of distinct messages seen. */
+    unsigned long suppressed = 0; /**< Messages not printed because of the rate limit. */
+    long windowStart = 0; /**< Start of the current rate limiting window in ms. */
+    int printedInWindow = 0; /**< Messages printed in the current window. */
+    unsigned long perfMessages = 0; /**< Performance-category messages since the start. */
 
     /**
-     * @brief Getter function for the vertex vector.
-     * @return Reference to the vertex vector.
+     * @brief Returns a printable name of a message type.
      */
-    std::vector<vec3> &Vtx() {
-        return vtx;
+    static const char *typeName(GLenum type) {
+        switch (type) {
+            case GL_DEBUG_TYPE_ERROR: return "error";
+            case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "deprecated";
+            case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "undefined";
+            case GL_DEBUG_TYPE_PORTABILITY: return "portability";
+            case GL_DEBUG_TYPE_PERFORMANCE: return "performance";
+            default: return "other";
+        }
     }
 
     /**
-     * @brief Updates the GPU buffers with the current vertex data.
+     * @brief Returns a printable name of a message severity.
      */
-    void updateGpu() {
-        glBindVertexArray(vao);
-        glBindBuffer(GL_ARRAY_BUFFER, vbo);
-        glBufferData(GL_ARRAY_BUFFER, vtx.size() * sizeof(vec3), &vtx[0], GL_DYNAMIC_DRAW);
+    static const char *severityName(GLenum severity) {
+        switch (severity) {
+            case GL_DEBUG_SEVERITY_HIGH: return "high";
+            case GL_DEBUG_SEVERITY_MEDIUM: return "medium";
+            case GL_DEBUG_SEVERITY_LOW: return "low";
+            default: return "notification";
+        }
     }
 
     /**
-     * @brief Draws the object with the specified drawing type and color.
-     * @param type The type of drawing to perform (e.g., GL_TRIANGLES, GL_LINES, etc.).
-     * @param color The color of the object.
+     * @brief Handles a message of the driver.
      */
-    void Draw(int type, vec3 color) {
-        if (vtx.size() > 0)
-            glBindVertexArray(vao);
-        gpuProgram.setUniform(color, "color");
-        glDrawArrays(type, 0, vtx.size());
+    void message(GLenum source, GLenum type, GLuint id, GLenum severity, const GLchar *text) {
+        if (type == GL_DEBUG_TYPE_PERFORMANCE) {
+            perfMessages++;
+            frameStats.perfWarnings++;
+        }
+        unsigned long long key = 1469598103934665603ull ^ ((unsigned long long) source << 40) ^
+                                 ((unsigned long long) type << 20) ^ id;
+        for (const GLchar *c = text; *c; c++) key = (key ^ (unsigned char) *c) * 1099511628211ull;
+        for (int m = 0; m < messageCount; m++) {
+            if (keys[m] == key) {
+                counts[m]++;
+                return;
+            }
+        }
+        if (messageCount < maxMessages) {
+            keys[messageCount] = key;
+            counts[messageCount++] = 1;
+        }
+        long now = glutGet(GLUT_ELAPSED_TIME);
+        if (now - windowStart >= 1000) {
+            windowStart = now;
+            printedInWindow = 0;
+        }
+        if (printedInWindow >= maxPerSecond) {
+            suppressed++;
+            return;
+        }
+        printedInWindow++;
+        printf("GL %s (%s, id %u): %s\n", typeName(type), severityName(severity), id, text);
     }
 
+#if !defined(__APPLE__)
     /**
-     * @brief Returns the number of vertices in the object.
-     * @return The number of vertices.
+     * @brief Callback registered with glDebugMessageCallback.
      */
-    size_t size() const {
-        return vtx.size();
+    static void GLAPIENTRY callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei,
+                                    const GLchar *text, const void *user) {
+        ((GlDebug *) user)->message(source, type, id, severity, text);
     }
-};
-
-
-/**
- * @class PointCollection
- * @brief Represents a collection of points stored in an Object.
- */
-class PointCollection {
-private:
-    Object points; /**< Object storing the points. */
+#endif
 
 public:
     /**
-     * @brief Returns the number of points in the collection.
-     * @return The number of points.
+     * @brief Installs the message callback if KHR_debug is available.
+     * @param notifications Whether notification-severity messages are reported as well.
      */
-    int size() const {
-        int count = 0;
-        for (size_t i = 0; i < points.size(); i++) {
-            count++;
+    void install(bool notifications = false) {
+#if !defined(__APPLE__)
+        available = GLEW_KHR_debug || GLEW_VERSION_4_3;
+        if (!available) {
+            printf("KHR_debug is not available, GL messages are not reported\n");
+            return;
         }
-        return count;
+        glEnable(GL_DEBUG_OUTPUT);
+        glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+        glDebugMessageCallback(callback, this);
+        glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION, 0, NULL,
+                              notifications ? GL_TRUE : GL_FALSE);
+#endif
     }
 
     /**
-     * @brief Adds a point to the collection.
-     * @param p The point to add.
+     * @brief Names a GL object for external profilers and debuggers.
+     * @param identifier Namespace of the object, e.g. GL_BUFFER.
+     * @param name Id of the object.
+     * @param label The name to show.
      */
-    void addPoint(vec3 p) {
-        points.Vtx().push_back(p);
-        update();
-        printf("Point %3.2f, %3.2f added\n", p.x, p.y);
+    void label(GLenum identifier, unsigned int name, const char *label) {
+#if !defined(__APPLE__)
+        if (available) glObjectLabel(identifier, name, -1, label);
+#endif
     }
 
     /**
-     * @brief Updates the GPU buffers with the current point data.
+     * @brief Opens a named debug group.
+     * @param name Name of the pass.
      */
-    void update() {
-        points.updateGpu();
+    void pushGroup(const char *name) {
+#if !defined(__APPLE__)
+        if (available) glPushDebugGroup(GL_DEBUG_SOURCE_APPLICATION, 0, -1, name);
+#endif
     }
 
     /**
-     * @brief Searches for the nearest point to a given position.
-     * @param pos The position to search around.
-     * @return The nearest point to the given position.
+     * @brief Closes the innermost debug group.
      */
-    vec3 searchNearestP(vec3 pos) {
-        if (points.Vtx().size() == 0) {
-            return vec3(0, 0, 1);
-        }
-        vec3 est = points.Vtx()[0];
-        float minD = sqrt((pos.x - est.x) * (pos.x - est.x) + (pos.y - est.y) * (pos.y - est.y));
-        for (int i = 1; i < points.Vtx().size(); i++) {
-            float d = sqrt((pos.x - points.Vtx()[i].x) * (pos.x - points.Vtx()[i].x) +
-                           (pos.y - points.Vtx()[i].y) * (pos.y - points.Vtx()[i].y));
-            if (d < minD) {
-                minD = d;
-                est = points.Vtx()[i];
-            }
-        }
-        return est;
+    void popGroup() {
+#if !defined(__APPLE__)
+        if (available) glPopDebugGroup();
+#endif
     }
 
     /**
-     * @brief Draws the points in the collection with the specified color.
-     * @param color The color of the points.
+     * @brief Prints the message statistics to the console.
      */
-    void Draw(vec3 color) {
-        points.Draw(GL_POINTS, color);
+    void print() const {
+        printf("GL messages: %d distinct, %lu performance, %lu suppressed by the rate limit\n",
+               messageCount, perfMessages, suppressed);
     }
 };
 
+GlDebug glDebug; /**< Reporter of the GL debug messages. */
+
 /**
- * @class Line
- * @brief Represents a line defined by two points in 2D space.
+ * @class DebugGroup
+ * @brief Scoped debug group annotating a rendering pass.
  */
-class Line {
-private:
-    vec3 p1; /**< First point of the line. */
-    vec3 p2; /**< Second point of the line. */
-    vec3 p3; /**< Third point of the line (for drawing). */
-    vec3 p4; /**< Fourth point of the line (for drawing). */
-    float a; /**< Coefficient 'a' of the line equation. */
-    float b; /**< Coefficient 'b' of the line equation. */
-    float c; /**< Coefficient 'c' of the line equation. */
-    float px; /**< Parametric vector x-component. */
-    float py; /**< Parametric vector y-component. */
-
+class DebugGroup {
 public:
     /**
-     * @brief Default constructor for the Line class.
+     * @brief Constructor for the DebugGroup class, opens the group.
+     * @param name Name of the pass.
      */
-    Line() {}
+    DebugGroup(const char *name) {
+        glDebug.pushGroup(name);
+    }
 
     /**
-     * @brief Constructor for the Line class.
-     * @param p1 First point of the line.
-     * @param p2 Second point of the line.
+     * @brief Destructor, closes the group.
      */
-    Line(vec3 p1, vec3 p2) {
-        if (p1.x == p2.x) {
-            this->a = 1;
-            this->b = 0;
-            this->c = -p1.x;
-        } else {
-            this->a = p2.y - p1.y;
-            this->b = p1.x - p2.x;
-            this->c = -a * p1.x - b * p1.y;
-        }
-        this->px = p2.x - p1.x;
-        this->py = p2.y - p1.y;
-        this->p1 = p1;
-        this->p2 = p2;
-        if (this->b != 0) {
-            this->p3 = vec3(-1.0f, (-a * -1.0f - c) / b, 1);
-            this->p4 = vec3(1.0f, (-a * 1.0f - c) / b, 1);
-        } else {
-            this->p3 = vec3(p1.x, -1.0f, 1);
-            this->p4 = vec3(p1.x, 1.0f, 1);
-        }
+    ~DebugGroup() {
+        glDebug.popGroup();
     }
+};
+
+/**
+ * @class MemoryPolicy
+ * @brief Page size and NUMA placement of the large geometry arrays.
+ *
+ * Set once at startup from POINTSLINES_MEMORY, a comma separated list of "thp" (transparent
+ * 2 MB pages), "hugetlb" (reserved 2 MB pages, falling back to thp when none are free),
+ * "interleave" (pages spread over all NUMA nodes) and "local" (pages placed by the first touch
+ * of threads pinned to the node of their share of the data). Blocks smaller than 2 MB, such as
+ * the chunks of the stores, are carved from 2 MB slabs mapped with the policy and recycled by
+ * page count; larger blocks are mapped on their own. Without the variable, and on other
+ * systems than Linux, everything comes from the heap.
+ */
+class MemoryPolicy {
+public:
+    /**
+     * @enum Pages
+     * @brief Page size of the mappings.
+     */
+    enum Pages {
+        SMALL, /**< The base pages of the system. */
+        TRANSPARENT, /**< 2 MB pages assembled by the kernel, requested with madvise. */
+        EXPLICIT /**< 2 MB pages from the reserved pool. */
+    };
 
     /**
-     * @brief Finds the intersection point of two lines.
-     * @param line2 The second line to intersect with.
-     * @return The intersection point of the two lines.
+     * @enum Placement
+     * @brief NUMA placement of the mappings.
      */
-    vec3 findIntersectionPoint(Line line2) {
-        float a1 = this->getA(), b1 = this->getB(), c1 = this->getC();
-        float a2 = line2.getA(), b2 = line2.getB(), c2 = line2.getC();
-        float determinant = a1 * b2 - a2 * b1;
+    enum Placement {
+        FIRST_TOUCH, /**< The node of the thread that first writes a page. */
+        INTERLEAVE, /**< Round robin over all nodes. */
+        LOCAL /**< First touch from threads pinned to the node of their partition. */
+    };
 
-        if (determinant == 0) {
-            return {0, 0, 1};
-        } else {
-            float x = (b1 * c2 - b2 * c1) / determinant;
-            float y = (a2 * c1 - a1 * c2) / determinant;
+    static const size_t hugePage = 2 << 20; /**< Size of a slab and of a huge page. */
+    static const size_t page = 4096; /**< Granularity of the blocks carved from slabs. */
+
+private:
+    /**
+     * @struct Mapping
+     * @brief A region mapped by the policy.
+     */
+    struct Mapping {
+        size_t bytes; /**< Size of the region. */
+        bool slab; /**< Whether blocks are carved from it. */
+    };
 
-            return {x, y, 1};
+    bool active = false; /**< Whether allocations go through the policy. */
+    Pages pages = SMALL; /**< Page size. */
+    Placement placement = FIRST_TOUCH; /**< NUMA placement. */
+    std::vector<std::vector<int> > nodeCpus; /**< CPUs of every NUMA node. */
+    std::mutex mutex; /**< Guards the slabs and the free lists. */
+    std::map<char *, Mapping> mappings; /**< Mapped regions by start address. */
+    std::vector<std::vector<char *> > freeBlocks; /**< Released slab blocks by page count. */
+    char *bump = NULL; /**< Next free byte of the current slab. */
+    char *bumpEnd = NULL; /**< End of the current slab. */
+
+    /**
+     * @brief Parses a CPU list such as "0-3,8-11".
+     */
+    static std::vector<int> parseCpuList(const char *text) {
+        std::vector<int> cpus;
+        while (*text) {
+            char *end;
+            long first = strtol(text, &end, 10), last = first;
+            if (end == text) break;
+            if (*end == '-') last = strtol(end + 1, &end, 10);
+            for (long cpu = first; cpu <= last; cpu++) cpus.push_back((int) cpu);
+            text = *end == ',' ? end + 1 : end;
         }
+        return cpus;
     }
 
     /**
-     * @brief Moves the line to a new position.
-     * @param clickP The new position to move the line to.
+     * @brief Maps a 2 MB aligned region with the page size and placement of the policy.
+     * @param bytes Size of the region, a multiple of 2 MB.
+     * @return The region, or NULL.
      */
-    void move(vec3 clickP) {
-        float a, b;
-        a = this->getA();
-        b = this->getB();
-        float newC = -a * clickP.x - b * clickP.y;
-        this->setP1(vec3(-1.0f, (-a * -1.0f - newC) / b, 1));
-        this->setP2(vec3(1.0f, (-a * 1.0f - newC) / b, 1));
-        this->setP3(vec3(-1.0f, (-a * -1.0f - newC) / b, 1));
-        this->setP4(vec3(1.0f, (-a * 1.0f - newC) / b, 1));
+    char *map(size_t bytes) {
+#if defined(__linux__)
+        if (pages == EXPLICIT) {
+            void *p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (p != MAP_FAILED) {
+                place((char *) p, bytes);
+                return (char *) p;
+            }
+            fprintf(stderr, "No reserved huge pages available (vm.nr_hugepages), using transparent huge pages\n");
+            pages = TRANSPARENT;
+        }
+        // over-map by one huge page and trim, so the region can be backed by huge pages
+        void *raw = mmap(NULL, bytes + hugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return NULL;
+        char *start = (char *) (((size_t) raw + hugePage - 1) & ~(hugePage - 1));
+        if (start > (char *) raw) munmap(raw, start - (char *) raw);
+        munmap(start + bytes, (char *) raw + hugePage - start);
+#ifdef MADV_HUGEPAGE
+        if (pages == TRANSPARENT) madvise(start, bytes, MADV_HUGEPAGE);
+#endif
+        place(start, bytes);
+        return start;
+#else
+        return NULL;
+#endif
     }
 
-    // Getters and setters
-    float getA() const {
-        return a;
+    /**
+     * @brief Applies the interleaved placement to a fresh region, before it is touched.
+     */
+    void place(char *start, size_t bytes) {
+#if defined(__linux__)
+        if (placement != INTERLEAVE || nodeCpus.size() < 2) return;
+        unsigned long mask = nodeCpus.size() >= 8 * sizeof(unsigned long) ? ~0UL : (1UL << nodeCpus.size()) - 1;
+        syscall(SYS_mbind, start, bytes, MPOL_INTERLEAVE, &mask, 8 * sizeof(unsigned long), 0);
+#endif
     }
-    float getB() const {
-        return b;
+
+public:
+    /**
+     * @brief Reads the policy from a comma separated list and the NUMA topology of the machine.
+     * @param spec The list, see the class description.
+     */
+    void configure(const char *spec) {
+        std::string list = spec;
+        size_t start = 0;
+        while (start <= list.size()) {
+            size_t end = list.find(',', start);
+            std::string item = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+            if (item == "thp") pages = TRANSPARENT;
+            else if (item == "hugetlb") pages = EXPLICIT;
+            else if (item == "interleave") placement = INTERLEAVE;
+            else if (item == "local") placement = LOCAL;
+            else if (!item.empty()) fprintf(stderr, "Unknown memory policy %s\n", item.c_str());
+            if (end == std::string::npos) break;
+            start = end + 1;
+        }
+#if defined(__linux__)
+        for (int node = 0;; node++) {
+            char path[64], text[1024];
+            snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+            FILE *file = fopen(path, "r");
+            if (!file) break;
+            if (!fgets(text, sizeof(text), file)) text[0] = 0;
+            fclose(file);
+            nodeCpus.push_back(parseCpuList(text));
+        }
+        if (nodeCpus.empty()) nodeCpus.push_back(std::vector<int>());
+        freeBlocks.resize(hugePage / page + 1);
+        active = true;
+#else
+        fprintf(stderr, "Memory policies are only applied on Linux\n");
+#endif
     }
-    float getC() const {
-        return c;
+
+    /**
+     * @brief Returns a short description of the policy.
+     */
+    std::string describe() const {
+        if (!active) return "heap";
+        std::string text = pages == EXPLICIT ? "hugetlb" : pages == TRANSPARENT ? "thp" : "4 KB pages";
+        text += placement == INTERLEAVE ? ", interleaved" : placement == LOCAL ? ", local" : ", first touch";
+        return text + " over " + std::to_string(nodeCpus.size()) + " NUMA node(s)";
     }
-    void setP1(const vec3 &p1) {
-        Line::p1 = p1;
+
+    /**
+     * @brief Returns the number of NUMA nodes, 1 if unknown.
+     */
+    int nodes() const {
+        return nodeCpus.empty() ? 1 : (int) nodeCpus.size();
     }
-    void setP2(const vec3 &p2) {
-        Line::p2 = p2;
+
+    /**
+     * @brief Tells whether parallel code should partition its data statically by node.
+     */
+    bool local() const {
+        return active && placement == LOCAL;
     }
-    void setP3(const vec3 &p3) {
-        Line::p3 = p3;
+
+    /**
+     * @brief Allocates a block with the policy.
+     * @param bytes Size of the block.
+     */
+    void *allocate(size_t bytes) {
+        if (!active) return ::operator new(bytes);
+        size_t pageCount = (bytes + page - 1) / page;
+        if (pageCount == 0) pageCount = 1;
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pageCount * page >= hugePage) {
+            size_t size = (bytes + hugePage - 1) & ~(hugePage - 1);
+            char *p = map(size);
+            if (!p) throw std::bad_alloc();
+            Mapping mapping = {size, false};
+            mappings[p] = mapping;
+            return p;
+        }
+        if (!freeBlocks[pageCount].empty()) {
+            char *p = freeBlocks[pageCount].back();
+            freeBlocks[pageCount].pop_back();
+            return p;
+        }
+        if (!bump || (size_t) (bumpEnd - bump) < pageCount * page) {
+            bump = map(hugePage);
+            if (!bump) throw std::bad_alloc();
+            bumpEnd = bump + hugePage;
+            Mapping mapping = {hugePage, true};
+            mappings[bump] = mapping;
+        }
+        char *p = bump;
+        bump += pageCount * page;
+        return p;
     }
-    void setP4(const vec3 &p4) {
-        Line::p4 = p4;
+
+    /**
+     * @brief Releases a block allocated with allocate, or with the heap before the policy was set.
+     * @param p The block.
+     * @param bytes Size of the block.
+     */
+    void release(void *p, size_t bytes) {
+        if (!active) {
+            ::operator delete(p);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        std::map<char *, Mapping>::iterator it = mappings.upper_bound((char *) p);
+        if (it == mappings.begin() || (char *) p >= (--it)->first + it->second.bytes) {
+            ::operator delete(p);
+        } else if (it->second.slab) {
+            size_t pageCount = (bytes + page - 1) / page;
+            freeBlocks[pageCount ? pageCount : 1].push_back((char *) p);
+        } else {
+#if defined(__linux__)
+            munmap(it->first, it->second.bytes);
+#endif
+            mappings.erase(it);
+        }
     }
-    float getPx() const {
-        return px;
+
+    /**
+     * @brief Pins the calling thread to a NUMA node.
+     * @param node The node.
+     */
+    void pinToNode(int node) const {
+#if defined(__linux__)
+        if (node < 0 || node >= (int) nodeCpus.size() || nodeCpus[node].empty()) return;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i = 0; i < nodeCpus[node].size(); i++) CPU_SET(nodeCpus[node][i], &set);
+        sched_setaffinity(0, sizeof(set), &set);
+#endif
     }
-    float getPy() const {
-        return py;
+
+    /**
+     * @brief Pins the calling worker to the node of its partition if the placement is local.
+     * @param t Index of the worker.
+     * @param threadCount Number of workers; worker t owns the t-th contiguous share of the data.
+     */
+    void bindThread(int t, int threadCount) const {
+        if (local() && nodes() > 1) pinToNode(t * nodes() / threadCount);
     }
-    const vec3 &getP3() const {
-        return p3;
+};
+
+MemoryPolicy memoryPolicy; /**< Allocation policy of the stores and of the large indices. */
+
+/**
+ * @class PolicyAllocator
+ * @brief Standard allocator drawing from memoryPolicy.
+ */
+template<typename T>
+class PolicyAllocator {
+public:
+    typedef T value_type; /**< Type of the elements. */
+
+    PolicyAllocator() {}
+
+    /**
+     * @brief Converting constructor required of allocators, the allocator has no state.
+     */
+    template<typename U>
+    PolicyAllocator(const PolicyAllocator<U> &) {}
+
+    /**
+     * @brief Allocates room for n elements.
+     */
+    T *allocate(size_t n) {
+        return (T *) memoryPolicy.allocate(n * sizeof(T));
     }
-    const vec3 &getP4() const {
-        return p4;
+
+    /**
+     * @brief Releases room for n elements.
+     */
+    void deallocate(T *p, size_t n) {
+        memoryPolicy.release(p, n * sizeof(T));
     }
-    const vec3 &getP2() const {
-        return p2;
+
+    /**
+     * @brief All instances are interchangeable.
+     */
+    template<typename U>
+    bool operator==(const PolicyAllocator<U> &) const {
+        return true;
     }
-    const vec3 &getP1() const {
-        return p1;
+
+    /**
+     * @brief All instances are interchangeable.
+     */
+    template<typename U>
+    bool operator!=(const PolicyAllocator<U> &) const {
+        return false;
     }
 };
+
 /**
- * @class LineCollection
+ * @class LargeArray
+ * @brief Fixed-size array of trivially copyable elements drawn from memoryPolicy and left untouched,
+ * so the threads that fill it decide where its pages live.
+ */
+template<typename T>
+class LargeArray {
+    T *items = NULL; /**< The elements. */
+    size_t count = 0; /**< Number of elements. */
+
+public:
+    LargeArray() {}
+
+    LargeArray(const LargeArray &) = delete;
+
+    LargeArray &operator=(const LargeArray &) = delete;
+
+    ~LargeArray() {
+        reset(0);
+    }
+
+    /**
+     * @brief Replaces the contents with n uninitialized elements.
+     */
+    void reset(size_t n) {
+        if (items) memoryPolicy.release(items, count * sizeof(T));
+        items = n ? (T *) memoryPolicy.allocate(n * sizeof(T)) : NULL;
+        count = n;
+    }
+
+    /**
+     * @brief Returns element i.
+     */
+    T &operator[](size_t i) {
+        return items[i];
+    }
+
+    /**
+     * @brief Returns element i.
+     */
+    const T &operator[](size_t i) const {
+        return items[i];
+    }
+
+    /**
+     * @brief Returns the number of elements.
+     */
+    size_t size() const {
+        return count;
+    }
+};
+
+/**
+ * @brief Global stamp source for chunk modifications.
+ * Every write to a chunk gives it a fresh stamp, so equal stamps mean equal contents.
+ */
+unsigned long nextChunkStamp = 0;
+
+/**
+ * @class ChunkedArray
+ * @brief Copy-on-write array stored as fixed-size chunks in a persistent radix tree.
+ *
+ * Copying the array only copies the root pointer, so snapshots are O(1).
+ * A write clones the nodes on the path to the touched chunk if they are shared
+ * with a snapshot, therefore unchanged chunks stay shared between versions.
+ */
+template<typename T>
+class ChunkedArray {
+public:
+    static const size_t chunkBits = 10; /**< log2 of the number of elements in a chunk. */
+    static const size_t chunkSize = 1 << chunkBits; /**< Number of elements in a chunk. */
+    static const size_t fanBits = 5; /**< log2 of the number of children of an inner node. */
+    static const size_t fan = 1 << fanBits; /**< Number of children of an inner node. */
+
+private:
+    /**
+     * @struct Node
+     * @brief Inner node (children) or leaf chunk (items) of the tree.
+     */
+    struct Node {
+        std::vector<T, PolicyAllocator<T> > items; /**< Elements of a leaf chunk. */
+        std::vector<std::shared_ptr<Node> > children; /**< Children of an inner node. */
+        unsigned long stamp = 0; /**< Stamp of the last modification of a leaf. */
+    };
+
+    std::shared_ptr<Node> root; /**< Root of the tree, a leaf while depth is 0. */
+    size_t count = 0; /**< Number of elements. */
+    unsigned int depth = 0; /**< Number of inner levels above the leaves. */
+
+    /**
+     * @brief Returns the number of elements addressable with the current depth.
+     */
+    size_t capacity() const {
+        return chunkSize << (fanBits * depth);
+    }
+
+    /**
+     * @brief Makes the node unique to this array, cloning it if it is shared.
+     * @param node The node to detach.
+     */
+    static void detach(std::shared_ptr<Node> &node) {
+        if (!node) {
+            node = std::make_shared<Node>();
+        } else if (node.use_count() > 1) {
+            node = std::make_shared<Node>(*node);
+        }
+    }
+
+    /**
+     * @brief Returns the leaf holding element i, with the path to it made writable.
+     * @param i Index of the element.
+     */
+    Node &writableLeaf(size_t i) {
+        detach(root);
+        Node *node = root.get();
+        for (unsigned int level = depth; level > 0; level--) {
+            size_t slot = (i >> (chunkBits + fanBits * (level - 1))) & (fan - 1);
+            if (node->children.size() <= slot) node->children.resize(slot + 1);
+            detach(node->children[slot]);
+            node = node->children[slot].get();
+        }
+        node->stamp = ++nextChunkStamp;
+        return *node;
+    }
+
+    /**
+     * @brief Returns the leaf holding element i for reading.
+     * @param i Index of the element.
+     */
+    const Node &leaf(size_t i) const {
+        const Node *node = root.get();
+        for (unsigned int level = depth; level > 0; level--) {
+            node = node->children[(i >> (chunkBits + fanBits * (level - 1))) & (fan - 1)].get();
+        }
+        return *node;
+    }
+
+    /**
+     * @brief Visits the leaves below a node in order.
+     */
+    template<typename F>
+    static void visit(const Node &node, unsigned int level, size_t &chunk, F &f) {
+        if (level == 0) {
+            f(chunk, node.items.data(), node.items.size(), node.stamp);
+            chunk++;
+            return;
+        }
+        for (size_t i = 0; i < node.children.size(); i++) {
+            visit(*node.children[i], level - 1, chunk, f);
+        }
+    }
+
+public:
+    /**
+     * @brief Returns the number of elements.
+     */
+    size_t size() const {
+        return count;
+    }
+
+    /**
+     * @brief Returns the number of chunks in use.
+     */
+    size_t chunks() const {
+        return (count + chunkSize - 1) / chunkSize;
+    }
+
+    /**
+     * @brief Returns element i.
+     * @param i Index of the element.
+     */
+    const T &operator[](size_t i) const {
+        return leaf(i).items[i & (chunkSize - 1)];
+    }
+
+    /**
+     * @brief Overwrites element i, copying its chunk if it is shared with a snapshot.
+     * @param i Index of the element.
+     * @param v The new value.
+     */
+    void set(size_t i, const T &v) {
+        writableLeaf(i).items[i & (chunkSize - 1)] = v;
+    }
+
+    /**
+     * @brief Appends an element, touching only the tail chunk.
+     * @param v The value to append.
+     */
+    void push_back(const T &v) {
+        if (root && count == capacity()) {
+            std::shared_ptr<Node> newRoot = std::make_shared<Node>();
+            newRoot->children.push_back(root);
+            root = newRoot;
+            depth++;
+        }
+        Node &tail = writableLeaf(count);
+        if (tail.items.capacity() < chunkSize) tail.items.reserve(chunkSize);
+        tail.items.push_back(v);
+        count++;
+    }
+
+    /**
+     * @brief Calls f(chunkIndex, data, count, stamp) for every chunk in order.
+     * @param f The visitor.
+     */
+    template<typename F>
+    void forEachChunk(F f) const {
+        if (!root) return;
+        size_t chunk = 0;
+        visit(*root, depth, chunk, f);
+    }
+};
+
+/**
+ * @class GpuResource
+ * @brief GPU allocation known to the residency manager.
+ */
+class GpuResource {
+public:
+    unsigned long lastUsed = 0; /**< Frame in which the resource was last drawn. */
+    size_t bytes = 0; /**< Size of the allocation. */
+    int category = 0; /**< Category the bytes are accounted to. */
+    bool resident = false; /**< Whether the allocation currently exists on the GPU. */
+
+    /**
+     * @brief Frees the GPU allocation; the owner re-creates it on demand.
+     */
+    virtual void evict() = 0;
+
+    /**
+     * @brief Virtual destructor.
+     */
+    virtual ~GpuResource() {}
+};
+
+/**
+ * @class GpuMemory
+ * @brief Central accounting of GPU memory with a budget and least-recently-drawn eviction.
+ *
+ * Evictable resources (vertex blocks) are freed, oldest first, when an allocation would exceed
+ * the budget; resources drawn in the current frame are never evicted. Pinned allocations
+ * (textures, render targets) are only accounted.
+ */
+class GpuMemory {
+public:
+    /**
+     * @brief Category of an allocation.
+     */
+    enum Category {
+        VERTICES, TEXTURES, TARGETS, CATEGORY_COUNT
+    };
+
+private:
+    std::vector<GpuResource *> resources; /**< Evictable resources. */
+    size_t used[CATEGORY_COUNT] = {}; /**< Bytes in use per category. */
+    size_t budget = (size_t) 512 << 20; /**< Bytes allowed in total. */
+    unsigned long frame = 1; /**< Current frame number. */
+    unsigned long evictions = 0; /**< Number of evicted resources. */
+    unsigned long reuploads = 0; /**< Number of evicted resources made resident again. */
+
+public:
+    /**
+     * @brief Sets the budget.
+     * @param bytes Bytes allowed in total.
+     */
+    void setBudget(size_t bytes) {
+        budget = bytes;
+    }
+
+    /**
+     * @brief Returns the bytes in use over all categories.
+     */
+    size_t total() const {
+        size_t sum = 0;
+        for (int c = 0; c < CATEGORY_COUNT; c++) sum += used[c];
+        return sum;
+    }
+
+    /**
+     * @brief Returns the bytes in use in a category.
+     */
+    size_t usage(Category c) const {
+        return used[c];
+    }
+
+    /**
+     * @brief Returns the number of evicted resources.
+     */
+    unsigned long getEvictions() const {
+        return evictions;
+    }
+
+    /**
+     * @brief Returns the number of evicted resources made resident again.
+     */
+    unsigned long getReuploads() const {
+        return reuploads;
+    }
+
+    /**
+     * @brief Registers an evictable resource.
+     */
+    void add(GpuResource *r) {
+        resources.push_back(r);
+    }
+
+    /**
+     * @brief Unregisters a resource that is being destroyed, accounting its allocation as freed.
+     */
+    void remove(GpuResource *r) {
+        release(r);
+        resources.erase(std::remove(resources.begin(), resources.end(), r), resources.end());
+    }
+
+    /**
+     * @brief Makes room for a resource within the budget and accounts it as resident.
+     * @param r The resource.
+     * @param reupload Whether the resource was evicted before.
+     */
+    void allocate(GpuResource *r, bool reupload) {
+        while (total() + r->bytes > budget) {
+            GpuResource *victim = NULL;
+            for (size_t i = 0; i < resources.size(); i++) {
+                GpuResource *c = resources[i];
+                if (c != r && c->resident && c->lastUsed < frame && (!victim || c->lastUsed < victim->lastUsed)) {
+                    victim = c;
+                }
+            }
+            if (!victim) break;
+            victim->evict();
+            release(victim);
+            evictions++;
+        }
+        used[r->category] += r->bytes;
+        r->resident = true;
+        r->lastUsed = frame;
+        if (reupload) reuploads++;
+    }
+
+    /**
+     * @brief Accounts a resource as freed.
+     */
+    void release(GpuResource *r) {
+        if (!r->resident) return;
+        used[r->category] -= r->bytes;
+        r->resident = false;
+    }
+
+    /**
+     * @brief Marks a resource as drawn in the current frame.
+     */
+    void touch(GpuResource *r) {
+        r->lastUsed = frame;
+    }
+
+    /**
+     * @brief Accounts a pinned allocation, which is never evicted.
+     * @param c Category of the allocation.
+     * @param bytes Size of the allocation, negative when it is freed.
+     */
+    void pin(Category c, long long bytes) {
+        used[c] += bytes;
+    }
+
+    /**
+     * @brief Closes the current frame.
+     */
+    void endFrame() {
+        frame++;
+    }
+
+    /**
+     * @brief Prints the usage per category and the eviction counters to the console.
+     */
+    void print() const {
+        printf("GPU memory: %.2f of %.2f MB (vertices %.2f, textures %.2f, targets %.2f), %lu evictions, %lu re-uploads\n",
+               total() / 1048576.0, budget / 1048576.0, used[VERTICES] / 1048576.0, used[TEXTURES] / 1048576.0,
+               used[TARGETS] / 1048576.0, evictions, reuploads);
+    }
+};
+
+GpuMemory gpuMemory; /**< Residency manager of the GPU allocations. */
+
+/**
+ * @class WorldCamera
+ * @brief Camera of the viewport being drawn, kept in double precision.
+ *
+ * Every GPU block of an Object stores its vertices relative to its own origin. Before a block is
+ * drawn, the MVP uniform is set to the camera transform with that origin folded in; the offsets
+ * are computed in double, so only small camera-relative values are rounded to float and the
+ * geometry stays steady at any zoom. A block whose origin is too far from the camera for float
+ * precision at the current pixel size is re-based and re-uploaded. The new origin is the center of
+ * the finest view of the frame that sees the block, so every view picks the same one and a block
+ * seen by an overview and a detail view is re-based once, not once per view and frame.
+ *
+ * Origins are kept per GPU block rather than per chunk: a block is drawn with one MVP uniform, so
+ * an origin per chunk would split every draw call into chunksPerBlock calls, while a re-base only
+ * happens when a view moves far, and then re-uploads the chunks of the block it has to anyway.
+ */
+class WorldCamera {
+public:
+    /**
+     * @struct View
+     * @brief A viewport drawn in the current frame.
+     */
+    struct View {
+        dvec3 center; /**< World point in the middle of the viewport. */
+        double pixel; /**< World size of a pixel of the viewport. */
+        vec4 visible; /**< World rectangle (min x, min y, max x, max y) seen by the viewport. */
+    };
+
+private:
+    std::vector<View> views; /**< Viewports of the current frame. */
+    bool active = false; /**< Whether a viewport is being drawn. */
+    dvec3 center; /**< World point in the middle of the viewport. */
+    double zoom = 1; /**< Magnification of the viewport. */
+    double pixel = 1; /**< World size of a pixel of the viewport. */
+    int location = -1; /**< Location of the MVP uniform. */
+    float angle = 0; /**< Rotation of the drawn geometry about pivot. */
+    dvec3 pivot; /**< Center of the rotation. */
+    dvec3 offset; /**< Translation of the drawn geometry after the rotation. */
+    unsigned long rebases = 0; /**< Number of blocks re-based so far. */
+
+public:
+    /**
+     * @brief Sets the viewports of the frame, before any of them is drawn.
+     */
+    void beginFrame() {
+        views.clear();
+    }
+
+    /**
+     * @brief Adds a viewport of the frame.
+     * @param center World point in the middle of the viewport.
+     * @param zoom Magnification, 1 shows the [-1, 1] square.
+     * @param widthPixels Width of the viewport in pixels.
+     * @param visible World rectangle (min x, min y, max x, max y) seen by the viewport.
+     */
+    void addView(const dvec3 &center, double zoom, int widthPixels, const vec4 &visible) {
+        View view = {center, 2.0 / (zoom * (widthPixels > 0 ? widthPixels : 1)), visible};
+        views.push_back(view);
+    }
+
+    /**
+     * @brief Starts drawing a viewport.
+     * @param center World point in the middle of the viewport.
+     * @param zoom Magnification, 1 shows the [-1, 1] square.
+     * @param widthPixels Width of the viewport in pixels.
+     * @param location Location of the MVP uniform.
+     */
+    void begin(const dvec3 &center, double zoom, int widthPixels, int location) {
+        this->center = center;
+        this->zoom = zoom;
+        this->pixel = 2.0 / (zoom * (widthPixels > 0 ? widthPixels : 1));
+        this->location = location;
+        active = true;
+    }
+
+    /**
+     * @brief Stops drawing through the camera; objects then use the MVP uniform as it is.
+     */
+    void end() {
+        active = false;
+    }
+
+    /**
+     * @brief Returns whether a viewport is being drawn.
+     */
+    bool isActive() const {
+        return active;
+    }
+
+    /**
+     * @brief Rotates the following draws by angle about pivot, then translates them by offset.
+     */
+    void setTransform(float angle, const dvec3 &pivot, const dvec3 &offset) {
+        this->angle = angle;
+        this->pivot = pivot;
+        this->offset = offset;
+    }
+
+    /**
+     * @brief Removes the transform of the following draws.
+     */
+    void clearTransform() {
+        setTransform(0, dvec3(), dvec3());
+    }
+
+    /**
+     * @brief Returns whether vertices relative to an origin lose precision at the current pixel size.
+     */
+    bool needsRebase(const dvec3 &origin) const {
+        double dx = origin.x - center.x, dy = origin.y - center.y;
+        return sqrt(dx * dx + dy * dy) * 1.2e-7 > pixel * 0.05;    // float epsilon against a twentieth of a pixel
+    }
+
+    /**
+     * @brief Re-bases an origin to the center of the finest view of the frame that sees the block.
+     * @param origin The origin of the block, changed if a re-base is needed.
+     * @param sees Returns whether the block has vertices in a world rectangle.
+     * @return True if the origin changed and the block must be re-uploaded.
+     */
+    template<typename Sees>
+    bool rebase(dvec3 &origin, Sees sees) {
+        if (!needsRebase(origin)) return false;
+        dvec3 target = center;
+        double finest = INFINITY;
+        for (size_t v = 0; v < views.size(); v++) {
+            if (views[v].pixel < finest && sees(views[v].visible)) {
+                finest = views[v].pixel;
+                target = views[v].center;
+            }
+        }
+        if (origin.x == target.x && origin.y == target.y) return false;    // a coarser view cannot do better
+        origin = dvec3(target.x, target.y, 0);
+        rebases++;
+        return true;
+    }
+
+    /**
+     * @brief Returns the number of blocks re-based so far.
+     */
+    unsigned long getRebases() const {
+        return rebases;
+    }
+
+    /**
+     * @brief Sets the MVP uniform for vertices stored relative to an origin.
+     */
+    void apply(const dvec3 &origin) const {
+        double c = cos(angle), s = sin(angle);
+        double rx = origin.x - pivot.x, ry = origin.y - pivot.y;
+        double tx = (c * rx - s * ry + pivot.x + offset.x - center.x) * zoom;
+        double ty = (s * rx + c * ry + pivot.y + offset.y - center.y) * zoom;
+        mat4 m((float) (c * zoom), (float) (s * zoom), 0, 0,
+               (float) (-s * zoom), (float) (c * zoom), 0, 0,
+               0, 0, 1, 0,
+               (float) tx, (float) ty, 0, 1);
+        glUniformMatrix4fv(location, 1, GL_TRUE, m);
+    }
+};
+
+WorldCamera camera; /**< Camera of the viewport being drawn. */
+
+/**
+ * @class Object
+ * @brief Represents an object with vertices stored in a chunked array and a pool of fixed-size GPU blocks.
+ *
+ * Every GPU block holds chunksPerBlock chunks of the array in its own buffer, so growing the object
+ * only adds blocks: nothing is reallocated or copied on the CPU or on the GPU. Blocks are accounted
+ * by gpuMemory, which may evict the ones not drawn recently; they are re-uploaded when drawn again.
+ */
+class Object {
+public:
+    static const size_t chunksPerBlock = 16; /**< Number of chunks in a GPU block. */
+    static const size_t blockSize = chunksPerBlock * ChunkedArray<dvec3>::chunkSize; /**< Vertices in a GPU block. */
+
+private:
+    /**
+     * @class GpuBlock
+     * @brief Buffer of a block and the VAO reading it.
+     */
+    class GpuBlock : public GpuResource {
+    public:
+        Object *owner; /**< Object the block belongs to. */
+        size_t index; /**< Index of the block in the object. */
+        unsigned int vao = 0; /**< Vertex Array Object (VAO) ID. */
+        unsigned int vbo = 0; /**< Vertex Buffer Object (VBO) ID. */
+        dvec3 origin; /**< World position the vertices of the block are stored relative to. */
+
+        /**
+         * @brief Destructor, frees the buffers and unregisters the block from gpuMemory.
+         * The chunk stamps of the owner are not touched, they may already be destroyed.
+         */
+        ~GpuBlock() {
+            if (resident) {
+                glDeleteVertexArrays(1, &vao);
+                glDeleteBuffers(1, &vbo);
+            }
+            gpuMemory.remove(this);
+        }
+
+        /**
+         * @brief Frees the buffers and marks the chunks of the block as not uploaded.
+         */
+        void evict() override {
+            glDeleteVertexArrays(1, &vao);
+            glDeleteBuffers(1, &vbo);
+            vao = vbo = 0;
+            for (size_t c = index * chunksPerBlock; c < (index + 1) * chunksPerBlock && c < owner->uploaded.size(); c++) {
+                owner->uploaded[c] = 0;
+            }
+        }
+    };
+
+    ChunkedArray<dvec3> vtx; /**< Copy-on-write storage of the vertices of the object. */
+    std::vector<std::unique_ptr<GpuBlock> > blocks; /**< GPU blocks, block b holds vertices [b * blockSize, (b + 1) * blockSize). */
+    std::vector<unsigned long> uploaded; /**< Stamp of each chunk as last uploaded to its block. */
+    std::vector<vec4> chunkBounds; /**< Bounding rectangle (min x, min y, max x, max y) of each chunk. */
+    std::vector<unsigned long> boundsStamps; /**< Stamp of each chunk when its bounds were computed. */
+    const char *label = NULL; /**< Name of the buffers for GL debuggers. */
+
+    /**
+     * @brief Creates the buffers of a block within the memory budget.
+     * @param block The block.
+     * @param reupload Whether the block was evicted before.
+     */
+    void makeResident(GpuBlock &block, bool reupload) {
+        gpuMemory.allocate(&block, reupload);
+        glGenVertexArrays(1, &block.vao);
+        glBindVertexArray(block.vao);
+        glGenBuffers(1, &block.vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, block.vbo);
+        glBufferData(GL_ARRAY_BUFFER, blockSize * sizeof(vec3), NULL, GL_DYNAMIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+        if (label) {
+            glDebug.label(GL_VERTEX_ARRAY, block.vao, label);
+            glDebug.label(GL_BUFFER, block.vbo, label);
+        }
+    }
+
+    /**
+     * @brief Appends a GPU block.
+     */
+    void addBlock() {
+        GpuBlock *block = new GpuBlock();
+        block->owner = this;
+        block->index = blocks.size();
+        block->bytes = blockSize * sizeof(vec3);
+        block->category = GpuMemory::VERTICES;
+        blocks.push_back(std::unique_ptr<GpuBlock>(block));
+        gpuMemory.add(block);
+        makeResident(*block, false);
+    }
+
+public:
+    /**
+     * @brief Getter function for the vertex storage.
+     * @return Reference to the vertex storage.
+     */
+    ChunkedArray<dvec3> &Vtx() {
+        return vtx;
+    }
+
+    /**
+     * @brief Names the buffers of the object for GL debuggers and profilers.
+     * @param name The name to show.
+     */
+    void setLabel(const char *name) {
+        label = name;
+        for (size_t b = 0; b < blocks.size(); b++) {
+            if (!blocks[b]->resident) continue;
+            glDebug.label(GL_VERTEX_ARRAY, blocks[b]->vao, name);
+            glDebug.label(GL_BUFFER, blocks[b]->vbo, name);
+        }
+    }
+
+    /**
+     * @brief Updates the resident GPU blocks with the chunks that changed since the last upload.
+     * Chunks of evicted blocks are uploaded when the block is drawn again.
+     */
+    void updateGpu() {
+        while (blocks.size() * blockSize < vtx.size()) addBlock();
+        uploaded.resize(vtx.chunks(), 0);
+        chunkBounds.resize(vtx.chunks());
+        boundsStamps.resize(vtx.chunks(), 0);
+        std::vector<unsigned long> &stamps = uploaded;
+        std::vector<std::unique_ptr<GpuBlock> > &pool = blocks;
+        std::vector<vec4> &bounds = chunkBounds;
+        std::vector<unsigned long> &bStamps = boundsStamps;
+        std::vector<vec3> relative;
+        vtx.forEachChunk([&](size_t chunk, const dvec3 *data, size_t n, unsigned long stamp) {
+            if (bStamps[chunk] != stamp) {
+                vec4 b((float) data[0].x, (float) data[0].y, (float) data[0].x, (float) data[0].y);
+                for (size_t i = 1; i < n; i++) {
+                    b.x = fminf(b.x, (float) data[i].x);
+                    b.y = fminf(b.y, (float) data[i].y);
+                    b.z = fmaxf(b.z, (float) data[i].x);
+                    b.w = fmaxf(b.w, (float) data[i].y);
+                }
+                bounds[chunk] = b;
+                bStamps[chunk] = stamp;
+            }
+            GpuBlock &block = *pool[chunk / chunksPerBlock];
+            if (stamps[chunk] == stamp || !block.resident) return;
+            relative.resize(n);
+            for (size_t i = 0; i < n; i++) {
+                relative[i] = vec3((float) (data[i].x - block.origin.x), (float) (data[i].y - block.origin.y), (float) data[i].z);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, block.vbo);
+            glBufferSubData(GL_ARRAY_BUFFER, (chunk % chunksPerBlock) * ChunkedArray<dvec3>::chunkSize * sizeof(vec3),
+                            n * sizeof(vec3), &relative[0]);
+            frameStats.uploadBytes += n * sizeof(vec3);
+            stamps[chunk] = stamp;
+        });
+    }
+
+    /**
+     * @brief Checks whether a GPU block has vertices inside a rectangle.
+     * @param b Index of the block.
+     * @param view The rectangle (min x, min y, max x, max y).
+     */
+    bool blockVisible(size_t b, const vec4 &view) const {
+        for (size_t c = b * chunksPerBlock; c < (b + 1) * chunksPerBlock && c < chunkBounds.size(); c++) {
+            const vec4 &cb = chunkBounds[c];
+            if (cb.x <= view.z && cb.z >= view.x && cb.y <= view.w && cb.w >= view.y) return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief Draws the object with the specified drawing type and color, one draw call per GPU block.
+     * Blocks outside the view rectangle are skipped; evicted blocks are made resident and re-uploaded first.
+     * While a viewport is drawn through the camera, visible blocks too far from it are re-based first.
+     * @param type The type of drawing to perform (e.g., GL_TRIANGLES, GL_LINES, etc.).
+     * @param color The color of the object.
+     * @param view World rectangle (min x, min y, max x, max y) seen by the camera.
+     */
+    void Draw(int type, vec3 color, vec4 view = vec4(-1e30f, -1e30f, 1e30f, 1e30f)) {
+        gpuProgram.setUniform(color, "color");
+        bool reuploaded = false;
+        for (size_t b = 0; b < blocks.size() && b * blockSize < vtx.size(); b++) {
+            if (!blockVisible(b, view)) continue;
+            if (!blocks[b]->resident) {
+                makeResident(*blocks[b], true);
+                reuploaded = true;
+            }
+            if (camera.isActive() && camera.rebase(blocks[b]->origin, [this, b](const vec4 &rect) { return blockVisible(b, rect); })) {
+                for (size_t c = b * chunksPerBlock; c < (b + 1) * chunksPerBlock && c < uploaded.size(); c++) uploaded[c] = 0;
+                reuploaded = true;
+            }
+        }
+        if (reuploaded) updateGpu();
+        for (size_t b = 0; b < blocks.size() && b * blockSize < vtx.size(); b++) {
+            if (!blocks[b]->resident || !blockVisible(b, view)) continue;
+            size_t n = vtx.size() - b * blockSize < blockSize ? vtx.size() - b * blockSize : blockSize;
+            gpuMemory.touch(blocks[b].get());
+            if (camera.isActive()) camera.apply(blocks[b]->origin);
+            glBindVertexArray(blocks[b]->vao);
+            glDrawArrays(type, 0, (GLsizei) n);
+            frameStats.drawCalls++;
+        }
+    }
+
+    /**
+     * @brief Returns the number of vertices in the object.
+     * @return The number of vertices.
+     */
+    size_t size() const {
+        return vtx.size();
+    }
+};
+
+/**
+ * @struct GeometryKernels
+ * @brief Inner loops of the geometry queries compiled for one instruction set.
+ *
+ * The build has no architecture flags, so every table except the scalar one is compiled with
+ * target attributes and only called after KernelDispatch has checked the CPU supports it.
+ */
+struct GeometryKernels {
+    const char *name; /**< Name of the instruction set, as accepted by POINTSLINES_KERNELS. */
+    /** Returns the index of the point nearest to (x, y) with a squared distance below best and lowers best, or returns n. */
+    size_t (*nearestPoint)(const dvec3 *pts, size_t n, double x, double y, double &best);
+    /** Same for the lines given by four vertices each (the first two define the line), with the distance itself. */
+    size_t (*nearestLine)(const dvec3 *vtx, size_t lineCount, double x, double y, double &best);
+    /** Appends the intersections of line (a, b, c) with n lines given as coefficient arrays that fall inside [-1, 1]². */
+    void (*intersectRow)(double a, double b, double c, const double *a2, const double *b2, const double *c2, size_t n, std::vector<dvec3> &out);
+    /** Multiplies n row vectors with a matrix. */
+    void (*transform)(const mat4 &m, const vec4 *in, vec4 *out, size_t n);
+};
+
+/**
+ * @brief Scalar reference of GeometryKernels::nearestPoint.
+ */
+size_t nearestPointScalar(const dvec3 *pts, size_t n, double x, double y, double &best) {
+    size_t nearest = n;
+    for (size_t i = 0; i < n; i++) {
+        double dx = pts[i].x - x, dy = pts[i].y - y;
+        double d2 = dx * dx + dy * dy;
+        if (d2 < best) {
+            best = d2;
+            nearest = i;
+        }
+    }
+    return nearest;
+}
+
+/**
+ * @brief Scalar reference of GeometryKernels::nearestLine.
+ *
+ * The distance is |cross(p2 - p1, q - p1)| / |p2 - p1|; degenerate lines give NaN and are never chosen.
+ */
+size_t nearestLineScalar(const dvec3 *vtx, size_t lineCount, double x, double y, double &best) {
+    size_t nearest = lineCount;
+    for (size_t k = 0; k < lineCount; k++) {
+        const dvec3 &p1 = vtx[4 * k], &p2 = vtx[4 * k + 1];
+        double lx = p2.x - p1.x, ly = p2.y - p1.y;
+        double d = fabs(lx * (y - p1.y) - ly * (x - p1.x)) / sqrt(lx * lx + ly * ly);
+        if (d < best) {
+            best = d;
+            nearest = k;
+        }
+    }
+    return nearest;
+}
+
+/**
+ * @brief Scalar reference of GeometryKernels::intersectRow.
+ */
+void intersectRowScalar(double a1, double b1, double c1, const double *a2, const double *b2, const double *c2, size_t n, std::vector<dvec3> &out) {
+    for (size_t j = 0; j < n; j++) {
+        double determinant = a1 * b2[j] - a2[j] * b1;
+        if (determinant == 0) continue;
+        double x = (b1 * c2[j] - b2[j] * c1) / determinant;
+        double y = (a2[j] * c1 - a1 * c2[j]) / determinant;
+        if (fabs(x) <= 1 && fabs(y) <= 1) out.push_back(dvec3(x, y, 1));
+    }
+}
+
+/**
+ * @brief Scalar reference of GeometryKernels::transform.
+ */
+void transformScalar(const mat4 &m, const vec4 *in, vec4 *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = in[i] * m;
+}
+
+/**
+ * @brief Reduces the per-lane minima of a vectorized search to the first index of the smallest value.
+ * @param laneBest Smallest value seen by every lane.
+ * @param laneIndex Index where every lane saw it, -1 if the lane never went below best.
+ * @param lanes Number of lanes.
+ * @param best The bound of the search, lowered to the result.
+ * @param none Value returned if no lane went below best.
+ */
+size_t reduceLanes(const double *laneBest, const double *laneIndex, int lanes, double &best, size_t none) {
+    size_t nearest = none;
+    for (int l = 0; l < lanes; l++) {
+        if (laneIndex[l] < 0) continue;
+        if (laneBest[l] < best || (laneBest[l] == best && (size_t) laneIndex[l] < nearest)) {
+            best = laneBest[l];
+            nearest = (size_t) laneIndex[l];
+        }
+    }
+    return nearest;
+}
+
+#ifdef GEOMETRY_X86
+/**
+ * @brief SSE4.2 version of GeometryKernels::nearestPoint, two points per step.
+ */
+KERNEL_TARGET("sse4.2")
+size_t nearestPointSse42(const dvec3 *pts, size_t n, double x, double y, double &best) {
+    __m128d qx = _mm_set1_pd(x), qy = _mm_set1_pd(y);
+    __m128d laneBest = _mm_set1_pd(best), laneIndex = _mm_set1_pd(-1);
+    __m128d index = _mm_set_pd(1, 0), step = _mm_set1_pd(2);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m128d p0 = _mm_loadu_pd(&pts[i].x), p1 = _mm_loadu_pd(&pts[i + 1].x);
+        __m128d dx = _mm_sub_pd(_mm_unpacklo_pd(p0, p1), qx);
+        __m128d dy = _mm_sub_pd(_mm_unpackhi_pd(p0, p1), qy);
+        __m128d d2 = _mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy));
+        __m128d closer = _mm_cmplt_pd(d2, laneBest);
+        laneBest = _mm_blendv_pd(laneBest, d2, closer);
+        laneIndex = _mm_blendv_pd(laneIndex, index, closer);
+        index = _mm_add_pd(index, step);
+    }
+    double lb[2], li[2];
+    _mm_storeu_pd(lb, laneBest);
+    _mm_storeu_pd(li, laneIndex);
+    size_t nearest = reduceLanes(lb, li, 2, best, n);
+    size_t tail = nearestPointScalar(pts + i, n - i, x, y, best);
+    return tail != n - i ? i + tail : nearest;
+}
+
+/**
+ * @brief SSE4.2 version of GeometryKernels::nearestLine, two lines per step.
+ */
+KERNEL_TARGET("sse4.2")
+size_t nearestLineSse42(const dvec3 *vtx, size_t lineCount, double x, double y, double &best) {
+    __m128d qx = _mm_set1_pd(x), qy = _mm_set1_pd(y), sign = _mm_set1_pd(-0.0);
+    __m128d laneBest = _mm_set1_pd(best), laneIndex = _mm_set1_pd(-1);
+    __m128d index = _mm_set_pd(1, 0), step = _mm_set1_pd(2);
+    size_t k = 0;
+    for (; k + 2 <= lineCount; k += 2) {
+        __m128d s0 = _mm_loadu_pd(&vtx[4 * k].x), s1 = _mm_loadu_pd(&vtx[4 * k + 4].x);
+        __m128d e0 = _mm_loadu_pd(&vtx[4 * k + 1].x), e1 = _mm_loadu_pd(&vtx[4 * k + 5].x);
+        __m128d x1 = _mm_unpacklo_pd(s0, s1), y1 = _mm_unpackhi_pd(s0, s1);
+        __m128d lx = _mm_sub_pd(_mm_unpacklo_pd(e0, e1), x1), ly = _mm_sub_pd(_mm_unpackhi_pd(e0, e1), y1);
+        __m128d c = _mm_sub_pd(_mm_mul_pd(lx, _mm_sub_pd(qy, y1)), _mm_mul_pd(ly, _mm_sub_pd(qx, x1)));
+        __m128d d = _mm_div_pd(_mm_andnot_pd(sign, c), _mm_sqrt_pd(_mm_add_pd(_mm_mul_pd(lx, lx), _mm_mul_pd(ly, ly))));
+        __m128d closer = _mm_cmplt_pd(d, laneBest);
+        laneBest = _mm_blendv_pd(laneBest, d, closer);
+        laneIndex = _mm_blendv_pd(laneIndex, index, closer);
+        index = _mm_add_pd(index, step);
+    }
+    double lb[2], li[2];
+    _mm_storeu_pd(lb, laneBest);
+    _mm_storeu_pd(li, laneIndex);
+    size_t nearest = reduceLanes(lb, li, 2, best, lineCount);
+    size_t tail = nearestLineScalar(vtx + 4 * k, lineCount - k, x, y, best);
+    return tail != lineCount - k ? k + tail : nearest;
+}
+
+/**
+ * @brief SSE4.2 version of GeometryKernels::intersectRow, two lines per step.
+ */
+KERNEL_TARGET("sse4.2")
+void intersectRowSse42(double a1, double b1, double c1, const double *a2, const double *b2, const double *c2, size_t n, std::vector<dvec3> &out) {
+    __m128d a = _mm_set1_pd(a1), b = _mm_set1_pd(b1), c = _mm_set1_pd(c1);
+    __m128d zero = _mm_setzero_pd(), one = _mm_set1_pd(1), sign = _mm_set1_pd(-0.0);
+    size_t j = 0;
+    for (; j + 2 <= n; j += 2) {
+        __m128d a2v = _mm_loadu_pd(a2 + j), b2v = _mm_loadu_pd(b2 + j), c2v = _mm_loadu_pd(c2 + j);
+        __m128d determinant = _mm_sub_pd(_mm_mul_pd(a, b2v), _mm_mul_pd(a2v, b));
+        __m128d x = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(b, c2v), _mm_mul_pd(b2v, c)), determinant);
+        __m128d y = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(a2v, c), _mm_mul_pd(a, c2v)), determinant);
+        __m128d inside = _mm_and_pd(_mm_cmpneq_pd(determinant, zero),
+                                    _mm_and_pd(_mm_cmple_pd(_mm_andnot_pd(sign, x), one), _mm_cmple_pd(_mm_andnot_pd(sign, y), one)));
+        int mask = _mm_movemask_pd(inside);
+        if (!mask) continue;
+        double xs[2], ys[2];
+        _mm_storeu_pd(xs, x);
+        _mm_storeu_pd(ys, y);
+        for (int l = 0; l < 2; l++) {
+            if (mask & (1 << l)) out.push_back(dvec3(xs[l], ys[l], 1));
+        }
+    }
+    intersectRowScalar(a1, b1, c1, a2 + j, b2 + j, c2 + j, n - j, out);
+}
+
+/**
+ * @brief SSE4.2 version of GeometryKernels::transform, one vector per step.
+ */
+KERNEL_TARGET("sse4.2")
+void transformSse42(const mat4 &m, const vec4 *in, vec4 *out, size_t n) {
+    __m128 r0 = _mm_loadu_ps(&m.rows[0].x), r1 = _mm_loadu_ps(&m.rows[1].x);
+    __m128 r2 = _mm_loadu_ps(&m.rows[2].x), r3 = _mm_loadu_ps(&m.rows[3].x);
+    for (size_t i = 0; i < n; i++) {
+        __m128 v = _mm_loadu_ps(&in[i].x);
+        __m128 r = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(v, v, 0x00), r0),
+                                                    _mm_mul_ps(_mm_shuffle_ps(v, v, 0x55), r1)),
+                                         _mm_mul_ps(_mm_shuffle_ps(v, v, 0xAA), r2)),
+                              _mm_mul_ps(_mm_shuffle_ps(v, v, 0xFF), r3));
+        _mm_storeu_ps(&out[i].x, r);
+    }
+}
+
+/**
+ * @brief AVX2 version of GeometryKernels::nearestPoint, four points gathered per step.
+ */
+KERNEL_TARGET("avx2")
+size_t nearestPointAvx2(const dvec3 *pts, size_t n, double x, double y, double &best) {
+    const __m256i offsets = _mm256_set_epi64x(9, 6, 3, 0);
+    __m256d qx = _mm256_set1_pd(x), qy = _mm256_set1_pd(y);
+    __m256d laneBest = _mm256_set1_pd(best), laneIndex = _mm256_set1_pd(-1);
+    __m256d index = _mm256_set_pd(3, 2, 1, 0), step = _mm256_set1_pd(4);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const double *base = &pts[i].x;
+        __m256d dx = _mm256_sub_pd(_mm256_i64gather_pd(base, offsets, 8), qx);
+        __m256d dy = _mm256_sub_pd(_mm256_i64gather_pd(base + 1, offsets, 8), qy);
+        __m256d d2 = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+        __m256d closer = _mm256_cmp_pd(d2, laneBest, _CMP_LT_OQ);
+        laneBest = _mm256_blendv_pd(laneBest, d2, closer);
+        laneIndex = _mm256_blendv_pd(laneIndex, index, closer);
+        index = _mm256_add_pd(index, step);
+    }
+    double lb[4], li[4];
+    _mm256_storeu_pd(lb, laneBest);
+    _mm256_storeu_pd(li, laneIndex);
+    size_t nearest = reduceLanes(lb, li, 4, best, n);
+    size_t tail = nearestPointScalar(pts + i, n - i, x, y, best);
+    return tail != n - i ? i + tail : nearest;
+}
+
+/**
+ * @brief AVX2 version of GeometryKernels::nearestLine, four lines gathered per step.
+ */
+KERNEL_TARGET("avx2")
+size_t nearestLineAvx2(const dvec3 *vtx, size_t lineCount, double x, double y, double &best) {
+    const __m256i offsets = _mm256_set_epi64x(36, 24, 12, 0);
+    __m256d qx = _mm256_set1_pd(x), qy = _mm256_set1_pd(y), sign = _mm256_set1_pd(-0.0);
+    __m256d laneBest = _mm256_set1_pd(best), laneIndex = _mm256_set1_pd(-1);
+    __m256d index = _mm256_set_pd(3, 2, 1, 0), step = _mm256_set1_pd(4);
+    size_t k = 0;
+    for (; k + 4 <= lineCount; k += 4) {
+        const double *base = &vtx[4 * k].x;
+        __m256d x1 = _mm256_i64gather_pd(base, offsets, 8), y1 = _mm256_i64gather_pd(base + 1, offsets, 8);
+        __m256d lx = _mm256_sub_pd(_mm256_i64gather_pd(base + 3, offsets, 8), x1);
+        __m256d ly = _mm256_sub_pd(_mm256_i64gather_pd(base + 4, offsets, 8), y1);
+        __m256d c = _mm256_sub_pd(_mm256_mul_pd(lx, _mm256_sub_pd(qy, y1)), _mm256_mul_pd(ly, _mm256_sub_pd(qx, x1)));
+        __m256d d = _mm256_div_pd(_mm256_andnot_pd(sign, c),
+                                  _mm256_sqrt_pd(_mm256_add_pd(_mm256_mul_pd(lx, lx), _mm256_mul_pd(ly, ly))));
+        __m256d closer = _mm256_cmp_pd(d, laneBest, _CMP_LT_OQ);
+        laneBest = _mm256_blendv_pd(laneBest, d, closer);
+        laneIndex = _mm256_blendv_pd(laneIndex, index, closer);
+        index = _mm256_add_pd(index, step);
+    }
+    double lb[4], li[4];
+    _mm256_storeu_pd(lb, laneBest);
+    _mm256_storeu_pd(li, laneIndex);
+    size_t nearest = reduceLanes(lb, li, 4, best, lineCount);
+    size_t tail = nearestLineScalar(vtx + 4 * k, lineCount - k, x, y, best);
+    return tail != lineCount - k ? k + tail : nearest;
+}
+
+/**
+ * @brief AVX2 version of GeometryKernels::intersectRow, four lines per step.
+ */
+KERNEL_TARGET("avx2")
+void intersectRowAvx2(double a1, double b1, double c1, const double *a2, const double *b2, const double *c2, size_t n, std::vector<dvec3> &out) {
+    __m256d a = _mm256_set1_pd(a1), b = _mm256_set1_pd(b1), c = _mm256_set1_pd(c1);
+    __m256d zero = _mm256_setzero_pd(), one = _mm256_set1_pd(1), sign = _mm256_set1_pd(-0.0);
+    size_t j = 0;
+    for (; j + 4 <= n; j += 4) {
+        __m256d a2v = _mm256_loadu_pd(a2 + j), b2v = _mm256_loadu_pd(b2 + j), c2v = _mm256_loadu_pd(c2 + j);
+        __m256d determinant = _mm256_sub_pd(_mm256_mul_pd(a, b2v), _mm256_mul_pd(a2v, b));
+        __m256d x = _mm256_div_pd(_mm256_sub_pd(_mm256_mul_pd(b, c2v), _mm256_mul_pd(b2v, c)), determinant);
+        __m256d y = _mm256_div_pd(_mm256_sub_pd(_mm256_mul_pd(a2v, c), _mm256_mul_pd(a, c2v)), determinant);
+        __m256d inside = _mm256_and_pd(_mm256_cmp_pd(determinant, zero, _CMP_NEQ_OQ),
+                                       _mm256_and_pd(_mm256_cmp_pd(_mm256_andnot_pd(sign, x), one, _CMP_LE_OQ),
+                                                     _mm256_cmp_pd(_mm256_andnot_pd(sign, y), one, _CMP_LE_OQ)));
+        int mask = _mm256_movemask_pd(inside);
+        if (!mask) continue;
+        double xs[4], ys[4];
+        _mm256_storeu_pd(xs, x);
+        _mm256_storeu_pd(ys, y);
+        for (int l = 0; l < 4; l++) {
+            if (mask & (1 << l)) out.push_back(dvec3(xs[l], ys[l], 1));
+        }
+    }
+    intersectRowScalar(a1, b1, c1, a2 + j, b2 + j, c2 + j, n - j, out);
+}
+
+/**
+ * @brief AVX2 version of GeometryKernels::transform, two vectors per step.
+ */
+KERNEL_TARGET("avx2")
+void transformAvx2(const mat4 &m, const vec4 *in, vec4 *out, size_t n) {
+    __m256 r0 = _mm256_broadcast_ps((const __m128 *) &m.rows[0]), r1 = _mm256_broadcast_ps((const __m128 *) &m.rows[1]);
+    __m256 r2 = _mm256_broadcast_ps((const __m128 *) &m.rows[2]), r3 = _mm256_broadcast_ps((const __m128 *) &m.rows[3]);
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        __m256 v = _mm256_loadu_ps(&in[i].x);
+        __m256 r = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_permute_ps(v, 0x00), r0),
+                                                             _mm256_mul_ps(_mm256_permute_ps(v, 0x55), r1)),
+                                               _mm256_mul_ps(_mm256_permute_ps(v, 0xAA), r2)),
+                                 _mm256_mul_ps(_mm256_permute_ps(v, 0xFF), r3));
+        _mm256_storeu_ps(&out[i].x, r);
+    }
+    transformScalar(m, in + i, out + i, n - i);
+}
+
+/**
+ * @brief AVX-512 version of GeometryKernels::nearestPoint, eight points gathered per step.
+ */
+KERNEL_TARGET("avx512f")
+size_t nearestPointAvx512(const dvec3 *pts, size_t n, double x, double y, double &best) {
+    const __m512i offsets = _mm512_set_epi64(21, 18, 15, 12, 9, 6, 3, 0);
+    __m512d qx = _mm512_set1_pd(x), qy = _mm512_set1_pd(y);
+    __m512d laneBest = _mm512_set1_pd(best), laneIndex = _mm512_set1_pd(-1);
+    __m512d index = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0), step = _mm512_set1_pd(8);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        const double *base = &pts[i].x;
+        __m512d dx = _mm512_sub_pd(_mm512_i64gather_pd(offsets, base, 8), qx);
+        __m512d dy = _mm512_sub_pd(_mm512_i64gather_pd(offsets, base + 1, 8), qy);
+        __m512d d2 = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+        __mmask8 closer = _mm512_cmp_pd_mask(d2, laneBest, _CMP_LT_OQ);
+        laneBest = _mm512_mask_mov_pd(laneBest, closer, d2);
+        laneIndex = _mm512_mask_mov_pd(laneIndex, closer, index);
+        index = _mm512_add_pd(index, step);
+    }
+    double lb[8], li[8];
+    _mm512_storeu_pd(lb, laneBest);
+    _mm512_storeu_pd(li, laneIndex);
+    size_t nearest = reduceLanes(lb, li, 8, best, n);
+    size_t tail = nearestPointScalar(pts + i, n - i, x, y, best);
+    return tail != n - i ? i + tail : nearest;
+}
+
+/**
+ * @brief AVX-512 version of GeometryKernels::nearestLine, eight lines gathered per step.
+ */
+KERNEL_TARGET("avx512f")
+size_t nearestLineAvx512(const dvec3 *vtx, size_t lineCount, double x, double y, double &best) {
+    const __m512i offsets = _mm512_set_epi64(84, 72, 60, 48, 36, 24, 12, 0);
+    __m512d qx = _mm512_set1_pd(x), qy = _mm512_set1_pd(y);
+    __m512d laneBest = _mm512_set1_pd(best), laneIndex = _mm512_set1_pd(-1);
+    __m512d index = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0), step = _mm512_set1_pd(8);
+    size_t k = 0;
+    for (; k + 8 <= lineCount; k += 8) {
+        const double *base = &vtx[4 * k].x;
+        __m512d x1 = _mm512_i64gather_pd(offsets, base, 8), y1 = _mm512_i64gather_pd(offsets, base + 1, 8);
+        __m512d lx = _mm512_sub_pd(_mm512_i64gather_pd(offsets, base + 3, 8), x1);
+        __m512d ly = _mm512_sub_pd(_mm512_i64gather_pd(offsets, base + 4, 8), y1);
+        __m512d c = _mm512_sub_pd(_mm512_mul_pd(lx, _mm512_sub_pd(qy, y1)), _mm512_mul_pd(ly, _mm512_sub_pd(qx, x1)));
+        __m512d d = _mm512_div_pd(_mm512_abs_pd(c), _mm512_sqrt_pd(_mm512_add_pd(_mm512_mul_pd(lx, lx), _mm512_mul_pd(ly, ly))));
+        __mmask8 closer = _mm512_cmp_pd_mask(d, laneBest, _CMP_LT_OQ);
+        laneBest = _mm512_mask_mov_pd(laneBest, closer, d);
+        laneIndex = _mm512_mask_mov_pd(laneIndex, closer, index);
+        index = _mm512_add_pd(index, step);
+    }
+    double lb[8], li[8];
+    _mm512_storeu_pd(lb, laneBest);
+    _mm512_storeu_pd(li, laneIndex);
+    size_t nearest = reduceLanes(lb, li, 8, best, lineCount);
+    size_t tail = nearestLineScalar(vtx + 4 * k, lineCount - k, x, y, best);
+    return tail != lineCount - k ? k + tail : nearest;
+}
+
+/**
+ * @brief AVX-512 version of GeometryKernels::intersectRow, eight lines per step compressed into the output.
+ */
+KERNEL_TARGET("avx512f")
+void intersectRowAvx512(double a1, double b1, double c1, const double *a2, const double *b2, const double *c2, size_t n, std::vector<dvec3> &out) {
+    __m512d a = _mm512_set1_pd(a1), b = _mm512_set1_pd(b1), c = _mm512_set1_pd(c1);
+    __m512d zero = _mm512_setzero_pd(), one = _mm512_set1_pd(1);
+    size_t j = 0;
+    for (; j + 8 <= n; j += 8) {
+        __m512d a2v = _mm512_loadu_pd(a2 + j), b2v = _mm512_loadu_pd(b2 + j), c2v = _mm512_loadu_pd(c2 + j);
+        __m512d determinant = _mm512_sub_pd(_mm512_mul_pd(a, b2v), _mm512_mul_pd(a2v, b));
+        __m512d x = _mm512_div_pd(_mm512_sub_pd(_mm512_mul_pd(b, c2v), _mm512_mul_pd(b2v, c)), determinant);
+        __m512d y = _mm512_div_pd(_mm512_sub_pd(_mm512_mul_pd(a2v, c), _mm512_mul_pd(a, c2v)), determinant);
+        __mmask8 inside = _mm512_cmp_pd_mask(determinant, zero, _CMP_NEQ_OQ) &
+                          _mm512_cmp_pd_mask(_mm512_abs_pd(x), one, _CMP_LE_OQ) &
+                          _mm512_cmp_pd_mask(_mm512_abs_pd(y), one, _CMP_LE_OQ);
+        if (!inside) continue;
+        double xs[8], ys[8];
+        _mm512_mask_compressstoreu_pd(xs, inside, x);
+        _mm512_mask_compressstoreu_pd(ys, inside, y);
+        int found = 0;
+        for (unsigned int bits = inside; bits; bits &= bits - 1) found++;
+        for (int l = 0; l < found; l++) out.push_back(dvec3(xs[l], ys[l], 1));
+    }
+    intersectRowScalar(a1, b1, c1, a2 + j, b2 + j, c2 + j, n - j, out);
+}
+
+/**
+ * @brief AVX-512 version of GeometryKernels::transform, four vectors per step.
+ */
+KERNEL_TARGET("avx512f")
+void transformAvx512(const mat4 &m, const vec4 *in, vec4 *out, size_t n) {
+    __m512 r0 = _mm512_broadcast_f32x4(_mm_loadu_ps(&m.rows[0].x)), r1 = _mm512_broadcast_f32x4(_mm_loadu_ps(&m.rows[1].x));
+    __m512 r2 = _mm512_broadcast_f32x4(_mm_loadu_ps(&m.rows[2].x)), r3 = _mm512_broadcast_f32x4(_mm_loadu_ps(&m.rows[3].x));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m512 v = _mm512_loadu_ps(&in[i].x);
+        __m512 r = _mm512_add_ps(_mm512_add_ps(_mm512_add_ps(_mm512_mul_ps(_mm512_permute_ps(v, 0x00), r0),
+                                                             _mm512_mul_ps(_mm512_permute_ps(v, 0x55), r1)),
+                                               _mm512_mul_ps(_mm512_permute_ps(v, 0xAA), r2)),
+                                 _mm512_mul_ps(_mm512_permute_ps(v, 0xFF), r3));
+        _mm512_storeu_ps(&out[i].x, r);
+    }
+    transformScalar(m, in + i, out + i, n - i);
+}
+#endif
+
+/**
+ * @brief The kernel tables, from the most portable to the widest.
+ */
+const GeometryKernels geometryKernelTables[] = {
+        {"scalar", nearestPointScalar, nearestLineScalar, intersectRowScalar, transformScalar},
+#ifdef GEOMETRY_X86
+        {"sse4.2", nearestPointSse42, nearestLineSse42, intersectRowSse42, transformSse42},
+        {"avx2", nearestPointAvx2, nearestLineAvx2, intersectRowAvx2, transformAvx2},
+        {"avx512", nearestPointAvx512, nearestLineAvx512, intersectRowAvx512, transformAvx512},
+#endif
+};
+
+/**
+ * @class KernelDispatch
+ * @brief Chooses the kernel table for the CPU the program runs on.
+ *
+ * Until select is called the scalar table is used, so the kernels can be called from anywhere.
+ */
+class KernelDispatch {
+    const GeometryKernels *active = &geometryKernelTables[0]; /**< The table in use. */
+
+public:
+    /**
+     * @brief Returns the number of tables compiled in.
+     */
+    static int count() {
+        return (int) (sizeof(geometryKernelTables) / sizeof(geometryKernelTables[0]));
+    }
+
+    /**
+     * @brief Returns a compiled table.
+     * @param i Index of the table, 0 being the scalar reference.
+     */
+    static const GeometryKernels &table(int i) {
+        return geometryKernelTables[i];
+    }
+
+    /**
+     * @brief Tells whether the CPU and the operating system support the instructions of a table.
+     * @param kernels The table.
+     */
+    static bool supported(const GeometryKernels &kernels) {
+        if (strcmp(kernels.name, "scalar") == 0) return true;
+#ifdef GEOMETRY_X86
+#if defined(__GNUC__) || defined(__clang__)
+        __builtin_cpu_init();
+        if (strcmp(kernels.name, "sse4.2") == 0) return __builtin_cpu_supports("sse4.2");
+        if (strcmp(kernels.name, "avx2") == 0) return __builtin_cpu_supports("avx2");
+        if (strcmp(kernels.name, "avx512") == 0) return __builtin_cpu_supports("avx512f");
+#elif defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 1);
+        bool sse42 = (info[2] & (1 << 20)) != 0, osxsave = (info[2] & (1 << 27)) != 0;
+        unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+        __cpuidex(info, 7, 0);
+        if (strcmp(kernels.name, "sse4.2") == 0) return sse42;
+        if (strcmp(kernels.name, "avx2") == 0) return (xcr0 & 0x6) == 0x6 && (info[1] & (1 << 5)) != 0;
+        if (strcmp(kernels.name, "avx512") == 0) return (xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)) != 0;
+#endif
+#endif
+        return false;
+    }
+
+    /**
+     * @brief Returns the table in use.
+     */
+    const GeometryKernels &kernels() const {
+        return *active;
+    }
+
+    /**
+     * @brief Switches to a table by name.
+     * @param name Name of the table.
+     * @return False if there is no such table or the CPU does not support it; the table in use is kept then.
+     */
+    bool force(const char *name) {
+        for (int i = 0; i < count(); i++) {
+            if (strcmp(table(i).name, name) == 0 && supported(table(i))) {
+                active = &table(i);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Selects the widest supported table, or the one named by POINTSLINES_KERNELS.
+     */
+    void select() {
+        const char *forced = getenv("POINTSLINES_KERNELS");
+        if (forced && force(forced)) return;
+        if (forced) fprintf(stderr, "POINTSLINES_KERNELS=%s is not available on this CPU, selecting automatically\n", forced);
+        for (int i = count() - 1; i >= 0; i--) {
+            if (supported(table(i))) {
+                active = &table(i);
+                return;
+            }
+        }
+    }
+};
+
+KernelDispatch kernelDispatch; /**< Kernel tables of the geometry queries. */
+
+
+/**
+ * @class ConcurrentAppender
+ * @brief Lock-free staging area where several threads append elements for a store.
+ *
+ * A producer fills a Writer, its own buffer. Flushing the buffer reserves a range of positions
+ * with one atomic addition and copies the elements into the segments that cover the range.
+ * Every segment counts the elements written into it. The thread that owns the store calls
+ * publish, which takes the prefix of positions whose writes are all complete, in position order,
+ * and frees the segments it has used up. Segments and directory blocks are created on first use
+ * with a compare-and-swap, so producers never wait on a lock or on each other.
+ */
+template<typename T>
+class ConcurrentAppender {
+public:
+    static const size_t segmentBits = 12; /**< log2 of the number of elements in a segment. */
+    static const size_t segmentSize = 1 << segmentBits; /**< Number of elements in a segment. */
+    static const size_t blockBits = 12; /**< log2 of the number of segments in a directory block. */
+    static const size_t blockCount = 1 << 12; /**< Number of directory blocks, bounding the positions to 2^36. */
+    static const size_t stageSize = 1024; /**< Elements a Writer buffers before flushing. */
+
+private:
+    /**
+     * @struct Segment
+     * @brief Fixed-size run of positions and the number of them written.
+     */
+    struct Segment {
+        T items[segmentSize]; /**< The elements. */
+        std::atomic<size_t> filled; /**< Number of elements written so far. */
+
+        Segment() : filled(0) {}
+    };
+
+    /**
+     * @struct Block
+     * @brief Directory block, the segments of 2^blockBits consecutive segment indices.
+     */
+    struct Block {
+        std::atomic<Segment *> segments[1 << blockBits]; /**< Segments, NULL until first used. */
+    };
+
+    std::unique_ptr<std::atomic<Block *>[]> blocks; /**< Directory, NULL until first used. */
+    std::atomic<size_t> reserved; /**< Positions handed out to producers. */
+    size_t published = 0; /**< Positions already published, owned by the publishing thread. */
+
+    /**
+     * @brief Returns segment k, creating it and its directory block if needed.
+     */
+    Segment *segment(size_t k) {
+        std::atomic<Block *> &slot = blocks[k >> blockBits];
+        Block *block = slot.load(std::memory_order_acquire);
+        if (!block) {
+            Block *fresh = new Block();
+            if (slot.compare_exchange_strong(block, fresh, std::memory_order_acq_rel)) block = fresh;
+            else delete fresh;
+        }
+        std::atomic<Segment *> &entry = block->segments[k & ((1 << blockBits) - 1)];
+        Segment *seg = entry.load(std::memory_order_acquire);
+        if (!seg) {
+            Segment *fresh = new Segment();
+            if (entry.compare_exchange_strong(seg, fresh, std::memory_order_acq_rel)) seg = fresh;
+            else delete fresh;
+        }
+        return seg;
+    }
+
+    /**
+     * @brief Returns segment k if a producer has created it, NULL otherwise.
+     */
+    Segment *find(size_t k) const {
+        Block *block = blocks[k >> blockBits].load(std::memory_order_acquire);
+        return block ? block->segments[k & ((1 << blockBits) - 1)].load(std::memory_order_acquire) : NULL;
+    }
+
+    /**
+     * @brief Frees segment k, which has been published entirely, and its directory block after the last segment.
+     */
+    void retire(size_t k) {
+        Block *block = blocks[k >> blockBits].load(std::memory_order_acquire);
+        delete block->segments[k & ((1 << blockBits) - 1)].exchange(NULL);
+        if ((k & ((1 << blockBits) - 1)) == (1 << blockBits) - 1) delete blocks[k >> blockBits].exchange(NULL);
+    }
+
+public:
+    /**
+     * @class Writer
+     * @brief Per-thread buffer of a producer, flushed into the appender in ranges.
+     */
+    class Writer {
+        ConcurrentAppender *owner; /**< The appender written to. */
+        std::vector<T> staging; /**< Elements not yet flushed. */
+
+    public:
+        /**
+         * @brief Constructor for the Writer class.
+         * @param owner The appender to write to.
+         */
+        explicit Writer(ConcurrentAppender &owner) : owner(&owner) {
+            staging.reserve(stageSize);
+        }
+
+        Writer(const Writer &) = delete;
+
+        Writer &operator=(const Writer &) = delete;
+
+        /**
+         * @brief Destructor, flushes the remaining elements.
+         */
+        ~Writer() {
+            flush();
+        }
+
+        /**
+         * @brief Appends an element, flushing the buffer when it is full.
+         */
+        void push(const T &v) {
+            staging.push_back(v);
+            if (staging.size() == stageSize) flush();
+        }
+
+        /**
+         * @brief Hands the buffered elements to the appender.
+         */
+        void flush() {
+            if (!staging.empty()) owner->append(staging.data(), staging.size());
+            staging.clear();
+        }
+    };
+
+    /**
+     * @brief Constructor for the ConcurrentAppender class.
+     */
+    ConcurrentAppender() : blocks(new std::atomic<Block *>[blockCount]()), reserved(0) {}
+
+    ConcurrentAppender(const ConcurrentAppender &) = delete;
+
+    ConcurrentAppender &operator=(const ConcurrentAppender &) = delete;
+
+    /**
+     * @brief Destructor, frees the segments left, published or not.
+     */
+    ~ConcurrentAppender() {
+        for (size_t b = 0; b < blockCount; b++) {
+            Block *block = blocks[b].load();
+            if (!block) continue;
+            for (size_t s = 0; s < (1 << blockBits); s++) delete block->segments[s].load();
+            delete block;
+        }
+    }
+
+    /**
+     * @brief Appends a run of elements as one range; safe to call from any number of threads.
+     * @param items The elements.
+     * @param n Number of elements.
+     */
+    void append(const T *items, size_t n) {
+        size_t position = reserved.fetch_add(n, std::memory_order_relaxed);
+        while (n > 0) {
+            size_t offset = position & (segmentSize - 1);
+            size_t count = n < segmentSize - offset ? n : segmentSize - offset;
+            Segment *seg = segment(position >> segmentBits);
+            std::copy(items, items + count, seg->items + offset);
+            seg->filled.fetch_add(count, std::memory_order_release);
+            items += count;
+            position += count;
+            n -= count;
+        }
+    }
+
+    /**
+     * @brief Moves the elements whose writes are complete, in position order, to out.
+     *
+     * Stops at the first segment with a write in flight; the rest is taken by a later call.
+     * Must only be called from one thread at a time.
+     * @param out Receives the elements.
+     * @return The number of elements moved.
+     */
+    size_t publish(std::vector<T> &out) {
+        size_t before = out.size();
+        for (;;) {
+            size_t k = published >> segmentBits, start = k << segmentBits;
+            Segment *seg = find(k);
+            if (!seg) break;
+            // the count is read first: every write it includes was reserved before the read of reserved
+            size_t filled = seg->filled.load(std::memory_order_acquire);
+            size_t end = reserved.load(std::memory_order_acquire);
+            if (end > start + segmentSize) end = start + segmentSize;
+            if (start + filled != end) break;
+            out.insert(out.end(), seg->items + (published - start), seg->items + (end - start));
+            published = end;
+            if (end < start + segmentSize) break;
+            retire(k);
+        }
+        return out.size() - before;
+    }
+
+    /**
+     * @brief Returns the number of elements appended but not yet published.
+     */
+    size_t pending() const {
+        return reserved.load(std::memory_order_relaxed) - published;
+    }
+};
+
+/**
+ * @class PointCollection
+ * @brief Represents a collection of points stored in an Object.
+ */
+class PointCollection {
+private:
+    Object points; /**< Object storing the points. */
+    unsigned long epoch = 0; /**< Bumped when the whole collection is replaced. */
+    ConcurrentAppender<dvec3> incoming; /**< Points appended by other threads, added by publish. */
+
+public:
+    /**
+     * @brief Returns the number of points in the collection.
+     * @return The number of points.
+     */
+    int size() const {
+        return (int) points.size();
+    }
+
+    /**
+     * @brief Adds a point to the collection.
+     * @param p The point to add.
+     */
+    void addPoint(const dvec3 &p) {
+        points.Vtx().push_back(p);
+        update();
+        printf("Point %3.2f, %3.2f added\n", p.x, p.y);
+    }
+
+    /**
+     * @brief Adds a batch of points with a single upload.
+     * @param batch The points to add.
+     */
+    void addPoints(const std::vector<dvec3> &batch) {
+        for (size_t i = 0; i < batch.size(); i++) points.Vtx().push_back(batch[i]);
+        update();
+        printf("%d points added\n", (int) batch.size());
+    }
+
+    /**
+     * @brief Returns the appender through which other threads add points.
+     */
+    ConcurrentAppender<dvec3> &appender() {
+        return incoming;
+    }
+
+    /**
+     * @brief Adds the points appended by other threads so far, with a single upload.
+     * @return Whether points were added.
+     */
+    bool publish() {
+        std::vector<dvec3> batch;
+        if (incoming.publish(batch) == 0) return false;
+        addPoints(batch);
+        return true;
+    }
+
+    /**
+     * @brief Updates the GPU buffers with the current point data.
+     */
+    void update() {
+        points.updateGpu();
+    }
+
+    /**
+     * @brief Returns the object storing the points.
+     * @return Reference to the point object.
+     */
+    Object &getPoints() {
+        return points;
+    }
+
+    /**
+     * @brief Replaces the points with a snapshot, re-uploading only the chunks that differ.
+     * @param snapshot The point storage to restore.
+     */
+    void restore(const ChunkedArray<dvec3> &snapshot) {
+        points.Vtx() = snapshot;
+        epoch++;
+        update();
+    }
+
+    /**
+     * @brief Returns the epoch of the collection, bumped when it is replaced by a snapshot.
+     */
+    unsigned long getEpoch() const {
+        return epoch;
+    }
+
+    /**
+     * @brief Searches for the nearest point to a given position.
+     * @param pos The position to search around.
+     * @return The nearest point to the given position.
+     */
+    dvec3 searchNearestP(const dvec3 &pos) {
+        if (points.Vtx().size() == 0) {
+            return dvec3(0, 0, 1);
+        }
+        const GeometryKernels &kernels = kernelDispatch.kernels();
+        double best = INFINITY;
+        dvec3 est = points.Vtx()[0];
+        points.Vtx().forEachChunk([&](size_t, const dvec3 *data, size_t n, unsigned long) {
+            size_t i = kernels.nearestPoint(data, n, pos.x, pos.y, best);
+            if (i != n) est = data[i];
+        });
+        return est;
+    }
+
+    /**
+     * @brief Draws the points in the collection with the specified color.
+     * @param color The color of the points.
+     */
+    void Draw(vec3 color, vec4 view = vec4(-1e30f, -1e30f, 1e30f, 1e30f)) {
+        points.Draw(GL_POINTS, color, view);
+    }
+};
+
+/**
+ * @class Line
+ * @brief Represents a line defined by two points in 2D space.
+ */
+class Line {
+private:
+    dvec3 p1; /**< First point of the line. */
+    dvec3 p2; /**< Second point of the line. */
+    dvec3 p3; /**< Third point of the line (for drawing). */
+    dvec3 p4; /**< Fourth point of the line (for drawing). */
+    double a; /**< Coefficient 'a' of the line equation. */
+    double b; /**< Coefficient 'b' of the line equation. */
+    double c; /**< Coefficient 'c' of the line equation. */
+    double px; /**< Parametric vector x-component. */
+    double py; /**< Parametric vector y-component. */
+
+public:
+    /**
+     * @brief Default constructor for the Line class.
+     */
+    Line() {}
+
+    /**
+     * @brief Constructor for the Line class.
+     * @param p1 First point of the line.
+     * @param p2 Second point of the line.
+     */
+    Line(const dvec3 &p1, const dvec3 &p2) {
+        if (p1.x == p2.x) {
+            this->a = 1;
+            this->b = 0;
+            this->c = -p1.x;
+        } else {
+            this->a = p2.y - p1.y;
+            this->b = p1.x - p2.x;
+            this->c = -a * p1.x - b * p1.y;
+        }
+        this->px = p2.x - p1.x;
+        this->py = p2.y - p1.y;
+        this->p1 = p1;
+        this->p2 = p2;
+        if (this->b != 0) {
+            this->p3 = dvec3(-1.0, (-a * -1.0 - c) / b, 1);
+            this->p4 = dvec3(1.0, (-a * 1.0 - c) / b, 1);
+        } else {
+            this->p3 = dvec3(p1.x, -1.0, 1);
+            this->p4 = dvec3(p1.x, 1.0, 1);
+        }
+    }
+
+    /**
+     * @brief Finds the intersection point of two lines.
+     * @param line2 The second line to intersect with.
+     * @return The intersection point of the two lines.
+     */
+    dvec3 findIntersectionPoint(const Line &line2) const {
+        double a1 = this->getA(), b1 = this->getB(), c1 = this->getC();
+        double a2 = line2.getA(), b2 = line2.getB(), c2 = line2.getC();
+        double determinant = a1 * b2 - a2 * b1;
+
+        if (determinant == 0) {
+            return dvec3(0, 0, 1);
+        } else {
+            double x = (b1 * c2 - b2 * c1) / determinant;
+            double y = (a2 * c1 - a1 * c2) / determinant;
+
+            return dvec3(x, y, 1);
+        }
+    }
+
+    /**
+     * @brief Moves the line to a new position.
+     * @param clickP The new position to move the line to.
+     */
+    void move(const dvec3 &clickP) {
+        double a, b;
+        a = this->getA();
+        b = this->getB();
+        double newC = -a * clickP.x - b * clickP.y;
+        this->setP1(dvec3(-1.0, (-a * -1.0 - newC) / b, 1));
+        this->setP2(dvec3(1.0, (-a * 1.0 - newC) / b, 1));
+        this->setP3(dvec3(-1.0, (-a * -1.0 - newC) / b, 1));
+        this->setP4(dvec3(1.0, (-a * 1.0 - newC) / b, 1));
+    }
+
+    // Getters and setters
+    double getA() const {
+        return a;
+    }
+    double getB() const {
+        return b;
+    }
+    double getC() const {
+        return c;
+    }
+    void setP1(const dvec3 &p1) {
+        Line::p1 = p1;
+    }
+    void setP2(const dvec3 &p2) {
+        Line::p2 = p2;
+    }
+    void setP3(const dvec3 &p3) {
+        Line::p3 = p3;
+    }
+    void setP4(const dvec3 &p4) {
+        Line::p4 = p4;
+    }
+    double getPx() const {
+        return px;
+    }
+    double getPy() const {
+        return py;
+    }
+    const dvec3 &getP3() const {
+        return p3;
+    }
+    const dvec3 &getP4() const {
+        return p4;
+    }
+    const dvec3 &getP2() const {
+        return p2;
+    }
+    const dvec3 &getP1() const {
+        return p1;
+    }
+};
+/**
+ * @class LineCollection
  * @brief Represents a collection of lines.
  */
-class LineCollection {
+class LineCollection {
+private:
+    Object lines; /**< Object storing the lines. */
+    std::vector<unsigned long> versions; /**< Version stamp of each line, renewed when it changes. */
+    unsigned long lastVersion = 0; /**< Last stamp handed out; stamps are unique, so a reused line id never matches a stale one. */
+    unsigned long epoch = 0; /**< Bumped when the whole collection is replaced. */
+    unsigned long changes = 0; /**< Bumped whenever a line moves. */
+    bool firstClick = false; /**< Flag indicating the first click when drawing a line. */
+    dvec3 startPoint; /**< Start point of the line when drawing. */
+public:
+    /**
+     * @struct Vertices
+     * @brief The four vertices of a line, appended as one element so a line is never split.
+     */
+    struct Vertices {
+        dvec3 v[4]; /**< The vertices, as stored by addLine. */
+    };
+
+private:
+    ConcurrentAppender<Vertices> incoming; /**< Lines appended by other threads, added by publish. */
+
+public:
+    bool firstCLick = false;
+    /**
+     * @brief Returns the number of lines in the collection.
+     * @return The number of lines.
+     */
+    Object &getLines() {
+        return lines;
+    }
+
+    /**
+     * @brief Returns the number of lines in the collection.
+     * @return The number of lines.
+     */
+    int size() const {
+        return (int) lines.size() / 4;
+    }
+
+    /**
+     * @brief Returns whether the first click has occurred when drawing a line.
+     * @return True if the first click has occurred, false otherwise.
+     */
+    int index(Line l1) {
+        for (int i = 0; i < lines.Vtx().size(); i += 4) {
+            bool isSameLine = (lines.Vtx()[i].x == l1.getP1().x && lines.Vtx()[i].y == l1.getP1().y &&
+                               lines.Vtx()[i + 1].x == l1.getP2().x && lines.Vtx()[i + 1].y == l1.getP2().y) ||
+                              (lines.Vtx()[i].x == l1.getP2().x && lines.Vtx()[i].y == l1.getP2().y &&
+                               lines.Vtx()[i + 1].x == l1.getP1().x && lines.Vtx()[i + 1].y == l1.getP1().y);
+
+            if (isSameLine) {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    /**
+     * @brief Adds a line to the collection.
+     * @param l The line to add.
+     */
+    void addLine(Line l) {
+        double a, b, c, px, py;
+        lines.Vtx().push_back(l.getP1());
+        lines.Vtx().push_back(l.getP2());
+        lines.Vtx().push_back(l.getP3());
+        lines.Vtx().push_back(l.getP4());
+        versions.push_back(++lastVersion);
+        a = l.getA();
+        b = l.getB();
+        c = -a * l.getP1().x - b * l.getP1().y;
+        px = l.getPx();
+        py = l.getPy();
+        printf("Line added\n");
+        printf("\tImplicit: %3.2f x + %3.2f y + %3.2f = 0\n", a, b, c);
+        printf("\tParametric: r<t> = <%3.2f, %3.2f> + <%3.2f, %3.2f>t\n", l.getP1().x, l.getP1().y, px, py);
+        update();
+    }
+
+    /**
+     * @brief Adds a batch of lines given by their four vertices with a single upload.
+     * @param vertices The vertices, four per line.
+     */
+    void addLines(const std::vector<dvec3> &vertices) {
+        for (size_t i = 0; i < vertices.size(); i++) lines.Vtx().push_back(vertices[i]);
+        stampNewLines();
+        update();
+        printf("%d lines added\n", (int) vertices.size() / 4);
+    }
+
+    /**
+     * @brief Returns the appender through which other threads add lines.
+     */
+    ConcurrentAppender<Vertices> &appender() {
+        return incoming;
+    }
+
+    /**
+     * @brief Adds the lines appended by other threads so far, with a single upload.
+     * @return Whether lines were added.
+     */
+    bool publish() {
+        std::vector<Vertices> batch;
+        if (incoming.publish(batch) == 0) return false;
+        std::vector<dvec3> vertices;
+        vertices.reserve(batch.size() * 4);
+        for (size_t i = 0; i < batch.size(); i++) vertices.insert(vertices.end(), batch[i].v, batch[i].v + 4);
+        addLines(vertices);
+        return true;
+    }
+
+    /**
+     * @brief Replaces the vertices of a line and marks it as changed.
+     * @param lineId Index of the line (vertex index / 4).
+     */
+    void setLine(int lineId, const dvec3 &p1, const dvec3 &p2, const dvec3 &p3, const dvec3 &p4) {
+        ChunkedArray<dvec3> &vtx = lines.Vtx();
+        vtx.set(lineId * 4, p1);
+        vtx.set(lineId * 4 + 1, p2);
+        vtx.set(lineId * 4 + 2, p3);
+        vtx.set(lineId * 4 + 3, p4);
+        touch(lineId);
+    }
+
+    /**
+     * @brief Starts drawing a line from a given point.
+     * @param startPoint The starting point of the line.
+     */
+    void startDrawing(const dvec3 &startPoint) {
+        firstCLick = true;
+        this->startPoint = startPoint;
+
+    }
+
+    /**
+     * @brief Finishes drawing a line to a given point.
+     * @param endPoint The end point of the line.
+     */
+    void finishDrawing(const dvec3 &endPoint) {
+        firstCLick = false;
+        addLine(Line(startPoint, endPoint));
+    }
+
+    /**
+     * @brief Abandons the line being drawn.
+     */
+    void cancelDrawing() {
+        firstCLick = false;
+    }
+
+    /**
+     * @brief Checks if the drawing is in the first click phase.
+     * @return True if in the first click phase, false otherwise.
+     */
+    bool isFirst() const {
+        return firstCLick;
+    }
+
+    /**
+     * @brief Returns the start point of the line being drawn.
+     */
+    const dvec3 &getStartPoint() const {
+        return startPoint;
+    }
+
+    /**
+     * @brief Updates the GPU buffers with the current line data.
+     */
+    void update() {
+        lines.updateGpu();
+    }
+
+    /**
+     * @brief Replaces the lines with a snapshot, re-uploading only the chunks that differ.
+     *
+     * Only the lines whose vertices differ get a new version, so cached results of the
+     * untouched lines stay valid. Chunks shared with the current storage are skipped.
+     * @param snapshot The line storage to restore.
+     */
+    void restore(const ChunkedArray<dvec3> &snapshot) {
+        ChunkedArray<dvec3> previous = lines.Vtx();
+        std::vector<unsigned long> stamps;
+        previous.forEachChunk([&](size_t, const dvec3 *, size_t, unsigned long stamp) {
+            stamps.push_back(stamp);
+        });
+        size_t kept = std::min(versions.size(), snapshot.size() / 4);
+        versions.resize(kept);
+        snapshot.forEachChunk([&](size_t chunk, const dvec3 *data, size_t n, unsigned long stamp) {    // chunks hold whole lines
+            if (chunk < stamps.size() && stamps[chunk] == stamp) return;
+            size_t first = chunk * ChunkedArray<dvec3>::chunkSize / 4;
+            for (size_t k = 0; k < n / 4 && first + k < kept; k++) {
+                for (int v = 0; v < 4; v++) {
+                    const dvec3 &a = data[k * 4 + v], &b = previous[(first + k) * 4 + v];
+                    if (a.x != b.x || a.y != b.y || a.z != b.z) {
+                        versions[first + k] = ++lastVersion;
+                        break;
+                    }
+                }
+            }
+        });
+        lines.Vtx() = snapshot;
+        stampNewLines();
+        epoch++;
+        update();
+    }
+
+    /**
+     * @brief Marks a line as changed.
+     * @param lineId Index of the line (vertex index / 4).
+     */
+    void touch(int lineId) {
+        versions[lineId] = ++lastVersion;
+        changes++;
+    }
+
+    /**
+     * @brief Gives the lines appended since the last call a fresh version each.
+     */
+    void stampNewLines() {
+        while (versions.size() < lines.size() / 4) versions.push_back(++lastVersion);
+    }
+
+    /**
+     * @brief Returns the number of line moves so far.
+     */
+    unsigned long getChanges() const {
+        return changes;
+    }
+
+    /**
+     * @brief Returns the version counter of a line.
+     * @param lineId Index of the line (vertex index / 4).
+     */
+    unsigned long version(int lineId) const {
+        return versions[lineId];
+    }
+
+    /**
+     * @brief Returns the epoch of the collection, bumped when it is replaced by a snapshot.
+     */
+    unsigned long getEpoch() const {
+        return epoch;
+    }
+
+    /**
+     * @brief Builds the Line stored at a line index.
+     * @param lineId Index of the line (vertex index / 4).
+     */
+    Line line(int lineId) {
+        return Line(lines.Vtx()[lineId * 4], lines.Vtx()[lineId * 4 + 1]);
+    }
+
+    /**
+    * @brief Draws the lines in the collection.
+    * @param type The type of drawing (e.g., GL_LINES, GL_LINE_STRIP, etc.).
+    * @param color The color of the lines.
+    */
+    void Draw(int type, vec3 color, vec4 view = vec4(-1e30f, -1e30f, 1e30f, 1e30f)) {
+        lines.Draw(type, color, view);
+    }
+
+    /**
+     * @brief Finds the nearest line to a given position.
+     * @param clickP The position to search around.
+     * @return The index of the nearest line.
+     */
+    int findNearestLine(const dvec3 &clickP) {
+        const GeometryKernels &kernels = kernelDispatch.kernels();
+        double best = 0.01;
+        int nearestLine = -1;
+        lines.Vtx().forEachChunk([&](size_t chunk, const dvec3 *data, size_t n, unsigned long) {    // chunks hold whole lines
+            size_t k = kernels.nearestLine(data, n / 4, clickP.x, clickP.y, best);
+            if (k != n / 4) nearestLine = (int) (chunk * ChunkedArray<dvec3>::chunkSize + 4 * k);
+        });
+        return nearestLine;
+    }
+
+};
+
+bool runAllocationTest();
+void runLatencyReplay();
+
+PointCollection *points; /**< Pointer to a PointCollection object. */
+LineCollection *lines; /**< Pointer to a LineCollection object. */
+
+/**
+ * @struct SceneSnapshot
+ * @brief Version of the scene; copies share every chunk with the live storage.
+ */
+struct SceneSnapshot {
+    ChunkedArray<dvec3> points; /**< Point storage at the time of the snapshot. */
+    ChunkedArray<dvec3> lines; /**< Line storage at the time of the snapshot. */
+};
+
+/**
+ * @class History
+ * @brief Undo/redo stacks of scene snapshots.
+ *
+ * Taking and restoring a snapshot is O(1); memory grows only with the chunks touched
+ * by the edits, and the number of kept snapshots is bounded by maxDepth.
+ */
+class History {
+    std::deque<SceneSnapshot> undoStack; /**< Snapshots before the recorded edits. */
+    std::deque<SceneSnapshot> redoStack; /**< Snapshots of undone states. */
+    size_t maxDepth; /**< Maximum number of undo steps kept. */
+
+    /**
+     * @brief Captures the current scene.
+     */
+    static SceneSnapshot capture() {
+        SceneSnapshot s;
+        s.points = points->getPoints().Vtx();
+        s.lines = lines->getLines().Vtx();
+        return s;
+    }
+
+    /**
+     * @brief Makes a snapshot the current scene.
+     */
+    static void apply(const SceneSnapshot &s) {
+        points->restore(s.points);
+        lines->restore(s.lines);
+    }
+
+public:
+    /**
+     * @brief Constructor for the History class.
+     * @param maxDepth Maximum number of undo steps kept.
+     */
+    History(size_t maxDepth = 256) : maxDepth(maxDepth) {}
+
+    /**
+     * @brief Records the current scene before an edit is applied.
+     */
+    void record() {
+        undoStack.push_back(capture());
+        if (undoStack.size() > maxDepth) undoStack.pop_front();
+        redoStack.clear();
+    }
+
+    /**
+     * @brief Steps back to the scene before the last edit.
+     * @return True if there was an edit to undo.
+     */
+    bool undo() {
+        if (undoStack.empty()) return false;
+        redoStack.push_back(capture());
+        apply(undoStack.back());
+        undoStack.pop_back();
+        return true;
+    }
+
+    /**
+     * @brief Re-applies the last undone edit.
+     * @return True if there was an edit to redo.
+     */
+    bool redo() {
+        if (redoStack.empty()) return false;
+        undoStack.push_back(capture());
+        apply(redoStack.back());
+        redoStack.pop_back();
+        return true;
+    }
+};
+
+History history; /**< Undo/redo history of the scene. */
+
+/**
+ * @class LittleEndian
+ * @brief Field by field little-endian encoding, so files and messages do not depend on the host.
+ */
+class LittleEndian {
+public:
+    /**
+     * @brief Appends a 32-bit value in little-endian byte order.
+     */
+    static void putU32(std::vector<char> &bytes, unsigned int value) {
+        for (int k = 0; k < 4; k++) bytes.push_back((char) (value >> (8 * k)));
+    }
+
+    /**
+     * @brief Appends a 64-bit value in little-endian byte order.
+     */
+    static void putU64(std::vector<char> &bytes, unsigned long long value) {
+        for (int k = 0; k < 8; k++) bytes.push_back((char) (value >> (8 * k)));
+    }
+
+    /**
+     * @brief Appends an IEEE 754 double in little-endian byte order.
+     */
+    static void putF64(std::vector<char> &bytes, double value) {
+        unsigned long long bits;
+        memcpy(&bits, &value, sizeof(bits));
+        putU64(bytes, bits);
+    }
+
+    /**
+     * @brief Reads a little-endian 32-bit value.
+     */
+    static unsigned int getU32(const char *p) {
+        unsigned int value = 0;
+        for (int k = 0; k < 4; k++) value |= (unsigned int) (unsigned char) p[k] << (8 * k);
+        return value;
+    }
+
+    /**
+     * @brief Reads a little-endian 64-bit value.
+     */
+    static unsigned long long getU64(const char *p) {
+        unsigned long long value = 0;
+        for (int k = 0; k < 8; k++) value |= (unsigned long long) (unsigned char) p[k] << (8 * k);
+        return value;
+    }
+
+    /**
+     * @brief Reads a little-endian IEEE 754 double.
+     */
+    static double getF64(const char *p) {
+        unsigned long long bits = getU64(p);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+};
+
+/**
+ * @class Replication
+ * @brief Replicates edit operations between instances over a local socket.
+ *
+ * The first instance on a socket path becomes the hub, later ones connect to it. Every point and
+ * line gets an id (site, sequence) and every line a version stamp (Lamport clock, site); moves are
+ * applied only if their stamp is newer, so concurrent moves of a line converge on every replica.
+ * The edits of a frame are sent as one batch: new elements are found by comparing the collection
+ * sizes with the replicated ones, and moved lines are coalesced, so the traffic is proportional to
+ * the edits. The hub applies and forwards the batches of its clients, and sends a new client its
+ * current scene compacted to one operation per element. The transport is a Unix domain socket,
+ * built with SCENE_SHARING (Linux only).
+ */
+class Replication {
+public:
+    /**
+     * @brief Kinds of replicated operations.
+     */
+    enum OpType {
+        ADD_POINT = 1, ADD_LINE = 2, MOVE_LINE = 3
+    };
+
+    /**
+     * @struct Op
+     * @brief A replicated operation.
+     */
+    struct Op {
+        unsigned int type; /**< OpType of the operation. */
+        unsigned int site; /**< Site that created the element. */
+        unsigned int seq; /**< Sequence number of the element on its site. */
+        unsigned int clock; /**< Lamport clock of the version stamp. */
+        unsigned int author; /**< Site of the version stamp. */
+        dvec3 v[4]; /**< The point, or the four vertices of the line. */
+    };
+
+    static const size_t opBytes = 5 * 4 + 4 * 3 * 8; /**< Size of an encoded operation. */
+
+private:
+    /**
+     * @struct Stamp
+     * @brief Version stamp of a line, ordered by clock then site.
+     */
+    struct Stamp {
+        unsigned int clock; /**< Lamport clock. */
+        unsigned int site; /**< Site that made the change. */
+
+        bool newerThan(const Stamp &o) const {
+            return clock != o.clock ? clock > o.clock : site > o.site;
+        }
+    };
+
+    /**
+     * @struct Peer
+     * @brief A connection and its partial input and pending output.
+     */
+    struct Peer {
+        int fd = -1; /**< The socket. */
+        std::vector<char> in; /**< Received bytes not yet parsed into batches. */
+        std::vector<char> out; /**< Output, accepted by the socket up to sent. */
+        size_t sent = 0; /**< Bytes at the front of out already accepted by the socket. */
+        bool stalled = false; /**< Whether the peer stopped reading and is to be dropped. */
+    };
+
+    static const unsigned int magic = 0x504c4f47; /**< Header of a batch. */
+    static const size_t maxPending = 64 << 20; /**< Unsent bytes after which a peer is considered stalled. */
+
+    bool hub = false; /**< Whether this instance accepts the other ones. */
+    int listenFd = -1; /**< Listening socket of the hub. */
+    std::vector<Peer> peers; /**< The hub, or the clients of the hub. */
+    unsigned int site = 0; /**< Id of this instance. */
+    unsigned int nextSeq = 0; /**< Sequence number of the next local element. */
+    unsigned int clock = 0; /**< Lamport clock. */
+    std::vector<unsigned long long> pointIds; /**< Id of each replicated point. */
+    std::vector<unsigned long long> lineIds; /**< Id of each replicated line. */
+    std::vector<Stamp> lineStamps; /**< Version stamp of each replicated line. */
+    std::unordered_map<unsigned long long, int> pointIndex; /**< Point index by id. */
+    std::unordered_map<unsigned long long, int> lineIndex; /**< Line index by id. */
+    std::vector<int> dirtyLines; /**< Lines moved locally since the last batch. */
+    std::vector<bool> lineDirty; /**< Whether a line is in dirtyLines. */
+    std::vector<Op> pending; /**< Local operations of the current batch. */
+    unsigned long opsSent = 0; /**< Operations sent. */
+    unsigned long opsReceived = 0; /**< Operations received. */
+    unsigned long bytesSent = 0; /**< Bytes sent. */
+    unsigned long bytesReceived = 0; /**< Bytes received. */
+    unsigned long batches = 0; /**< Batches sent. */
+
+    static unsigned long long key(unsigned int site, unsigned int seq) {
+        return ((unsigned long long) site << 32) | seq;
+    }
+
+    /**
+     * @brief Returns an operation with the given header fields and zero vertices.
+     */
+    static Op makeOp(unsigned int type, unsigned int site, unsigned int seq, unsigned int clock, unsigned int author) {
+        Op op = Op();
+        op.type = type;
+        op.site = site;
+        op.seq = seq;
+        op.clock = clock;
+        op.author = author;
+        return op;
+    }
+
+    /**
+     * @brief Gives ids to the elements added locally and turns the moved lines into operations.
+     */
+    void collectLocal() {
+        ChunkedArray<dvec3> &pts = points->getPoints().Vtx();
+        while ((int) pointIds.size() < points->size()) {
+            Op op = makeOp(ADD_POINT, site, nextSeq++, ++clock, site);
+            op.v[0] = pts[pointIds.size()];
+            pointIndex[key(op.site, op.seq)] = (int) pointIds.size();
+            pointIds.push_back(key(op.site, op.seq));
+            pending.push_back(op);
+        }
+        ChunkedArray<dvec3> &vtx = lines->getLines().Vtx();
+        while ((int) lineIds.size() < lines->size()) {
+            int l = (int) lineIds.size();
+            Op op = makeOp(ADD_LINE, site, nextSeq++, ++clock, site);
+            for (int k = 0; k < 4; k++) op.v[k] = vtx[l * 4 + k];
+            Stamp stamp = {op.clock, site};
+            lineIndex[key(op.site, op.seq)] = l;
+            lineIds.push_back(key(op.site, op.seq));
+            lineStamps.push_back(stamp);
+            lineDirty.push_back(false);
+            pending.push_back(op);
+        }
+        for (size_t d = 0; d < dirtyLines.size(); d++) {
+            int l = dirtyLines[d];
+            lineDirty[l] = false;
+            Op op = makeOp(MOVE_LINE, (unsigned int) (lineIds[l] >> 32), (unsigned int) lineIds[l], ++clock, site);
+            for (int k = 0; k < 4; k++) op.v[k] = vtx[l * 4 + k];
+            Stamp stamp = {op.clock, site};
+            lineStamps[l] = stamp;
+            pending.push_back(op);
+        }
+        dirtyLines.clear();
+    }
+
+    /**
+     * @brief Appends a batch to the output of a peer and sends as much as the socket accepts.
+     *
+     * A peer whose unsent output would exceed maxPending is marked stalled instead, and poll
+     * drops it, so a peer that stopped reading costs bounded memory.
+     */
+    void send(Peer &peer, const char *data, size_t bytes) {
+        if (peer.stalled) return;
+        if (peer.out.size() - peer.sent + bytes > maxPending) {
+            peer.stalled = true;
+            return;
+        }
+        peer.out.insert(peer.out.end(), data, data + bytes);
+        bytesSent += bytes;
+        drain(peer);
+    }
+
+#ifdef SCENE_SHARING
+    /**
+     * @brief Sends the pending output of a peer without blocking.
+     *
+     * The sent prefix is only removed once it is at least half of the buffer, so every byte is
+     * moved a bounded number of times however slowly the peer reads.
+     */
+    static void drain(Peer &peer) {
+        while (peer.sent < peer.out.size()) {
+            ssize_t n = ::send(peer.fd, &peer.out[peer.sent], peer.out.size() - peer.sent, MSG_NOSIGNAL);
+            if (n <= 0) break;
+            peer.sent += n;
+        }
+        if (peer.sent == peer.out.size()) {
+            peer.out.clear();
+            peer.sent = 0;
+        } else if (peer.sent >= peer.out.size() / 2) {
+            peer.out.erase(peer.out.begin(), peer.out.begin() + peer.sent);
+            peer.sent = 0;
+        }
+    }
+#else
+    static void drain(Peer &) {}
+#endif
+
+    /**
+     * @brief Encodes operations as a batch, field by field, independent of the struct layout and byte order.
+     */
+    static std::vector<char> encode(const std::vector<Op> &ops) {
+        std::vector<char> bytes;
+        bytes.reserve(8 + ops.size() * opBytes);
+        LittleEndian::putU32(bytes, magic);
+        LittleEndian::putU32(bytes, (unsigned int) ops.size());
+        for (size_t o = 0; o < ops.size(); o++) {
+            const Op &op = ops[o];
+            LittleEndian::putU32(bytes, op.type);
+            LittleEndian::putU32(bytes, op.site);
+            LittleEndian::putU32(bytes, op.seq);
+            LittleEndian::putU32(bytes, op.clock);
+            LittleEndian::putU32(bytes, op.author);
+            for (int k = 0; k < 4; k++) {
+                LittleEndian::putF64(bytes, op.v[k].x);
+                LittleEndian::putF64(bytes, op.v[k].y);
+                LittleEndian::putF64(bytes, op.v[k].z);
+            }
+        }
+        return bytes;
+    }
+
+    /**
+     * @brief Decodes an operation encoded by encode.
+     */
+    static Op decode(const char *p) {
+        Op op = makeOp(LittleEndian::getU32(p), LittleEndian::getU32(p + 4), LittleEndian::getU32(p + 8), LittleEndian::getU32(p + 12), LittleEndian::getU32(p + 16));
+        p += 20;
+        for (int k = 0; k < 4; k++, p += 24) op.v[k] = dvec3(LittleEndian::getF64(p), LittleEndian::getF64(p + 8), LittleEndian::getF64(p + 16));
+        return op;
+    }
+
+    /**
+     * @brief Applies a batch of remote operations with one upload per collection.
+     */
+    void apply(const Op *ops, size_t count) {
+        std::vector<dvec3> newPoints, newLines;
+        bool moved = false;
+        for (size_t o = 0; o < count; o++) {
+            const Op &op = ops[o];
+            if (op.clock > clock) clock = op.clock;
+            unsigned long long id = key(op.site, op.seq);
+            if (op.type == ADD_POINT && pointIndex.find(id) == pointIndex.end()) {
+                pointIndex[id] = (int) pointIds.size();
+                pointIds.push_back(id);
+                newPoints.push_back(op.v[0]);
+            } else if (op.type == ADD_LINE && lineIndex.find(id) == lineIndex.end()) {
+                Stamp stamp = {op.clock, op.author};
+                lineIndex[id] = (int) lineIds.size();
+                lineIds.push_back(id);
+                lineStamps.push_back(stamp);
+                lineDirty.push_back(false);
+                newLines.insert(newLines.end(), op.v, op.v + 4);
+            } else if (op.type == MOVE_LINE) {
+                std::unordered_map<unsigned long long, int>::iterator it = lineIndex.find(id);
+                Stamp stamp = {op.clock, op.author};
+                if (it == lineIndex.end() || !stamp.newerThan(lineStamps[it->second])) continue;
+                int l = it->second;
+                if (l >= lines->size()) {    // added in this batch
+                    for (int k = 0; k < 4; k++) newLines[(l - lines->size()) * 4 + k] = op.v[k];
+                } else {
+                    lines->setLine(l, op.v[0], op.v[1], op.v[2], op.v[3]);
+                    moved = true;
+                }
+                lineStamps[l] = stamp;
+            }
+        }
+        opsReceived += count;
+        if (!newPoints.empty()) points->addPoints(newPoints);
+        if (!newLines.empty()) lines->addLines(newLines);
+        if (moved) lines->update();
+        if (!newPoints.empty() || !newLines.empty() || moved) glutPostRedisplay();
+    }
+
+    /**
+     * @brief Sends the whole current scene to a new client, one operation per element.
+     */
+    void sendSnapshot(Peer &peer) {
+        std::vector<Op> ops;
+        ChunkedArray<dvec3> &pts = points->getPoints().Vtx();
+        for (size_t p = 0; p < pointIds.size(); p++) {
+            Op op = makeOp(ADD_POINT, (unsigned int) (pointIds[p] >> 32), (unsigned int) pointIds[p], 0, 0);
+            op.v[0] = pts[p];
+            ops.push_back(op);
+        }
+        ChunkedArray<dvec3> &vtx = lines->getLines().Vtx();
+        for (size_t l = 0; l < lineIds.size(); l++) {
+            Op op = makeOp(ADD_LINE, (unsigned int) (lineIds[l] >> 32), (unsigned int) lineIds[l],
+                           lineStamps[l].clock, lineStamps[l].site);
+            for (int k = 0; k < 4; k++) op.v[k] = vtx[l * 4 + k];
+            ops.push_back(op);
+        }
+        std::vector<char> bytes = encode(ops);
+        send(peer, &bytes[0], bytes.size());
+        printf("Replication: sent a snapshot of %d operations to a new client\n", (int) ops.size());
+    }
+
+public:
+    /**
+     * @brief Joins the session on a socket path, becoming its hub if there is none yet.
+     * @param path Path of the Unix domain socket.
+     * @return True if replication is active.
+     */
+    bool start(const char *path) {
+#ifdef SCENE_SHARING
+        site = (unsigned int) getpid();
+        sockaddr_un address;
+        memset(&address, 0, sizeof(address));
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0) return false;
+        if (connect(fd, (sockaddr *) &address, sizeof(address)) == 0) {
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            Peer peer = Peer();
+            peer.fd = fd;
+            peers.push_back(peer);
+            printf("Replication: joined %s as site %u\n", path, site);
+            return true;
+        }
+        unlink(path);    // no hub is listening, the path is stale
+        if (bind(fd, (sockaddr *) &address, sizeof(address)) != 0 || listen(fd, 16) != 0) {
+            printf("Replication: cannot listen on %s\n", path);
+            close(fd);
+            return false;
+        }
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        listenFd = fd;
+        hub = true;
+        printf("Replication: hosting %s as site %u\n", path, site);
+        return true;
+#else
+        (void) path;
+        printf("Replication is not supported in this build\n");
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Returns whether this instance replicates its edits.
+     */
+    bool active() const {
+        return hub || !peers.empty();
+    }
+
+    /**
+     * @brief Records that a line was moved locally.
+     * @param lineId Index of the line (vertex index / 4).
+     */
+    void lineMoved(int lineId) {
+        if (!active() || lineId >= (int) lineDirty.size() || lineDirty[lineId]) return;
+        lineDirty[lineId] = true;
+        dirtyLines.push_back(lineId);
+    }
+
+    /**
+     * @brief Sends the local edits of the frame as one batch.
+     */
+    void flush() {
+        if (!active()) return;
+        collectLocal();
+        if (pending.empty()) return;
+        std::vector<char> bytes = encode(pending);
+        for (size_t p = 0; p < peers.size(); p++) send(peers[p], &bytes[0], bytes.size());
+        opsSent += pending.size();
+        batches++;
+        pending.clear();
+    }
+
+    /**
+     * @brief Accepts new clients and applies the batches received, forwarding them on the hub.
+     */
+    void poll() {
+#ifdef SCENE_SHARING
+        if (!active()) return;
+        collectLocal();    // local elements must get their ids before remote ones are appended
+        if (hub) {
+            int fd;
+            while ((fd = accept(listenFd, NULL, NULL)) >= 0) {
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                Peer peer = Peer();
+                peer.fd = fd;
+                peers.push_back(peer);
+                sendSnapshot(peers.back());
+            }
+        }
+        for (size_t p = 0; p < peers.size(); p++) {
+            char buffer[65536];
+            ssize_t n;
+            bool closed = false;
+            while ((n = recv(peers[p].fd, buffer, sizeof(buffer), 0)) > 0) {
+                peers[p].in.insert(peers[p].in.end(), buffer, buffer + n);
+                bytesReceived += n;
+            }
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)) closed = true;
+            size_t used = 0;
+            std::vector<char> &in = peers[p].in;
+            while (in.size() - used >= 8) {
+                if (LittleEndian::getU32(&in[used]) != magic) {
+                    closed = true;
+                    break;
+                }
+                unsigned int count = LittleEndian::getU32(&in[used + 4]);
+                size_t bytes = 8 + count * opBytes;
+                if (in.size() - used < bytes) break;
+                std::vector<Op> ops(count);
+                for (unsigned int o = 0; o < count; o++) ops[o] = decode(&in[used + 8 + o * opBytes]);
+                apply(ops.empty() ? NULL : &ops[0], ops.size());
+                if (hub) {
+                    for (size_t q = 0; q < peers.size(); q++) {
+                        if (q != p) send(peers[q], &in[used], bytes);
+                    }
+                }
+                used += bytes;
+            }
+            in.erase(in.begin(), in.begin() + used);
+            drain(peers[p]);
+            if (peers[p].stalled && !closed) {
+                printf("Replication: %s stopped reading, dropping it\n", hub ? "a client" : "the hub");
+                closed = true;
+            } else if (closed) {
+                printf("Replication: %s disconnected\n", hub ? "a client" : "the hub");
+            }
+            if (closed) {
+                close(peers[p].fd);
+                peers.erase(peers.begin() + p);
+                p--;
+            }
+        }
+#endif
+    }
+
+    /**
+     * @brief Prints the replication statistics.
+     */
+    void print() const {
+        if (!active()) {
+            printf("Replication is off, set POINTSLINES_SHARE=<socket path> to enable it\n");
+            return;
+        }
+        printf("Replication: %s, site %u, %d peers, %d points and %d lines replicated\n", hub ? "hub" : "client", site,
+               (int) peers.size(), (int) pointIds.size(), (int) lineIds.size());
+        printf("\tsent %lu ops in %lu batches (%lu bytes), received %lu ops (%lu bytes)\n", opsSent, batches, bytesSent,
+               opsReceived, bytesReceived);
+    }
+};
+
+Replication replication; /**< Replication of the edits between instances. */
+
+/**
+ * @class IntersectionCache
+ * @brief Memoizes line-line intersections keyed by the pair of line ids.
+ *
+ * Every entry remembers the versions of both lines it was computed from, so moving
+ * a line invalidates exactly the pairs it takes part in. Stale entries are dropped when
+ * they are looked up, and swept out once the map reaches its size cap.
+ */
+class IntersectionCache {
+    /**
+     * @struct Entry
+     * @brief Cached intersection and the line versions it is valid for.
+     */
+    struct Entry {
+        dvec3 point; /**< The intersection point. */
+        unsigned long v1; /**< Version of the first line. */
+        unsigned long v2; /**< Version of the second line. */
+    };
+
+    std::unordered_map<unsigned long long, Entry> entries; /**< Cached results by line pair. */
+    static const size_t capacity = 1 << 16; /**< Number of entries that triggers a sweep. */
+    unsigned long hits = 0; /**< Number of lookups served from the cache. */
+    unsigned long misses = 0; /**< Number of lookups that had to be computed. */
+
+public:
+    /**
+     * @brief Returns the intersection of two lines, computing it only if either line changed.
+     * @param lineSet The collection the ids refer to.
+     * @param id1 Id of the first line.
+     * @param id2 Id of the second line.
+     * @return The intersection point.
+     */
+    dvec3 intersect(LineCollection &lineSet, int id1, int id2) {
+        if (id1 > id2) std::swap(id1, id2);
+        unsigned long long key = ((unsigned long long) id1 << 32) | (unsigned int) id2;
+        unsigned long v1 = lineSet.version(id1), v2 = lineSet.version(id2);
+        std::unordered_map<unsigned long long, Entry>::iterator it = entries.find(key);
+        if (it != entries.end()) {
+            if (it->second.v1 == v1 && it->second.v2 == v2) {
+                hits++;
+                return it->second.point;
+            }
+            entries.erase(it);
+        }
+        misses++;
+        if (entries.size() >= capacity) sweep(lineSet);
+        Entry e;
+        e.point = lineSet.line(id1).findIntersectionPoint(lineSet.line(id2));
+        e.v1 = v1;
+        e.v2 = v2;
+        entries[key] = e;
+        return e.point;
+    }
+
+    /**
+     * @brief Drops the entries of lines that changed or no longer exist; clears the map if it stays full.
+     * @param lineSet The collection the ids refer to.
+     */
+    void sweep(LineCollection &lineSet) {
+        for (std::unordered_map<unsigned long long, Entry>::iterator it = entries.begin(); it != entries.end();) {
+            int id1 = (int) (it->first >> 32), id2 = (int) (it->first & 0xffffffffu);
+            if (id2 >= lineSet.size() || lineSet.version(id1) != it->second.v1 || lineSet.version(id2) != it->second.v2) {
+                it = entries.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        if (entries.size() >= capacity / 2) entries.clear();
+    }
+
+    /**
+     * @brief Returns the number of cache hits.
+     */
+    unsigned long getHits() const {
+        return hits;
+    }
+
+    /**
+     * @brief Returns the number of cache misses.
+     */
+    unsigned long getMisses() const {
+        return misses;
+    }
+
+    /**
+     * @brief Returns the ratio of lookups served from the cache.
+     */
+    float hitRate() const {
+        return hits + misses > 0 ? (float) hits / (hits + misses) : 0;
+    }
+
+    /**
+     * @brief Prints the cache statistics to the console.
+     */
+    void printStats() const {
+        printf("Intersection cache: %lu hits, %lu misses, hit rate %3.2f, %lu entries\n",
+               hits, misses, hitRate(), (unsigned long) entries.size());
+    }
+};
+
+IntersectionCache intersections; /**< Cache of the computed line intersections. */
+
+/**
+ * @class LineGroups
+ * @brief Groups the lines by quantized direction, and coincident lines by quantized offset.
+ *
+ * The direction of a line is its normal angle folded into [0, pi); lines whose directions differ
+ * by at most angleTolerance are treated as parallel, since their intersection is not numerically
+ * meaningful. Parallel lines whose normalized offsets differ by at most offsetTolerance are
+ * coincident. The lines are hashed into direction buckets of angleTolerance, so finding the
+ * lines parallel to a line only looks at its bucket and the two neighbouring ones, which cover
+ * directions that round to either side of a bucket edge. Everything is computed in double, as
+ * the lines may lie far from the origin. The buckets are extended when lines are appended and
+ * rebuilt when lines move.
+ */
+class LineGroups {
+public:
+    static constexpr double angleTolerance = 1e-5; /**< Width of a direction bucket in radians. */
+    static constexpr double offsetTolerance = 1e-5; /**< Width of an offset bucket in world units. */
+
+    /**
+     * @struct Key
+     * @brief Direction bucket, direction and offset of a line.
+     */
+    struct Key {
+        long long direction; /**< Direction bucket. */
+        double angle; /**< Normal angle folded into the half turn of the direction buckets. */
+        double offset; /**< Signed distance from the origin along the folded normal. */
+    };
+
+private:
+    std::unordered_map<long long, std::vector<int> > buckets; /**< Lines per direction bucket. */
+    std::vector<Key> keys; /**< Buckets of each line. */
+    unsigned long epoch = 0; /**< Line collection epoch the buckets were built from. */
+    unsigned long changes = 0; /**< Line collection change count the buckets were built from. */
+    bool built = false; /**< Whether the buckets were built at all. */
+
+    /**
+     * @brief Brings the buckets up to date with the line collection.
+     */
+    void sync() {
+        if (!built || lines->getEpoch() != epoch || lines->getChanges() != changes || (int) keys.size() > lines->size()) {
+            buckets.clear();
+            keys.clear();
+            epoch = lines->getEpoch();
+            changes = lines->getChanges();
+            built = true;
+        }
+        while ((int) keys.size() < lines->size()) {
+            keys.push_back(keyOf(lines->line((int) keys.size())));
+            buckets[keys.back().direction].push_back((int) keys.size() - 1);
+        }
+    }
+
+    /**
+     * @brief Returns the number of direction buckets in a half turn.
+     */
+    static long long halfTurn() {
+        return (long long) floor(M_PI / angleTolerance + 0.5);
+    }
+
+    /**
+     * @brief Returns the direction bucket next to a bucket, wrapping around the half turn.
+     * @param direction The bucket.
+     * @param step -1 or 1.
+     */
+    static long long neighbour(long long direction, int step) {
+        return (direction + step + halfTurn()) % halfTurn();
+    }
+
+    /**
+     * @brief Returns whether two lines are within the angle tolerance.
+     * @param flipped Set if their folded normals point in opposite directions, across the wrap at pi.
+     */
+    static bool near(const Key &k1, const Key &k2, bool &flipped) {
+        double d = fabs(k1.angle - k2.angle);
+        flipped = d > M_PI / 2;
+        if (flipped) d = M_PI - d;
+        return d <= angleTolerance;
+    }
+
+    /**
+     * @brief Returns whether two keys belong to coincident lines.
+     */
+    static bool coincide(const Key &k1, const Key &k2) {
+        bool flipped;
+        return near(k1, k2, flipped) && fabs(k1.offset - (flipped ? -k2.offset : k2.offset)) <= offsetTolerance;
+    }
+
+public:
+    /**
+     * @brief Computes the buckets of a line.
+     */
+    static Key keyOf(const Line &line) {
+        double a = line.getA(), b = line.getB(), c = line.getC();
+        if (b < 0 || (b == 0 && a < 0)) {    // fold the normal angle into [0, pi)
+            a = -a;
+            b = -b;
+            c = -c;
+        }
+        double n = sqrt(a * a + b * b);
+        double angle = atan2(b, a);
+        long long direction = (long long) floor(angle / angleTolerance + 0.5);
+        if (direction >= halfTurn()) {    // pi is the same direction as 0 with the normal flipped
+            direction -= halfTurn();
+            angle -= M_PI;
+            c = -c;
+        }
+        Key key = {direction, angle, n > 0 ? c / n : 0};
+        return key;
+    }
+
+    /**
+     * @brief Returns the lines parallel to a line, the line itself included.
+     * @param lineId Index of the line (vertex index / 4).
+     */
+    std::vector<int> parallelTo(int lineId) {
+        sync();
+        std::vector<int> result;
+        long long direction = keys[lineId].direction;
+        long long searched[3] = {neighbour(direction, -1), direction, neighbour(direction, 1)};
+        for (int s = 0; s < 3; s++) {
+            if (s > 0 && searched[s] == searched[s - 1]) continue;
+            std::unordered_map<long long, std::vector<int> >::const_iterator it = buckets.find(searched[s]);
+            if (it == buckets.end()) continue;
+            for (size_t k = 0; k < it->second.size(); k++) {
+                if (parallel(lineId, it->second[k])) result.push_back(it->second[k]);
+            }
+        }
+        return result;
+    }
+
+    /**
+     * @brief Returns whether two lines are parallel.
+     */
+    bool parallel(int id1, int id2) {
+        sync();
+        bool flipped;
+        return near(keys[id1], keys[id2], flipped);
+    }
+
+    /**
+     * @brief Returns whether two lines coincide.
+     */
+    bool coincident(int id1, int id2) {
+        sync();
+        return coincide(keys[id1], keys[id2]);
+    }
+
+    /**
+     * @brief Returns the groups of two or more coincident lines.
+     *
+     * Every line of a bucket is compared with the lines of the same and the next bucket whose
+     * offsets fall in the same or an adjacent offset bucket, and coincident pairs are joined.
+     */
+    std::vector<std::vector<int> > coincidentGroups() {
+        sync();
+        std::vector<int> parent(keys.size());
+        for (size_t k = 0; k < parent.size(); k++) parent[k] = (int) k;
+        std::function<int(int)> root = [&parent, &root](int k) {
+            return parent[k] == k ? k : parent[k] = root(parent[k]);
+        };
+        for (std::unordered_map<long long, std::vector<int> >::iterator it = buckets.begin(); it != buckets.end(); ++it) {
+            std::unordered_map<long long, std::vector<int> > byOffset;
+            const Key &first = keys[it->second[0]];
+            long long next = neighbour(it->first, 1);
+            std::unordered_map<long long, std::vector<int> >::iterator nextIt = buckets.find(next);
+            for (int b = 0; b < 2; b++) {
+                const std::vector<int> *members = b == 0 ? &it->second : nextIt != buckets.end() && next != it->first ? &nextIt->second : NULL;
+                if (!members) continue;
+                for (size_t k = 0; k < members->size(); k++) {
+                    const Key &key = keys[(*members)[k]];
+                    bool flipped;
+                    near(first, key, flipped);
+                    double offset = flipped ? -key.offset : key.offset;
+                    byOffset[(long long) floor(offset / offsetTolerance)].push_back((*members)[k]);
+                }
+            }
+            for (size_t k = 0; k < it->second.size(); k++) {
+                int line = it->second[k];
+                bool flipped;
+                near(first, keys[line], flipped);
+                long long cell = (long long) floor((flipped ? -keys[line].offset : keys[line].offset) / offsetTolerance);
+                for (long long c = cell - 1; c <= cell + 1; c++) {
+                    std::unordered_map<long long, std::vector<int> >::iterator o = byOffset.find(c);
+                    if (o == byOffset.end()) continue;
+                    for (size_t m = 0; m < o->second.size(); m++) {
+                        int other = o->second[m];
+                        if (other != line && coincide(keys[line], keys[other])) parent[root(line)] = root(other);
+                    }
+                }
+            }
+        }
+        std::unordered_map<int, std::vector<int> > byRoot;
+        for (size_t k = 0; k < keys.size(); k++) byRoot[root((int) k)].push_back((int) k);
+        std::vector<std::vector<int> > groups;
+        for (std::unordered_map<int, std::vector<int> >::iterator g = byRoot.begin(); g != byRoot.end(); ++g) {
+            if (g->second.size() > 1) groups.push_back(g->second);
+        }
+        return groups;
+    }
+
+    /**
+     * @brief Prints the direction buckets and the coincident groups.
+     */
+    void print() {
+        sync();
+        size_t parallelLines = 0, parallelPairs = 0;
+        for (std::unordered_map<long long, std::vector<int> >::iterator it = buckets.begin(); it != buckets.end(); ++it) {
+            if (it->second.size() < 2) continue;
+            parallelLines += it->second.size();
+            parallelPairs += it->second.size() * (it->second.size() - 1) / 2;
+        }
+        printf("Line groups: %d lines in %d directions, %d lines in parallel groups (%d pairs skipped by intersection)\n",
+               (int) keys.size(), (int) buckets.size(), (int) parallelLines, (int) parallelPairs);
+        std::vector<std::vector<int> > groups = coincidentGroups();
+        for (size_t g = 0; g < groups.size(); g++) {
+            printf("\tcoincident:");
+            for (size_t k = 0; k < groups[g].size(); k++) printf(" %d", groups[g][k]);
+            printf("\n");
+        }
+    }
+};
+
+LineGroups lineGroups; /**< Direction and coincidence groups of the lines. */
+
+/**
+ * @class Job
+ * @brief Long operation written as a resumable state machine, advanced in time slices.
+ */
+class Job {
+public:
+    /**
+     * @brief Advances the job until it is done or the deadline has passed.
+     * @param deadline Time by which the slice must return.
+     * @return True if the job has finished.
+     */
+    virtual bool step(std::chrono::steady_clock::time_point deadline) = 0;
+
+    /**
+     * @brief Returns the finished fraction of the job in [0, 1].
+     */
+    virtual float progress() const = 0;
+
+    /**
+     * @brief Returns the name of the job.
+     */
+    virtual const char *name() const = 0;
+
+    /**
+     * @brief Virtual destructor.
+     */
+    virtual ~Job() {}
+};
+
+/**
+ * @class JobScheduler
+ * @brief Cooperative scheduler running the jobs from the idle hook within a per-frame time budget.
+ */
+class JobScheduler {
+    std::vector<std::unique_ptr<Job> > jobs; /**< Jobs in progress. */
+    std::vector<int> reported; /**< Last progress step printed for each job, in tenths. */
+    size_t next = 0; /**< Job to be resumed first, for round-robin fairness. */
+    float budgetMs = 4.0f; /**< Time the jobs may use per frame. */
+    std::chrono::steady_clock::duration spent = std::chrono::steady_clock::duration::zero(); /**< Time used since the last frame. */
+
+public:
+    /**
+     * @brief Adds a job.
+     * @param job The job, owned by the scheduler from now on.
+     */
+    void add(Job *job) {
+        jobs.push_back(std::unique_ptr<Job>(job));
+        reported.push_back(0);
+        printf("Job %s started\n", job->name());
+    }
+
+    /**
+     * @brief Sets the time the jobs may use per frame.
+     * @param ms The budget in milliseconds.
+     */
+    void setBudget(float ms) {
+        budgetMs = ms;
+    }
+
+    /**
+     * @brief Returns whether any job is in progress.
+     */
+    bool busy() const {
+        return !jobs.empty();
+    }
+
+    /**
+     * @brief Returns the first job in progress, or NULL.
+     */
+    const Job *current() const {
+        return jobs.empty() ? NULL : jobs[0].get();
+    }
+
+    /**
+     * @brief Starts a new frame budget; called when a frame is drawn.
+     */
+    void beginFrame() {
+        spent = std::chrono::steady_clock::duration::zero();
+    }
+
+    /**
+     * @brief Runs slices of the jobs in round-robin order until the frame budget is used up.
+     *
+     * GLUT may call onIdle several times between two frames, so the time of every call
+     * since the last beginFrame() counts against the same budget.
+     */
+    void run() {
+        if (jobs.empty()) return;
+        std::chrono::steady_clock::duration budget = std::chrono::microseconds((long long) (budgetMs * 1000));
+        if (spent >= budget) return;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point deadline = start + (budget - spent);
+        while (!jobs.empty() && std::chrono::steady_clock::now() < deadline) {
+            if (next >= jobs.size()) next = 0;
+            if (jobs[next]->step(deadline)) {
+                printf("Job %s finished\n", jobs[next]->name());
+                jobs.erase(jobs.begin() + next);
+                reported.erase(reported.begin() + next);
+            } else {
+                int tenth = (int) (jobs[next]->progress() * 10);
+                if (tenth > reported[next]) {
+                    reported[next] = tenth;
+                    printf("Job %s %d%%\n", jobs[next]->name(), tenth * 10);
+                }
+                next++;
+            }
+        }
+        spent += std::chrono::steady_clock::now() - start;
+    }
+};
+
+JobScheduler jobs; /**< Background jobs advanced from onIdle. */
+
+/**
+ * @class AllPairsIntersectionJob
+ * @brief Intersects every pair of lines of a snapshot and publishes the visible intersections.
+ *
+ * Works on a copy-on-write snapshot of the lines, so edits made meanwhile do not disturb it.
+ * The points found in a slice are added at the end of the slice.
+ */
+class AllPairsIntersectionJob : public Job {
+    ChunkedArray<dvec3> snapshot; /**< The lines at the start of the job. */
+    int lineCount; /**< Number of lines in the snapshot. */
+    std::vector<int> order; /**< Line indices sorted by direction bucket. */
+    std::vector<int> runEnd; /**< End of the direction bucket of each position in order. */
+    int i = 0; /**< Position in order of the first line of the next pair. */
+    int j = 1; /**< Position in order of the second line of the next pair. */
+    double done = 0; /**< Number of pairs processed. */
+    double total; /**< Number of pairs. */
+    std::vector<dvec3> found; /**< Points found in the current slice. */
+
+public:
+    /**
+     * @brief Constructor for the AllPairsIntersectionJob class.
+     * @param lineSet The lines to intersect.
+     */
+    AllPairsIntersectionJob(LineCollection &lineSet) {
+        snapshot = lineSet.getLines().Vtx();
+        lineCount = (int) snapshot.size() / 4;
+        std::vector<long long> direction(lineCount);
+        for (int l = 0; l < lineCount; l++) {
+            direction[l] = LineGroups::keyOf(Line(snapshot[l * 4], snapshot[l * 4 + 1])).direction;
+            order.push_back(l);
+        }
+        std::sort(order.begin(), order.end(), [&direction](int a, int b) { return direction[a] < direction[b]; });
+        runEnd.resize(lineCount);
+        total = 0;
+        for (int k = lineCount - 1; k >= 0; k--) {
+            bool sameAsNext = k + 1 < lineCount && direction[order[k]] == direction[order[k + 1]];
+            runEnd[k] = sameAsNext ? runEnd[k + 1] : k + 1;
+            total += lineCount - runEnd[k];
+        }
+        if (lineCount > 0) j = runEnd[0];    // parallel pairs are never visited
+    }
+
+    bool step(std::chrono::steady_clock::time_point deadline) override {
+        found.clear();
+        int sinceCheck = 0;
+        while (i < lineCount - 1) {
+            Line l1(snapshot[order[i] * 4], snapshot[order[i] * 4 + 1]);
+            for (; j < lineCount; j++) {
+                Line l2(snapshot[order[j] * 4], snapshot[order[j] * 4 + 1]);
+                if (l1.getA() * l2.getB() - l2.getA() * l1.getB() != 0) {
+                    dvec3 p = l1.findIntersectionPoint(l2);
+                    if (fabs(p.x) <= 1 && fabs(p.y) <= 1) found.push_back(p);
+                }
+                done++;
+                if (++sinceCheck == 256) {
+                    sinceCheck = 0;
+                    if (std::chrono::steady_clock::now() >= deadline) {
+                        j++;
+                        publish();
+                        return false;
+                    }
+                }
+            }
+            i++;
+            if (i < lineCount) j = runEnd[i];
+        }
+        publish();
+        return true;
+    }
+
+    /**
+     * @brief Adds the points found in the slice to the scene.
+     */
+    void publish() {
+        if (!found.empty()) points->addPoints(found);
+    }
+
+    float progress() const override {
+        return total > 0 ? (float) (done / total) : 1.0f;
+    }
+
+    const char *name() const override {
+        return "intersect all";
+    }
+};
+
+/**
+ * @class SceneSink
+ * @brief Receives the points and lines of a scene as they are read or generated.
+ */
+class SceneSink {
+public:
+    virtual ~SceneSink() {}
+
+    /**
+     * @brief Receives a point.
+     */
+    virtual void point(const dvec3 &p) = 0;
+
+    /**
+     * @brief Receives a line given by two of its points.
+     */
+    virtual void line(const dvec3 &p1, const dvec3 &p2) = 0;
+};
+
+/**
+ * @class SceneFile
+ * @brief Scene file format: a header, then the points, then the lines.
+ *
+ * The header is the magic "PLSC", a 32-bit version and the 64-bit point and line counts. Points
+ * follow as (x, y) and lines as the (x, y) of their two defining points, all little-endian
+ * doubles, so a file can be written and read as a stream whatever its size. Every field goes
+ * through LittleEndian, so the files are the same on every host.
+ */
+class SceneFile : public SceneSink {
+    FILE *file = NULL; /**< File being written. */
+    std::vector<char> bytes; /**< Encoding buffer of the element being written. */
+    unsigned long long pointsLeft = 0; /**< Points still to be written. */
+    unsigned long long linesLeft = 0; /**< Lines still to be written. */
+
+public:
+    static const unsigned int version = 1; /**< Version written to the header. */
+    static const size_t headerSize = 24; /**< Bytes before the first point. */
+
+    /**
+     * @brief Starts writing a scene file.
+     * @param path Path of the file.
+     * @param pointCount Number of points that will be written.
+     * @param lineCount Number of lines that will be written.
+     * @return False if the file cannot be created.
+     */
+    bool create(const char *path, unsigned long long pointCount, unsigned long long lineCount) {
+        file = fopen(path, "wb");
+        if (!file) {
+            printf("Cannot create scene %s\n", path);
+            return false;
+        }
+        setvbuf(file, NULL, _IOFBF, 1 << 20);
+        bytes.clear();
+        LittleEndian::putU32(bytes, 0x43534c50);    // "PLSC"
+        LittleEndian::putU32(bytes, version);
+        LittleEndian::putU64(bytes, pointCount);
+        LittleEndian::putU64(bytes, lineCount);
+        fwrite(&bytes[0], bytes.size(), 1, file);
+        pointsLeft = pointCount;
+        linesLeft = lineCount;
+        return true;
+    }
+
+    void point(const dvec3 &p) override {
+        bytes.clear();
+        LittleEndian::putF64(bytes, p.x);
+        LittleEndian::putF64(bytes, p.y);
+        fwrite(&bytes[0], bytes.size(), 1, file);
+        pointsLeft--;
+    }
+
+    void line(const dvec3 &p1, const dvec3 &p2) override {
+        bytes.clear();
+        LittleEndian::putF64(bytes, p1.x);
+        LittleEndian::putF64(bytes, p1.y);
+        LittleEndian::putF64(bytes, p2.x);
+        LittleEndian::putF64(bytes, p2.y);
+        fwrite(&bytes[0], bytes.size(), 1, file);
+        linesLeft--;
+    }
+
+    /**
+     * @brief Finishes writing.
+     * @return False if the counts in the header were not matched or the write failed.
+     */
+    bool close() {
+        bool ok = pointsLeft == 0 && linesLeft == 0 && !ferror(file);
+        ok = fclose(file) == 0 && ok;
+        file = NULL;
+        return ok;
+    }
+
+    /**
+     * @brief Streams a scene file into a sink.
+     * @return False if the file is missing, has a wrong header or is truncated.
+     */
+    static bool read(const char *path, SceneSink &sink) {
+        FILE *in = fopen(path, "rb");
+        if (!in) {
+            printf("Cannot open scene %s\n", path);
+            return false;
+        }
+        char head[headerSize];
+        bool ok = fread(head, headerSize, 1, in) == 1 && LittleEndian::getU32(head) == 0x43534c50 &&
+                  LittleEndian::getU32(head + 4) == version;
+        unsigned long long counts[2] = {0, 0};
+        if (ok) {
+            counts[0] = LittleEndian::getU64(head + 8);
+            counts[1] = LittleEndian::getU64(head + 16);
+        }
+        std::vector<char> buffer;
+        for (int kind = 0; kind < 2 && ok; kind++) {
+            size_t width = (kind == 0 ? 2 : 4) * 8;
+            for (unsigned long long left = counts[kind]; left > 0 && ok;) {
+                size_t n = left < 65536 ? (size_t) left : 65536;
+                buffer.resize(n * width);
+                ok = fread(&buffer[0], width, n, in) == n;
+                for (size_t k = 0; k < n && ok; k++) {
+                    const char *v = &buffer[k * width];
+                    if (kind == 0) {
+                        sink.point(dvec3(LittleEndian::getF64(v), LittleEndian::getF64(v + 8), 1));
+                    } else {
+                        sink.line(dvec3(LittleEndian::getF64(v), LittleEndian::getF64(v + 8), 1),
+                                  dvec3(LittleEndian::getF64(v + 16), LittleEndian::getF64(v + 24), 1));
+                    }
+                }
+                left -= n;
+            }
+        }
+        fclose(in);
+        if (!ok) printf("Scene %s is not a valid scene file\n", path);
+        return ok;
+    }
+
+    /**
+     * @brief Writes the current points and lines to a scene file.
+     */
+    static bool save(const char *path) {
+        SceneFile out;
+        if (!out.create(path, points->size(), lines->size())) return false;
+        ChunkedArray<dvec3> &pts = points->getPoints().Vtx();
+        for (int p = 0; p < points->size(); p++) out.point(pts[p]);
+        ChunkedArray<dvec3> &vtx = lines->getLines().Vtx();
+        for (int l = 0; l < lines->size(); l++) out.line(vtx[l * 4], vtx[l * 4 + 1]);
+        return out.close();
+    }
+
+    /**
+     * @brief Adds the points and lines of a scene file to the collections, in large batches.
+     */
+    static bool load(const char *path);
+};
+
+/**
+ * @class CollectionSink
+ * @brief Adds the elements it receives to the point and line collections in large batches.
+ */
+class CollectionSink : public SceneSink {
+    std::vector<dvec3> newPoints; /**< Points of the current batch. */
+    std::vector<dvec3> newLines; /**< Vertices of the lines of the current batch. */
+
+public:
+    static const size_t batchSize = 1 << 20; /**< Elements added at a time. */
+
+    ~CollectionSink() {
+        flush();
+    }
+
+    void point(const dvec3 &p) override {
+        newPoints.push_back(p);
+        if (newPoints.size() == batchSize) flush();
+    }
+
+    void line(const dvec3 &p1, const dvec3 &p2) override {
+        Line l(p1, p2);
+        newLines.push_back(p1);
+        newLines.push_back(p2);
+        newLines.push_back(l.getP3());
+        newLines.push_back(l.getP4());
+        if (newLines.size() == 4 * batchSize) flush();
+    }
+
+    /**
+     * @brief Adds the current batch to the collections.
+     */
+    void flush() {
+        if (!newPoints.empty()) points->addPoints(newPoints);
+        if (!newLines.empty()) lines->addLines(newLines);
+        newPoints.clear();
+        newLines.clear();
+    }
+};
+
+/**
+ * @class VectorSink
+ * @brief Keeps the elements it receives in memory, for the benchmarks and the kernel checks.
+ */
+class VectorSink : public SceneSink {
+public:
+    std::vector<dvec3> points; /**< The points received. */
+    std::vector<dvec3> lineEnds; /**< The two defining points of every line received. */
+
+    void point(const dvec3 &p) override {
+        points.push_back(p);
+    }
+
+    void line(const dvec3 &p1, const dvec3 &p2) override {
+        lineEnds.push_back(p1);
+        lineEnds.push_back(p2);
+    }
+};
+
+bool SceneFile::load(const char *path) {
+    CollectionSink sink;
+    return read(path, sink);
+}
+
+/**
+ * @class AppenderSink
+ * @brief Appends the elements it receives to the collections through their concurrent appenders.
+ *
+ * Every sink has its own writers, so sinks on several threads can import at the same time;
+ * the elements become visible when the main thread publishes them.
+ */
+class AppenderSink : public SceneSink {
+    ConcurrentAppender<dvec3>::Writer pointWriter; /**< Writer of the points. */
+    ConcurrentAppender<LineCollection::Vertices>::Writer lineWriter; /**< Writer of the lines. */
+
+public:
+    AppenderSink() : pointWriter(points->appender()), lineWriter(lines->appender()) {}
+
+    void point(const dvec3 &p) override {
+        pointWriter.push(p);
+    }
+
+    void line(const dvec3 &p1, const dvec3 &p2) override {
+        Line l(p1, p2);
+        LineCollection::Vertices v = {{p1, p2, l.getP3(), l.getP4()}};
+        lineWriter.push(v);
+    }
+};
+
+std::atomic<int> backgroundProducers(0); /**< Threads currently appending to the collections. */
+
+/**
+ * @brief Imports scene files on background threads, one per file, while the program keeps running.
+ * @param paths The files, separated by spaces.
+ */
+void importScenes(const char *paths) {
+    std::string list = paths;
+    size_t start = 0;
+    while ((start = list.find_first_not_of(' ', start)) != std::string::npos) {
+        size_t end = list.find(' ', start);
+        std::string path = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+        start = end;
+        backgroundProducers++;
+        std::thread([path]() {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            bool ok;
+            {
+                AppenderSink sink;
+                ok = SceneFile::read(path.c_str(), sink);
+            }
+            double ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count() / 1000.0;
+            printf("Imported %s%s in %.1f ms\n", path.c_str(), ok ? "" : " partially", ms);
+            backgroundProducers--;
+        }).detach();
+    }
+}
+
+/**
+ * @class SceneGenerator
+ * @brief Generates reproducible synthetic scenes from a seed.
+ *
+ * The random numbers come from splitmix64 and Box-Muller rather than the standard library
+ * distributions, so a seed gives the same scene on every platform. Elements are sent to the sink
+ * one by one, so scenes of any size can be streamed to a file.
+ */
+class SceneGenerator {
+public:
+    /**
+     * @brief Distributions of the generated elements.
+     */
+    enum Kind {
+        UNIFORM, /**< Points and lines through two points, uniform in the [-1, 1] square. */
+        CLUSTERS, /**< Gaussian clusters of points, lines within a cluster. */
+        GRID, /**< Points on a lattice, horizontal and exactly vertical grid lines. */
+        PENCIL, /**< Four pencils of near-parallel lines. */
+        BUNDLE, /**< Bundles of lines through eight common points. */
+        VERTICAL, /**< Vertical and nearly vertical lines, the b == 0 path of Line. */
+        KIND_COUNT
+    };
+
+private:
+    unsigned long long state; /**< State of splitmix64. */
+
+    unsigned long long next() {
+        unsigned long long z = (state += 0x9e3779b97f4a7c15ULL);
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    }
+
+    /**
+     * @brief Returns a uniform number in [-1, 1).
+     */
+    double uniform() {
+        return (next() >> 11) * (2.0 / 9007199254740992.0) - 1;
+    }
+
+    /**
+     * @brief Returns a standard normal number.
+     */
+    double gaussian() {
+        double u1 = (next() >> 11) * (1.0 / 9007199254740992.0), u2 = (next() >> 11) * (1.0 / 9007199254740992.0);
+        return sqrt(-2 * log(u1 > 0 ? u1 : 1e-300)) * cos(2 * M_PI * u2);
+    }
+
+    dvec3 uniformPoint() {
+        double x = uniform();
+        return dvec3(x, uniform(), 1);
+    }
+
+public:
+    /**
+     * @brief Constructor for the SceneGenerator class.
+     * @param seed Seed of the random numbers.
+     */
+    SceneGenerator(unsigned long long seed) : state(seed) {}
+
+    /**
+     * @brief Returns the name of a distribution.
+     */
+    static const char *name(Kind kind) {
+        static const char *names[] = {"uniform", "clusters", "grid", "pencil", "bundle", "vertical"};
+        return names[kind];
+    }
+
+    /**
+     * @brief Finds a distribution by name.
+     * @return False if there is no such distribution.
+     */
+    static bool parse(const char *text, Kind &kind) {
+        for (int k = 0; k < KIND_COUNT; k++) {
+            if (strcmp(text, name((Kind) k)) == 0) {
+                kind = (Kind) k;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * @brief Generates a scene.
+     * @param kind Distribution of the elements.
+     * @param pointCount Number of points.
+     * @param lineCount Number of lines.
+     * @param sink Receives the points, then the lines.
+     */
+    void generate(Kind kind, unsigned long long pointCount, unsigned long long lineCount, SceneSink &sink) {
+        static const int groups = 16; /* clusters, pencils or bundles */
+        dvec3 centers[groups];
+        double angles[groups];
+        for (int g = 0; g < groups; g++) {
+            centers[g] = uniformPoint() * 0.8;
+            angles[g] = (uniform() + 1) * M_PI;
+        }
+        unsigned long long side = (unsigned long long) ceil(sqrt((double) pointCount));
+        for (unsigned long long i = 0; i < pointCount; i++) {
+            if (kind == CLUSTERS) {
+                const dvec3 &c = centers[next() % groups];
+                double x = c.x + gaussian() * 0.03;
+                sink.point(dvec3(x, c.y + gaussian() * 0.03, 1));
+            } else if (kind == GRID) {
+                sink.point(dvec3(-1 + 2 * ((i % side) + 0.5) / side, -1 + 2 * ((i / side) + 0.5) / side, 1));
+            } else {
+                sink.point(uniformPoint());
+            }
+        }
+        unsigned long long half = (lineCount + 1) / 2;
+        for (unsigned long long i = 0; i < lineCount; i++) {
+            dvec3 p1, p2;
+            if (kind == CLUSTERS) {
+                const dvec3 &c = centers[next() % groups];
+                double x1 = c.x + gaussian() * 0.03, y1 = c.y + gaussian() * 0.03;
+                double x2 = c.x + gaussian() * 0.03;
+                p1 = dvec3(x1, y1, 1);
+                p2 = dvec3(x2, c.y + gaussian() * 0.03, 1);
+            } else if (kind == GRID) {
+                double t = -1 + 2 * ((i / 2) + 0.5) / half;
+                p1 = i % 2 == 0 ? dvec3(-1, t, 1) : dvec3(t, -1, 1);
+                p2 = i % 2 == 0 ? dvec3(1, t, 1) : dvec3(t, 1, 1);
+            } else if (kind == PENCIL) {
+                double angle = angles[next() % 4] + gaussian() * 1e-4;
+                p1 = uniformPoint();
+                p2 = p1 + dvec3(cos(angle), sin(angle), 0) * 0.5;
+            } else if (kind == BUNDLE) {
+                double angle = (uniform() + 1) * M_PI;
+                p1 = centers[next() % 8];
+                p2 = p1 + dvec3(cos(angle), sin(angle), 0) * 0.5;
+            } else if (kind == VERTICAL) {
+                static const double tilts[] = {0, 1e-7, 1e-5, 1e-3};
+                double x = uniform() * 0.9;
+                p1 = dvec3(x, -0.9, 1);
+                p2 = dvec3(x + tilts[next() % 4] * uniform(), 0.9, 1);
+            } else {
+                p1 = uniformPoint();
+                p2 = uniformPoint();
+            }
+            if (p1.x == p2.x && p1.y == p2.y) p2.y += 1e-3;
+            sink.line(p1, p2);
+        }
+    }
+};
+
+/**
+ * @brief Generates a scene file from the POINTSLINES_GENERATE specification and exits.
+ *
+ * The specification is "kind points lines seed path", e.g. "clusters 1000000 10000 42 big.pls".
+ * @return The exit status.
+ */
+int runSceneGenerator() {
+    char kindName[32], path[1024];
+    double pointCount, lineCount;
+    unsigned long long seed;
+    SceneGenerator::Kind kind;
+    if (sscanf(getenv("POINTSLINES_GENERATE"), "%31s %lf %lf %llu %1023s", kindName, &pointCount, &lineCount, &seed, path) != 5 ||
+        !SceneGenerator::parse(kindName, kind)) {
+        printf("POINTSLINES_GENERATE must be \"kind points lines seed path\" with kind one of");
+        for (int k = 0; k < SceneGenerator::KIND_COUNT; k++) printf(" %s", SceneGenerator::name((SceneGenerator::Kind) k));
+        printf("\n");
+        return 1;
+    }
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    SceneFile out;
+    if (!out.create(path, (unsigned long long) pointCount, (unsigned long long) lineCount)) return 1;
+    SceneGenerator(seed).generate(kind, (unsigned long long) pointCount, (unsigned long long) lineCount, out);
+    if (!out.close()) {
+        printf("Writing %s failed\n", path);
+        return 1;
+    }
+    double s = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    printf("Generated %s: %.0f %s points and %.0f lines (seed %llu) in %.2f s\n", path, pointCount, kindName, lineCount, seed, s);
+    return 0;
+}
+
+/**
+ * @brief Intersects the lines of two blocks given by their implicit coefficients (a, b, c).
+ *
+ * Parallel pairs are skipped and only intersections inside the [-1, 1] square are kept,
+ * like AllPairsIntersectionJob does.
+ * @param first Coefficients of the lines of the first block.
+ * @param second Coefficients of the lines of the second block, ignored if same is true.
+ * @param same Whether the block is intersected with itself.
+ * @param out Receives the intersection points.
+ */
+void intersectBlocks(const std::vector<dvec3> &first, const std::vector<dvec3> &second, bool same, std::vector<dvec3> &out) {
+    const std::vector<dvec3> &other = same ? first : second;
+    std::vector<double> a(other.size()), b(other.size()), c(other.size());
+    for (size_t j = 0; j < other.size(); j++) {
+        a[j] = other[j].x;
+        b[j] = other[j].y;
+        c[j] = other[j].z;
+    }
+    const GeometryKernels &kernels = kernelDispatch.kernels();
+    for (size_t i = 0; i < first.size(); i++) {
+        size_t j = same ? i + 1 : 0;
+        kernels.intersectRow(first[i].x, first[i].y, first[i].z, a.data() + j, b.data() + j, c.data() + j, other.size() - j, out);
+    }
+}
+
+/**
+ * @brief Removes duplicate points, comparing them on a grid of 1e-5.
+ * @param pts The points, sorted and deduplicated in place.
+ */
+void dedupPoints(std::vector<dvec3> &pts) {
+    std::vector<std::pair<long long, long long> > keys(pts.size());
+    std::vector<size_t> order(pts.size());
+    for (size_t i = 0; i < pts.size(); i++) {
+        keys[i] = std::make_pair((long long) floor(pts[i].x * 1e5 + 0.5), (long long) floor(pts[i].y * 1e5 + 0.5));
+        order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), [&keys](size_t a, size_t b) { return keys[a] < keys[b]; });
+    std::vector<dvec3> unique;
+    for (size_t k = 0; k < order.size(); k++) {
+        if (k == 0 || keys[order[k]] != keys[order[k - 1]]) unique.push_back(pts[order[k]]);
+    }
+    pts.swap(unique);
+}
+
+/**
+ * @class ShardedIntersection
+ * @brief All-pairs intersection partitioned into block pairs and run by worker processes.
+ *
+ * The coordinator splits the lines into blocks of blockLines lines; every pair of blocks is a
+ * shard. Workers are separate instances of the executable started with the --shard-worker argument,
+ * standing in for remote nodes: they receive the coefficients of the two blocks over a pipe and
+ * stream the intersections back. A shard whose worker dies or exceeds the timeout is retried on a
+ * fresh worker. Requests and replies are encoded field by field through LittleEndian, so the
+ * protocol does not depend on the hosts: a request is the shard, whether it pairs a block with
+ * itself and the two line counts as 32-bit values, then (a, b, c) of every line as doubles; a
+ * reply is the shard and the point count, then (x, y) of every point. The results are merged
+ * and deduplicated. The run advances in rounds that never
+ * block longer than asked, so it can be driven by a Job. Worker processes need fork/exec and are
+ * built with SHARD_WORKERS (Linux only); otherwise, or when no worker can be started, the
+ * remaining shards run in the coordinator process, one per round.
+ */
+class ShardedIntersection {
+public:
+    static const int blockLines = 512; /**< Lines in a block. */
+    static const int maxRetries = 3; /**< Attempts of a shard after the first one. */
+    static const int timeoutMs = 30000; /**< Time after which a shard is considered lost. */
+
+private:
+    /**
+     * @struct Shard
+     * @brief A pair of blocks.
+     */
+    struct Shard {
+        int first; /**< Index of the first block. */
+        int second; /**< Index of the second block. */
+        int attempts; /**< Number of times the shard was dispatched. */
+    };
+
+    std::vector<std::vector<dvec3> > blocks; /**< Coefficients of the lines per block. */
+    std::vector<Shard> shards; /**< All shards. */
+    unsigned long retried = 0; /**< Number of shard retries. */
+    std::deque<int> queue; /**< Shards waiting for a worker. */
+    size_t finished = 0; /**< Shards done or given up in the current run. */
+    std::vector<dvec3> result; /**< Points found in the current run. */
+    bool local = true; /**< Whether the remaining shards run in this process. */
+
+#ifdef SHARD_WORKERS
+    /**
+     * @struct Worker
+     * @brief A worker process and its pipes.
+     */
+    struct Worker {
+        pid_t pid = -1; /**< Process id. */
+        int in = -1; /**< Pipe to the standard input of the worker. */
+        int out = -1; /**< Non-blocking pipe from the standard output of the worker. */
+        int shard = -1; /**< Shard in progress, -1 if idle. */
+        std::chrono::steady_clock::time_point started; /**< Dispatch time of the shard. */
+        std::vector<char> received; /**< Part of the reply received so far. */
+    };
+
+    std::vector<Worker> workers; /**< Worker processes of the current run. */
+    void (*previousPipeHandler)(int) = SIG_DFL; /**< SIGPIPE handler to restore after the run. */
+
+    /**
+     * @brief Writes a whole buffer to a file descriptor.
+     */
+    static bool writeAll(int fd, const void *data, size_t bytes) {
+        const char *p = (const char *) data;
+        while (bytes > 0) {
+            ssize_t n = write(fd, p, bytes);
+            if (n <= 0) return false;
+            p += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Reads a whole buffer from a blocking file descriptor.
+     */
+    static bool readAll(int fd, void *data, size_t bytes) {
+        char *p = (char *) data;
+        while (bytes > 0) {
+            ssize_t n = read(fd, p, bytes);
+            if (n <= 0) return false;
+            p += n;
+            bytes -= n;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Appends the coefficients (a, b, c) of a block to a request.
+     */
+    static void putCoefficients(std::vector<char> &bytes, const std::vector<dvec3> &block) {
+        for (size_t i = 0; i < block.size(); i++) {
+            LittleEndian::putF64(bytes, block[i].x);
+            LittleEndian::putF64(bytes, block[i].y);
+            LittleEndian::putF64(bytes, block[i].z);
+        }
+    }
+
+    /**
+     * @brief Reads the coefficients (a, b, c) of a block from a blocking file descriptor.
+     */
+    static bool readCoefficients(int fd, std::vector<dvec3> &block, int count) {
+        std::vector<char> bytes((size_t) count * 24);
+        block.resize(count);
+        if (count > 0 && !readAll(fd, &bytes[0], bytes.size())) return false;
+        for (int i = 0; i < count; i++) {
+            const char *p = &bytes[(size_t) i * 24];
+            block[i] = dvec3(LittleEndian::getF64(p), LittleEndian::getF64(p + 8), LittleEndian::getF64(p + 16));
+        }
+        return true;
+    }
+
+    /**
+     * @brief Starts a worker process.
+     */
+    static bool spawn(Worker &w) {
+        int toWorker[2], fromWorker[2];
+        if (pipe(toWorker) != 0) return false;
+        if (pipe(fromWorker) != 0) {
+            close(toWorker[0]);
+            close(toWorker[1]);
+            return false;
+        }
+        pid_t pid = fork();
+        if (pid == 0) {
+            dup2(toWorker[0], 0);
+            dup2(fromWorker[1], 1);
+            close(toWorker[1]);
+            close(fromWorker[0]);
+            execl("/proc/self/exe", "PointsLinesWorker", "--shard-worker", (char *) NULL);    // only async-signal-safe calls after fork
+            _exit(127);
+        }
+        close(toWorker[0]);
+        close(fromWorker[1]);
+        if (pid < 0) {
+            close(toWorker[1]);
+            close(fromWorker[0]);
+            return false;
+        }
+        fcntl(fromWorker[0], F_SETFL, fcntl(fromWorker[0], F_GETFL) | O_NONBLOCK);
+        w.pid = pid;
+        w.in = toWorker[1];
+        w.out = fromWorker[0];
+        w.shard = -1;
+        w.received.clear();
+        return true;
+    }
+
+    /**
+     * @brief Stops a worker process.
+     * @param kill Whether to kill it instead of asking it to exit.
+     */
+    static void stop(Worker &w, bool kill) {
+        if (w.pid < 0) return;
+        if (kill) {
+            ::kill(w.pid, SIGKILL);
+        } else {
+            std::vector<char> quit;
+            for (int k = 0; k < 4; k++) LittleEndian::putU32(quit, k == 0 ? (unsigned int) -1 : 0);
+            writeAll(w.in, &quit[0], quit.size());
+        }
+        close(w.in);
+        close(w.out);
+        waitpid(w.pid, NULL, 0);
+        w.pid = -1;
+    }
+
+    /**
+     * @brief Sends a shard to a worker.
+     */
+    bool dispatch(Worker &w, int s) {
+        Shard &shard = shards[s];
+        bool same = shard.first == shard.second;
+        const std::vector<dvec3> &b1 = blocks[shard.first], &b2 = blocks[shard.second];
+        std::vector<char> request;
+        LittleEndian::putU32(request, (unsigned int) s);
+        LittleEndian::putU32(request, same ? 1 : 0);
+        LittleEndian::putU32(request, (unsigned int) b1.size());
+        LittleEndian::putU32(request, same ? 0 : (unsigned int) b2.size());
+        putCoefficients(request, b1);
+        if (!same) putCoefficients(request, b2);
+        shard.attempts++;
+        w.shard = s;
+        w.started = std::chrono::steady_clock::now();
+        w.received.clear();
+        return writeAll(w.in, &request[0], request.size());
+    }
+
+    /**
+     * @brief Reads what a worker has sent so far and takes its reply once it is complete.
+     * @return False if the worker closed its pipe or sent a malformed reply.
+     */
+    bool receive(Worker &w) {
+        char buffer[65536];
+        for (;;) {
+            ssize_t n = read(w.out, buffer, sizeof(buffer));
+            if (n > 0) {
+                w.received.insert(w.received.end(), buffer, buffer + n);
+            } else if (n < 0 && errno == EINTR) {
+                continue;
+            } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                break;
+            } else {
+                return false;    // end of file before the reply was complete
+            }
+        }
+        if (w.received.size() < 8) return true;
+        int shard = (int) LittleEndian::getU32(&w.received[0]), count = (int) LittleEndian::getU32(&w.received[4]);
+        if (shard != w.shard || count < 0) return false;
+        size_t bytes = 8 + (size_t) count * 16;
+        if (w.received.size() < bytes) return true;
+        if (w.received.size() > bytes) return false;    // a worker sends one reply per shard
+        for (int k = 0; k < count; k++) {
+            const char *p = &w.received[8 + (size_t) k * 16];
+            result.push_back(dvec3(LittleEndian::getF64(p), LittleEndian::getF64(p + 8), 1));
+        }
+        w.received.clear();
+        w.shard = -1;
+        finished++;
+        return true;
+    }
+
+    /**
+     * @brief Queues a failed shard again, or gives it up after maxRetries retries.
+     */
+    void requeue(int s) {
+        if (shards[s].attempts > maxRetries) {
+            printf("Sharded intersection: shard %d failed %d times, giving up\n", s, shards[s].attempts);
+            finished++;
+        } else {
+            retried++;
+            queue.push_back(s);
+        }
+    }
+
+    /**
+     * @brief Dispatches idle workers and collects replies for at most waitMs milliseconds.
+     * @return False if no worker is running, so the remaining shards must run in process.
+     */
+    bool advanceWorkers(int waitMs) {
+        for (size_t k = 0; k < workers.size(); k++) {
+            if (workers[k].pid < 0 && !spawn(workers[k])) continue;
+            if (workers[k].shard < 0 && !queue.empty()) {
+                int s = queue.front();
+                queue.pop_front();
+                if (!dispatch(workers[k], s)) {
+                    workers[k].shard = -1;
+                    stop(workers[k], true);
+                    requeue(s);
+                }
+            }
+        }
+        std::vector<pollfd> fds;
+        std::vector<size_t> owners;
+        for (size_t k = 0; k < workers.size(); k++) {
+            if (workers[k].pid < 0 || workers[k].shard < 0) continue;
+            pollfd p = {workers[k].out, POLLIN, 0};
+            fds.push_back(p);
+            owners.push_back(k);
+        }
+        if (fds.empty()) return false;
+        poll(&fds[0], fds.size(), waitMs);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (size_t f = 0; f < fds.size(); f++) {
+            Worker &w = workers[owners[f]];
+            bool failed = false;
+            if (fds[f].revents & (POLLIN | POLLHUP | POLLERR)) failed = !receive(w);
+            if (!failed && w.shard >= 0 && now - w.started > std::chrono::milliseconds(timeoutMs)) failed = true;
+            if (failed) {
+                int s = w.shard;
+                w.shard = -1;
+                stop(w, true);
+                requeue(s);
+            }
+        }
+        return true;
+    }
+#endif
+
+public:
+    /**
+     * @brief Constructor for the ShardedIntersection class, partitions the lines.
+     * @param coefficients Implicit coefficients (a, b, c) of the lines.
+     */
+    ShardedIntersection(const std::vector<dvec3> &coefficients) {
+        for (size_t i = 0; i < coefficients.size(); i += blockLines) {
+            size_t end = i + blockLines < coefficients.size() ? i + blockLines : coefficients.size();
+            blocks.push_back(std::vector<dvec3>(coefficients.begin() + i, coefficients.begin() + end));
+        }
+        for (int i = 0; i < (int) blocks.size(); i++) {
+            for (int j = i; j < (int) blocks.size(); j++) {
+                Shard s = {i, j, 0};
+                shards.push_back(s);
+            }
+        }
+    }
+
+    /**
+     * @brief Returns the number of shards.
+     */
+    size_t size() const {
+        return shards.size();
+    }
+
+    /**
+     * @brief Returns the number of shard retries of the last run.
+     */
+    unsigned long retries() const {
+        return retried;
+    }
+
+    /**
+     * @brief Runs every shard in this process.
+     * @return The deduplicated intersection points.
+     */
+    std::vector<dvec3> runLocal() const {
+        std::vector<dvec3> result;
+        for (size_t s = 0; s < shards.size(); s++) {
+            intersectBlocks(blocks[shards[s].first], blocks[shards[s].second], shards[s].first == shards[s].second, result);
+        }
+        dedupPoints(result);
+        return result;
+    }
+
+    /**
+     * @brief Runs every shard on threads of this process, streaming the points into an appender.
+     *
+     * Unlike run and runLocal the points are not deduplicated, like those of AllPairsIntersectionJob.
+     * @param out The appender receiving the points.
+     * @param threadCount Number of threads.
+     */
+    void runThreads(ConcurrentAppender<dvec3> &out, int threadCount) const {
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.push_back(std::thread([this, &out, &next]() {
+                ConcurrentAppender<dvec3>::Writer writer(out);
+                std::vector<dvec3> found;
+                size_t s;
+                while ((s = next.fetch_add(1)) < shards.size()) {
+                    found.clear();
+                    intersectBlocks(blocks[shards[s].first], blocks[shards[s].second], shards[s].first == shards[s].second, found);
+                    for (size_t p = 0; p < found.size(); p++) writer.push(found[p]);
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+    }
+
+    /**
+     * @brief Starts a run on worker processes.
+     * @param workerCount Number of worker processes.
+     */
+    void start(int workerCount) {
+        queue.clear();
+        for (size_t s = 0; s < shards.size(); s++) {
+            queue.push_back((int) s);
+            shards[s].attempts = 0;
+        }
+        finished = 0;
+        retried = 0;
+        result.clear();
+        local = true;
+#ifdef SHARD_WORKERS
+        previousPipeHandler = signal(SIGPIPE, SIG_IGN);	// a dead worker must not kill the coordinator
+        workers.assign(workerCount, Worker());
+        for (size_t k = 0; k < workers.size(); k++) spawn(workers[k]);
+        local = false;
+#else
+        (void) workerCount;
+        printf("Worker processes are not supported in this build, running in process\n");
+#endif
+    }
+
+    /**
+     * @brief Advances the run by one round of dispatching and collecting, or by one shard in process.
+     * @param waitMs Longest time to wait for replies of the workers.
+     * @return True if every shard is done.
+     */
+    bool advance(int waitMs) {
+#ifdef SHARD_WORKERS
+        if (!local && finished < shards.size()) {
+            if (advanceWorkers(waitMs)) return finished == shards.size();
+            printf("Sharded intersection: no worker could be started, running the remaining shards in process\n");
+            local = true;
+        }
+#else
+        (void) waitMs;
+#endif
+        if (!queue.empty()) {
+            int s = queue.front();
+            queue.pop_front();
+            intersectBlocks(blocks[shards[s].first], blocks[shards[s].second], shards[s].first == shards[s].second, result);
+            finished++;
+        }
+        return finished == shards.size();
+    }
+
+    /**
+     * @brief Returns the finished fraction of the current run in [0, 1].
+     */
+    float progress() const {
+        return shards.empty() ? 1.0f : (float) finished / shards.size();
+    }
+
+    /**
+     * @brief Ends a run, stopping the workers.
+     * @return The deduplicated intersection points.
+     */
+    std::vector<dvec3> finish() {
+#ifdef SHARD_WORKERS
+        for (size_t k = 0; k < workers.size(); k++) stop(workers[k], false);
+        workers.clear();
+        signal(SIGPIPE, previousPipeHandler);
+#endif
+        std::vector<dvec3> points;
+        points.swap(result);
+        dedupPoints(points);
+        return points;
+    }
+
+    /**
+     * @brief Runs the shards on worker processes, blocking until they are done.
+     * @param workerCount Number of worker processes.
+     * @return The deduplicated intersection points.
+     */
+    std::vector<dvec3> run(int workerCount) {
+        start(workerCount);
+        while (!advance(1000)) {}
+        return finish();
+    }
+
+    /**
+     * @brief Destructor, kills the workers of an unfinished run.
+     */
+    ~ShardedIntersection() {
+#ifdef SHARD_WORKERS
+        for (size_t k = 0; k < workers.size(); k++) stop(workers[k], true);
+        if (!workers.empty()) signal(SIGPIPE, previousPipeHandler);
+#endif
+    }
+
+    /**
+     * @brief Serves shards on the standard input and output until asked to quit.
+     * @return The exit status of the worker.
+     */
+    static int serve() {
+#ifdef SHARD_WORKERS
+        std::vector<dvec3> first, second;
+        std::vector<dvec3> out;
+        std::vector<char> reply;
+        for (;;) {
+            char request[16];
+            if (!readAll(0, request, sizeof(request))) return 0;
+            int header[4];
+            for (int k = 0; k < 4; k++) header[k] = (int) LittleEndian::getU32(request + 4 * k);
+            if (header[0] < 0) return 0;
+            if (header[2] < 0 || header[3] < 0) return 1;
+            if (!readCoefficients(0, first, header[2]) || !readCoefficients(0, second, header[3])) return 1;
+            out.clear();
+            intersectBlocks(first, second, header[1] != 0, out);
+            reply.clear();
+            LittleEndian::putU32(reply, (unsigned int) header[0]);
+            LittleEndian::putU32(reply, (unsigned int) out.size());
+            for (size_t p = 0; p < out.size(); p++) {
+                LittleEndian::putF64(reply, out[p].x);
+                LittleEndian::putF64(reply, out[p].y);
+            }
+            fwrite(&reply[0], reply.size(), 1, stdout);
+            fflush(stdout);
+        }
+#else
+        printf("Worker processes are not supported in this build\n");
+        return 1;
+#endif
+    }
+};
+
+/**
+ * @brief Entry point of a worker process, called by main when started with --shard-worker.
+ * @return The exit status of the worker.
+ */
+int runShardWorker() {
+    kernelDispatch.select();
+    return ShardedIntersection::serve();
+}
+
+/**
+ * @brief Returns the implicit coefficients (a, b, c) of every line of a collection.
+ */
+std::vector<dvec3> lineCoefficients(LineCollection &lineSet) {
+    std::vector<dvec3> coefficients;
+    for (int l = 0; l < lineSet.size(); l++) {
+        Line line = lineSet.line(l);
+        coefficients.push_back(dvec3(line.getA(), line.getB(), line.getC()));
+    }
+    return coefficients;
+}
+
+/**
+ * @class ShardedIntersectionJob
+ * @brief Intersects all pairs of lines on worker processes and adds the points to the scene.
+ *
+ * Each slice dispatches shards to idle workers and waits for replies until the deadline, so the
+ * window keeps responding while the workers run.
+ */
+class ShardedIntersectionJob : public Job {
+    ShardedIntersection sharded; /**< The shards of the lines at the start of the job. */
+    int workerCount; /**< Number of worker processes. */
+    std::chrono::steady_clock::time_point started; /**< Start of the job. */
+
+public:
+    /**
+     * @brief Constructor for the ShardedIntersectionJob class, starts the workers.
+     * @param lineSet The lines to intersect.
+     */
+    ShardedIntersectionJob(LineCollection &lineSet) : sharded(lineCoefficients(lineSet)) {
+        workerCount = (int) std::thread::hardware_concurrency();
+        if (workerCount < 1) workerCount = 1;
+        started = std::chrono::steady_clock::now();
+        sharded.start(workerCount);
+    }
+
+    bool step(std::chrono::steady_clock::time_point deadline) override {
+        for (;;) {
+            long long waitMs = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+            if (sharded.advance(waitMs > 0 ? (int) waitMs : 0)) break;
+            if (std::chrono::steady_clock::now() >= deadline) return false;
+        }
+        std::vector<dvec3> found = sharded.finish();
+        double ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count() / 1000.0;
+        printf("Sharded intersection: %d shards on %d workers, %d retries, %d points in %.1f ms\n",
+               (int) sharded.size(), workerCount, (int) sharded.retries(), (int) found.size(), ms);
+        if (!found.empty()) points->addPoints(found);
+        return true;
+    }
+
+    float progress() const override {
+        return sharded.progress();
+    }
+
+    const char *name() const override {
+        return "sharded intersection";
+    }
+};
+
+/**
+ * @brief Intersects all pairs of lines on background threads; the points appear as they are published.
+ */
+void runThreadedIntersection() {
+    int threadCount = (int) std::thread::hardware_concurrency();
+    if (threadCount < 1) threadCount = 1;
+    std::shared_ptr<ShardedIntersection> sharded = std::make_shared<ShardedIntersection>(lineCoefficients(*lines));
+    backgroundProducers++;
+    std::thread([sharded, threadCount]() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        sharded->runThreads(points->appender(), threadCount);
+        double ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+        printf("Threaded intersection: %d shards on %d threads in %.1f ms\n", (int) sharded->size(), threadCount, ms);
+        backgroundProducers--;
+    }).detach();
+}
+
+/**
+ * @brief Compares the single-process path with 1, 2, 4, ... worker processes on random lines.
+ * @param lineCount Number of random lines.
+ */
+void runShardBenchmark(int lineCount) {
+    /**
+     * @class CoefficientSink
+     * @brief Keeps the implicit coefficients of the generated lines.
+     */
+    class CoefficientSink : public SceneSink {
+    public:
+        std::vector<dvec3> coefficients; /**< Coefficients (a, b, c) of the lines. */
+
+        void point(const dvec3 &) override {}
+
+        void line(const dvec3 &p1, const dvec3 &p2) override {
+            Line l(p1, p2);
+            coefficients.push_back(dvec3(l.getA(), l.getB(), l.getC()));
+        }
+    } sink;
+    SceneGenerator(12345).generate(SceneGenerator::UNIFORM, 0, lineCount, sink);
+    ShardedIntersection sharded(sink.coefficients);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    size_t reference = sharded.runLocal().size();
+    double singleMs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    printf("Shard benchmark: %d lines, %d shards\n", lineCount, (int) sharded.size());
+    printf("\t%-10s %10.1f ms %10s %10d points\n", "in process", singleMs, "1.00x", (int) reference);
+    int maxWorkers = (int) std::thread::hardware_concurrency();
+    for (int workers = 1; workers <= (maxWorkers > 1 ? maxWorkers : 1); workers *= 2) {
+        start = std::chrono::steady_clock::now();
+        size_t count = sharded.run(workers).size();
+        double ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+        printf("\t%2d workers %10.1f ms %9.2fx %10d points%s\n", workers, ms, singleMs / ms, (int) count,
+               count == reference ? "" : " MISMATCH");
+    }
+}
+
+/**
+ * @class PointJoin
+ * @brief Finds all pairs of points closer than a radius with a grid of radius-sized cells.
+ *
+ * The points are sorted by cell, so a cell is a run of the sorted array and only occupied cells
+ * exist, whatever the extent and clustering of the data. Every cell is compared with itself and
+ * with the four neighbours after it (right, and the three above), so each pair is found once.
+ * Positions, cells and squared distances are computed in double, as in the snapper, so points
+ * far from the origin are joined as precisely as points near it.
+ * Threads take cells in chunks from a shared counter and write to their own buffers, which are
+ * concatenated at the end; counting skips the buffers entirely. With the local memory policy
+ * the sorted arrays are filled by pinned threads and each thread sweeps the cells of its own
+ * share of them instead, so the scan reads memory of its own NUMA node.
+ */
+class PointJoin {
+public:
+    /**
+     * @struct Pair
+     * @brief Indices of two points closer than the radius, first < second.
+     */
+    struct Pair {
+        int first; /**< Index of the first point. */
+        int second; /**< Index of the second point. */
+    };
+
+    static const int cellsPerTask = 64; /**< Cells a thread takes at a time. */
+
+private:
+    /**
+     * @struct Cell
+     * @brief An occupied cell and its run in the sorted points.
+     */
+    struct Cell {
+        int x; /**< Column of the cell. */
+        int y; /**< Row of the cell. */
+        int begin; /**< First sorted point of the cell. */
+        int end; /**< One past the last sorted point of the cell. */
+    };
+
+    double radius; /**< Join radius. */
+    LargeArray<dvec3> pos; /**< Positions in cell order. */
+    LargeArray<int> ids; /**< Original index of each sorted point. */
+    std::vector<Cell> cells; /**< Occupied cells in (y, x) order. */
+    std::unordered_map<unsigned long long, int> cellIndex; /**< Cell by packed coordinates. */
+
+    static unsigned long long pack(int x, int y) {
+        return ((unsigned long long) (unsigned int) y << 32) | (unsigned int) x;
+    }
+
+    /**
+     * @brief Compares two runs of points, or a run with itself.
+     * @param pairs Receives the pairs if not NULL.
+     * @return The number of pairs found.
+     */
+    unsigned long long compare(const Cell &a, const Cell &b, bool same, std::vector<Pair> *pairs) const {
+        double r2 = radius * radius;
+        unsigned long long count = 0;
+        for (int i = a.begin; i < a.end; i++) {
+            for (int j = same ? i + 1 : b.begin; j < b.end; j++) {
+                double dx = pos[i].x - pos[j].x, dy = pos[i].y - pos[j].y;
+                if (dx * dx + dy * dy >= r2) continue;
+                count++;
+                if (pairs) {
+                    Pair p = {ids[i] < ids[j] ? ids[i] : ids[j], ids[i] < ids[j] ? ids[j] : ids[i]};
+                    pairs->push_back(p);
+                }
+            }
+        }
+        return count;
+    }
+
+    /**
+     * @brief Runs the sweep on threads.
+     * @param threadCount Number of threads.
+     * @param buffers Per-thread pair buffers, or NULL to only count.
+     * @return The number of pairs.
+     */
+    unsigned long long sweep(int threadCount, std::vector<std::vector<Pair> > *buffers) const {
+        static const int forward[4][2] = {{1, 0}, {-1, 1}, {0, 1}, {1, 1}};
+        std::atomic<size_t> next(0);
+        std::vector<unsigned long long> counts(threadCount, 0);
+        std::vector<std::thread> threads;
+        bool local = memoryPolicy.local();
+        for (int t = 0; t < threadCount; t++) {
+            threads.push_back(std::thread([this, t, threadCount, local, buffers, &next, &counts]() {
+                std::vector<Pair> *out = buffers ? &(*buffers)[t] : NULL;
+                size_t begin, end;
+                if (local) {
+                    memoryPolicy.bindThread(t, threadCount);
+                    begin = firstCellFrom(pos.size() * t / threadCount);
+                    end = firstCellFrom(pos.size() * (t + 1) / threadCount);
+                } else if ((begin = next.fetch_add(cellsPerTask)) < cells.size()) {
+                    end = begin + cellsPerTask < cells.size() ? begin + cellsPerTask : cells.size();
+                } else {
+                    return;
+                }
+                for (;;) {
+                    for (size_t c = begin; c < end; c++) {
+                        const Cell &cell = cells[c];
+                        counts[t] += compare(cell, cell, true, out);
+                        for (int n = 0; n < 4; n++) {
+                            std::unordered_map<unsigned long long, int>::const_iterator it =
+                                    cellIndex.find(pack(cell.x + forward[n][0], cell.y + forward[n][1]));
+                            if (it != cellIndex.end()) counts[t] += compare(cell, cells[it->second], false, out);
+                        }
+                    }
+                    if (local || (begin = next.fetch_add(cellsPerTask)) >= cells.size()) break;
+                    end = begin + cellsPerTask < cells.size() ? begin + cellsPerTask : cells.size();
+                }
+            }));
+        }
+        unsigned long long total = 0;
+        for (int t = 0; t < threadCount; t++) {
+            threads[t].join();
+            total += counts[t];
+        }
+        return total;
+    }
+
+    /**
+     * @brief Returns the first cell whose run starts at or after a sorted point.
+     */
+    size_t firstCellFrom(size_t point) const {
+        return std::lower_bound(cells.begin(), cells.end(), (int) point,
+                                [](const Cell &cell, int p) { return cell.begin < p; }) - cells.begin();
+    }
+
+public:
+    /**
+     * @brief Constructor for the PointJoin class, sorts the points into cells.
+     *
+     * The sorted arrays are written by threadCount threads, each its contiguous share,
+     * which decides their placement under the local memory policy.
+     * @param pts The points.
+     * @param radius Join radius.
+     * @param threadCount Number of threads filling the sorted arrays.
+     */
+    PointJoin(const ChunkedArray<dvec3> &pts, double radius, int threadCount = 1) : radius(radius) {
+        size_t n = pts.size();
+        std::vector<std::pair<unsigned long long, int> > keyed(n);
+        for (size_t i = 0; i < n; i++) {
+            const dvec3 &p = pts[i];
+            int x = (int) floor(p.x / radius), y = (int) floor(p.y / radius);
+            keyed[i] = std::make_pair(((unsigned long long) (unsigned int) (y ^ 0x80000000) << 32) |
+                                      (unsigned int) (x ^ 0x80000000), (int) i);    // sorts by row, then column
+        }
+        std::sort(keyed.begin(), keyed.end());
+        pos.reset(n);
+        ids.reset(n);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < threadCount; t++) {
+            threads.push_back(std::thread([this, t, threadCount, n, &pts, &keyed]() {
+                memoryPolicy.bindThread(t, threadCount);
+                for (size_t i = n * t / threadCount; i < n * (t + 1) / threadCount; i++) {
+                    pos[i] = pts[keyed[i].second];
+                    ids[i] = keyed[i].second;
+                }
+            }));
+        }
+        for (size_t t = 0; t < threads.size(); t++) threads[t].join();
+        for (size_t i = 0; i < n; i++) {
+            if (i == 0 || keyed[i].first != keyed[i - 1].first) {
+                Cell cell = {(int) ((unsigned int) keyed[i].first ^ 0x80000000),
+                             (int) ((unsigned int) (keyed[i].first >> 32) ^ 0x80000000), (int) i, (int) i};
+                cellIndex[pack(cell.x, cell.y)] = (int) cells.size();
+                cells.push_back(cell);
+            }
+            cells.back().end = (int) i + 1;
+        }
+    }
+
+    /**
+     * @brief Counts the pairs without storing them.
+     * @param threadCount Number of threads.
+     */
+    unsigned long long count(int threadCount) const {
+        return sweep(threadCount, NULL);
+    }
+
+    /**
+     * @brief Returns all pairs.
+     * @param threadCount Number of threads.
+     */
+    std::vector<Pair> pairs(int threadCount) const {
+        std::vector<std::vector<Pair> > buffers(threadCount);
+        sweep(threadCount, &buffers);
+        size_t total = 0;
+        for (int t = 0; t < threadCount; t++) total += buffers[t].size();
+        std::vector<Pair> result;
+        result.reserve(total);
+        for (int t = 0; t < threadCount; t++) result.insert(result.end(), buffers[t].begin(), buffers[t].end());
+        return result;
+    }
+
+    /**
+     * @brief Returns the number of occupied cells.
+     */
+    size_t cellCount() const {
+        return cells.size();
+    }
+};
+
+double joinRadius = 1e-3; /**< Distance under which points are reported as near-duplicates. */
+
+/**
+ * @brief Reports the pairs of points closer than joinRadius.
+ */
+void reportNearDuplicates() {
+    int threadCount = (int) std::thread::hardware_concurrency();
+    if (threadCount < 1) threadCount = 1;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    PointJoin join(points->getPoints().Vtx(), joinRadius, threadCount);
+    unsigned long long count = join.count(threadCount);
+    double ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0;
+    printf("Near-duplicates: %llu pairs of points closer than %g (%d points, %d cells, %d threads, %.1f ms)\n",
+           count, joinRadius, points->size(), (int) join.cellCount(), threadCount, ms);
+    if (count == 0) return;
+    std::vector<PointJoin::Pair> pairs = join.pairs(threadCount);
+    for (size_t k = 0; k < pairs.size() && k < 20; k++) {
+        dvec3 a = points->getPoints().Vtx()[pairs[k].first], b = points->getPoints().Vtx()[pairs[k].second];
+        printf("\t%d (%3.4f, %3.4f) - %d (%3.4f, %3.4f)\n", pairs[k].first, a.x, a.y, pairs[k].second, b.x, b.y);
+    }
+    if (pairs.size() > 20) printf("\t...\n");
+}
+
+/**
+ * @class LatencyHistogram
+ * @brief HDR-style histogram of latencies in microseconds.
+ *
+ * Buckets are log-linear: the power of two of the value selects a bucket group and the
+ * next subBits bits select the bucket inside it, so the relative error stays below
+ * 1 / 2^subBits at every magnitude while the storage is fixed and never allocates.
+ */
+class LatencyHistogram {
+    static const int subBits = 5; /**< Mantissa bits kept per power of two. */
+    static const int groups = 40; /**< Number of powers of two covered. */
+    unsigned long buckets[groups << subBits] = {}; /**< Counts per bucket. */
+    unsigned long count = 0; /**< Number of recorded values. */
+    unsigned long long maxValue = 0; /**< Largest recorded value. */
+
+    /**
+     * @brief Returns the bucket of a value.
+     */
+    static int bucket(unsigned long long v) {
+        if (v < (1ull << subBits)) return (int) v;
+        int msb = 63;
+        while (!(v >> msb)) msb--;
+        int shift = msb - subBits;
+        return ((shift + 1) << subBits) + (int) ((v >> shift) & ((1ull << subBits) - 1));
+    }
+
+    /**
+     * @brief Returns the largest value that falls into a bucket.
+     */
+    static unsigned long long upperBound(int b) {
+        int group = b >> subBits;
+        unsigned long long sub = b & ((1 << subBits) - 1);
+        if (group == 0) return sub;
+        int shift = group - 1;
+        return (((1ull << subBits) + sub + 1) << shift) - 1;
+    }
+
+public:
+    /**
+     * @brief Records a value.
+     * @param us The latency in microseconds.
+     */
+    void record(unsigned long long us) {
+        int b = bucket(us);
+        if (b >= (groups << subBits)) b = (groups << subBits) - 1;
+        buckets[b]++;
+        count++;
+        if (us > maxValue) maxValue = us;
+    }
+
+    /**
+     * @brief Returns the number of recorded values.
+     */
+    unsigned long size() const {
+        return count;
+    }
+
+    /**
+     * @brief Returns the value below which the given fraction of the records lie.
+     * @param q The quantile in [0, 1].
+     */
+    unsigned long long percentile(double q) const {
+        if (count == 0) return 0;
+        unsigned long rank = (unsigned long) ceil(q * count);
+        if (rank == 0) rank = 1;
+        unsigned long seen = 0;
+        for (int b = 0; b < (groups << subBits); b++) {
+            seen += buckets[b];
+            if (seen >= rank) return upperBound(b) < maxValue ? upperBound(b) : maxValue;
+        }
+        return maxValue;
+    }
+
+    /**
+     * @brief Prints p50/p99/p999 and max to the console.
+     * @param name Name of the histogram.
+     */
+    void print(const char *name) const {
+        printf("%-6s latency: %6lu samples, p50 %6.2f ms, p99 %6.2f ms, p999 %6.2f ms, max %6.2f ms\n",
+               name, count, percentile(0.5) / 1000.0, percentile(0.99) / 1000.0,
+               percentile(0.999) / 1000.0, maxValue / 1000.0);
+    }
+};
+
+/**
+ * @class LatencyTracker
+ * @brief Measures the time from an input event until the frame showing its effect is done on the GPU.
+ *
+ * Handlers stamp the event when they change the scene. The stamp of the earliest change not yet
+ * on screen is carried to the next glutSwapBuffers, where a fence is inserted; the latency is
+ * closed when the fence signals.
+ */
+class LatencyTracker {
+public:
+    /**
+     * @brief Kind of the input event.
+     */
+    enum Kind {
+        CLICK, DRAG, KIND_COUNT
+    };
+
+private:
+    /**
+     * @struct Pending
+     * @brief A presented frame waiting for its fence.
+     */
+    struct Pending {
+        GLsync fence; /**< Fence inserted after the swap. */
+        std::chrono::steady_clock::time_point stamp; /**< Time of the input event. */
+        Kind kind; /**< Kind of the input event. */
+    };
+
+    static const int maxPending = 8; /**< Number of frames that can wait for their fence. */
+    Pending pending[maxPending]; /**< Ring of frames waiting for their fence. */
+    int head = 0; /**< Oldest waiting frame. */
+    int waiting = 0; /**< Number of waiting frames. */
+    bool changed = false; /**< Whether an input changed the scene since the last present. */
+    std::chrono::steady_clock::time_point stamp; /**< Time of the earliest unpresented input. */
+    Kind kind = CLICK; /**< Kind of the earliest unpresented input. */
+    LatencyHistogram histograms[KIND_COUNT]; /**< Latencies per kind of input. */
+
+public:
+    /**
+     * @brief Returns the current time, to stamp an event at the entry of its handler.
+     */
+    static std::chrono::steady_clock::time_point now() {
+        return std::chrono::steady_clock::now();
+    }
+
+    /**
+     * @brief Notes that an input event changed the scene.
+     * @param k Kind of the event.
+     * @param eventStamp Time the handler was entered.
+     */
+    void input(Kind k, std::chrono::steady_clock::time_point eventStamp) {
+        if (changed) return;
+        changed = true;
+        stamp = eventStamp;
+        kind = k;
+    }
+
+    /**
+     * @brief Inserts a fence for the input shown by the frame just swapped.
+     */
+    void present() {
+        if (!changed) return;
+        changed = false;
+        if (waiting == maxPending) poll(true);
+        Pending &p = pending[(head + waiting) % maxPending];
+        p.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        p.stamp = stamp;
+        p.kind = kind;
+        waiting++;
+    }
+
+    /**
+     * @brief Closes the latencies of the frames whose fence has signaled.
+     * @param wait Whether to block until the oldest frame is done.
+     */
+    void poll(bool wait = false) {
+        while (waiting > 0) {
+            Pending &p = pending[head];
+            GLenum result = glClientWaitSync(p.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? 1000000000ull : 0);
+            if (result == GL_TIMEOUT_EXPIRED) return;
+            histograms[p.kind].record(
+                    std::chrono::duration_cast<std::chrono::microseconds>(now() - p.stamp).count());
+            glDeleteSync(p.fence);
+            head = (head + 1) % maxPending;
+            waiting--;
+            wait = false;
+        }
+    }
+
+    /**
+     * @brief Waits for every waiting frame and prints the histograms.
+     */
+    void print() {
+        while (waiting > 0) poll(true);
+        histograms[CLICK].print("Click");
+        histograms[DRAG].print("Drag");
+    }
+};
+
+LatencyTracker latency; /**< Input-to-photon latency of the handlers. */
+
+/**
+ * @brief Vertex shader of the HUD text, expands one instance per character into a quad.
+ */
+const char *const hudVertexSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform vec2 screenSize;   // size of the window in pixels
+    uniform vec2 glyphSize;    // size of a character on screen in pixels
+    uniform float glyphCount;  // number of glyphs in the atlas
+    layout(location = 0) in vec3 glyph;   // per instance: top-left pixel of the character and its atlas index
+
+    out vec2 texCoord;
+
+    void main() {
+        vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+        vec2 pixel = glyph.xy + corner * glyphSize;
+        gl_Position = vec4(pixel.x / screenSize.x * 2 - 1, 1 - pixel.y / screenSize.y * 2, 0, 1);
+        texCoord = vec2((glyph.z + corner.x) / glyphCount, corner.y);
+    }
+)";
+
+/**
+ * @brief Fragment shader of the HUD text, keeps the set texels of the glyph atlas.
+ */
+const char *const hudFragmentSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform sampler2D atlas;
+    uniform vec3 color;
+    in vec2 texCoord;
+    out vec4 outColor;
+
+    void main() {
+        if (texture(atlas, texCoord).a < 0.5) discard;
+        outColor = vec4(color, 1);
+    }
+)";
+
+/**
+ * @class Hud
+ * @brief Performance overlay drawn after the scene.
+ *
+ * Text uses a 3x5 bitmap font uploaded as a glyph atlas Texture and is drawn with one
+ * instanced draw call; the frame-time graph is a single line strip.
+ */
+class Hud {
+    static const int glyphW = 3; /**< Width of a glyph in texels. */
+    static const int glyphH = 5; /**< Height of a glyph in texels. */
+    static const int scale = 3; /**< Screen pixels per glyph texel. */
+    static const int maxChars = 256; /**< Capacity of the character instance buffer. */
+    static const int graphSamples = 120; /**< Number of frames in the frame-time graph. */
+    static const int gpuQueries = 4; /**< Number of GPU timer queries in flight. */
+
+    GPUProgram program; /**< Program drawing the text. */
+    Texture atlas; /**< Glyph atlas. */
+    unsigned int textVao; /**< VAO of the character instances. */
+    unsigned int textVbo; /**< Per-instance position and glyph index. */
+    vec3 chars[maxChars]; /**< CPU copy of the character instances. */
+    int charCount = 0; /**< Number of characters in this frame. */
+    Object *graph; /**< Line strip of the frame-time graph. */
+    float frameMs[graphSamples] = {}; /**< Ring of the last frame times. */
+    int frameHead = 0; /**< Next slot of the frame time ring. */
+    unsigned int queries[gpuQueries]; /**< Ring of GPU timer queries. */
+    int queryHead = 0; /**< Query used by the current frame. */
+    int queriesIssued = 0; /**< Number of queries that have been started. */
+    float gpuMs = 0; /**< Last known GPU time of the scene. */
+    std::chrono::steady_clock::time_point lastFrame; /**< Time of the previous frame. */
+    bool visible = false; /**< Whether the overlay is drawn. */
+    bool available = true; /**< Whether the text program was built, so the overlay can be shown. */
+
+    /**
+     * @brief Characters of the font, in atlas order.
+     */
+    static const char *charset() {
+        return " 0123456789.:/-%ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    }
+
+    /**
+     * @brief Rows of each glyph top to bottom, '1' marks a set texel.
+     */
+    static const char *glyphBits(int g) {
+        static const char *const bits[] = {
+                "000000000000000", "111101101101111", "010110010010111", "111001111100111", "111001111001111",
+                "101101111001001", "111100111001111", "111100111101111", "111001001001001", "111101111101111",
+                "111101111001111", "000000000000010", "000010000010000", "001001010100100", "000000111000000",
+                "101001010100101", "010101111101101", "110101110101110", "011100100100011", "110101101101110",
+                "111100110100111", "111100110100100", "011100101101011", "101101111101101", "111010010010111",
+                "001001001101010", "101101110101101", "100100100100111", "101111111101101", "110101101101101",
+                "010101101101010", "110101110100100", "010101101110011", "110101110101101", "011100010001110",
+                "111010010010010", "101101101101111", "101101101101010", "101101111111101", "101101010101101",
+                "101101010010010", "111001010100111"};
+        return bits[g];
+    }
+
+    /**
+     * @brief Appends a string at a pixel position; lowercase letters use the uppercase glyphs.
+     */
+    void text(int x, int y, const char *str) {
+        const char *set = charset();
+        for (; *str && charCount < maxChars; str++, x += (glyphW + 1) * scale) {
+            char ch = (*str >= 'a' && *str <= 'z') ? (char) (*str - 'a' + 'A') : *str;
+            const char *found = strchr(set, ch);
+            if (!found || ch == ' ') continue;
+            chars[charCount++] = vec3((float) x, (float) y, (float) (found - set));
+        }
+    }
+
+public:
+    /**
+     * @brief Constructor for the Hud class, builds the atlas and the GPU objects.
+     */
+    Hud() : program(false) {
+        int count = (int) strlen(charset());
+        std::vector<vec4> image(count * glyphW * glyphH);
+        for (int g = 0; g < count; g++) {
+            const char *bits = glyphBits(g);
+            for (int r = 0; r < glyphH; r++) {
+                for (int c = 0; c < glyphW; c++) {
+                    float on = bits[r * glyphW + c] == '1' ? 1.0f : 0.0f;
+                    image[r * count * glyphW + g * glyphW + c] = vec4(on, on, on, on);
+                }
+            }
+        }
+        atlas.create(count * glyphW, glyphH, image, GL_NEAREST);
+        gpuMemory.pin(GpuMemory::TEXTURES, (long long) image.size() * sizeof(vec4));
+        program.begin(hudVertexSource, hudFragmentSource, "outColor");
+        glDebug.label(GL_PROGRAM, program.getId(), "hud program");
+        glDebug.label(GL_TEXTURE, atlas.textureId, "hud glyph atlas");
+
+        glGenVertexArrays(1, &textVao);
+        glBindVertexArray(textVao);
+        glGenBuffers(1, &textVbo);
+        glBindBuffer(GL_ARRAY_BUFFER, textVbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(chars), NULL, GL_STREAM_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+        glVertexAttribDivisor(0, 1);
+        glDebug.label(GL_VERTEX_ARRAY, textVao, "hud text");
+        glDebug.label(GL_BUFFER, textVbo, "hud text");
+
+        graph = new Object();
+        graph->setLabel("hud frame graph");
+        for (int s = 0; s < graphSamples; s++) graph->Vtx().push_back(vec3(0, 0, 1));
+        glGenQueries(gpuQueries, queries);
+        lastFrame = std::chrono::steady_clock::now();
+    }
+
+    /**
+     * @brief Waits for the text program started by the constructor.
+     * @return True if the program was created successfully.
+     */
+    bool finishProgram() {
+        available = program.finish();
+        gpuProgram.Use();
+        return available;
+    }
+
+    /**
+     * @brief Shows or hides the overlay.
+     */
+    void toggle() {
+        if (!available) {
+            printf("Overlay unavailable, its program failed to build\n");
+            return;
+        }
+        visible = !visible;
+    }
+
+    /**
+     * @brief Returns whether the overlay is drawn.
+     */
+    bool isVisible() const {
+        return visible;
+    }
+
+    /**
+     * @brief Returns the last known GPU time of the scene in milliseconds.
+     */
+    float gpuTime() const {
+        return gpuMs;
+    }
+
+    /**
+     * @brief Starts timing the scene on the GPU and collects the oldest finished timing.
+     */
+    void beginScene() {
+        if (queriesIssued >= gpuQueries) {
+            int available = 0;
+            glGetQueryObjectiv(queries[queryHead], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(queries[queryHead], GL_QUERY_RESULT, &ns);
+                gpuMs = ns / 1.0e6f;
+            }
+        }
+        glBeginQuery(GL_TIME_ELAPSED, queries[queryHead]);
+    }
+
+    /**
+     * @brief Stops timing the scene on the GPU.
+     */
+    void endScene() {
+        glEndQuery(GL_TIME_ELAPSED);
+        queryHead = (queryHead + 1) % gpuQueries;
+        if (queriesIssued < gpuQueries) queriesIssued++;
+    }
+
+    /**
+     * @brief Records the frame time and draws the overlay if visible.
+     * @param pointCount Number of points in the scene.
+     * @param lineCount Number of lines in the scene.
+     */
+    void draw(int pointCount, int lineCount) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        float ms = std::chrono::duration_cast<std::chrono::microseconds>(now - lastFrame).count() / 1000.0f;
+        lastFrame = now;
+        frameMs[frameHead] = ms;
+        frameHead = (frameHead + 1) % graphSamples;
+        if (!visible) return;
+        DebugGroup group("HUD");
+
+        float sum = 0;
+        for (int s = 0; s < graphSamples; s++) sum += frameMs[s];
+        float avgMs = sum / graphSamples;
+
+        int lineH = (glyphH + 2) * scale;
+        char buffer[64];
+        charCount = 0;
+        snprintf(buffer, sizeof(buffer), "FPS %.1f  FRAME %.2f MS", avgMs > 0 ? 1000.0f / avgMs : 0.0f, avgMs);
+        text(8, 8, buffer);
+        snprintf(buffer, sizeof(buffer), "GPU %.3f MS  DRAWS %lu", gpuMs, frameStats.lastDrawCalls);
+        text(8, 8 + lineH, buffer);
+        snprintf(buffer, sizeof(buffer), "UPLOAD %lu B  PERF WARN %lu", frameStats.lastUploadBytes,
+                 frameStats.lastPerfWarnings);
+        text(8, 8 + 2 * lineH, buffer);
+        snprintf(buffer, sizeof(buffer), "POINTS %d  LINES %d", pointCount, lineCount);
+        text(8, 8 + 3 * lineH, buffer);
+        snprintf(buffer, sizeof(buffer), "GPU MEM %.1f MB  EVICT %lu  REUPLOAD %lu", gpuMemory.total() / 1048576.0,
+                 gpuMemory.getEvictions(), gpuMemory.getReuploads());
+        text(8, 8 + 4 * lineH, buffer);
+        int rows = 5;
+        if (jobs.busy()) {
+            snprintf(buffer, sizeof(buffer), "JOB %s %.0f%%", jobs.current()->name(), jobs.current()->progress() * 100);
+            text(8, 8 + rows++ * lineH, buffer);
+        }
+
+        float graphTop = 8 + rows * lineH + 4, graphH = 60;
+        ChunkedArray<dvec3> &g = graph->Vtx();
+        for (int s = 0; s < graphSamples; s++) {
+            float v = frameMs[(frameHead + s) % graphSamples] / 33.3f;
+            float px = 8 + s * 2.0f, py = graphTop + graphH * (1 - (v < 1 ? v : 1));
+            g.set(s, vec3(px / screenWidth * 2 - 1, 1 - py / screenHeight * 2, 1));
+        }
+        graph->updateGpu();
+        graph->Draw(GL_LINE_STRIP, vec3(1, 1, 0));
+
+        program.Use();
+        program.setUniform(vec2((float) screenWidth, (float) screenHeight), "screenSize");
+        program.setUniform(vec2((float) glyphW * scale, (float) glyphH * scale), "glyphSize");
+        program.setUniform((float) strlen(charset()), "glyphCount");
+        program.setUniform(vec3(1, 1, 1), "color");
+        program.setUniform(atlas, "atlas");
+        glBindVertexArray(textVao);
+        glBindBuffer(GL_ARRAY_BUFFER, textVbo);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, charCount * sizeof(vec3), chars);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, charCount);
+        frameStats.drawCalls++;
+        gpuProgram.Use();
+    }
+};
+
+Hud *hud; /**< Performance overlay. */
+
+/**
+ * @class DynamicResolution
+ * @brief Renders the scene into a scaled offscreen target and upsamples it to the window.
+ *
+ * The scale follows the GPU time of the scene so that it stays under the target frame time.
+ * It is quantized to 1/16 steps, so the target is only reallocated when the scale really changes.
+ */
+class DynamicResolution {
+    unsigned int fbo = 0; /**< Offscreen framebuffer. */
+    unsigned int color = 0; /**< Color renderbuffer of the offscreen framebuffer. */
+    int targetW = 0; /**< Width of the offscreen target. */
+    int targetH = 0; /**< Height of the offscreen target. */
+    float scale = 1.0f; /**< Resolution scale relative to the window. */
+    float targetMs = 16.0f; /**< Frame time the scale is adapted to. */
+    bool enabled = false; /**< Whether the scene is rendered offscreen. */
+
+public:
+    /**
+     * @brief Enables or disables the dynamic resolution mode.
+     */
+    void toggle() {
+        enabled = !enabled;
+        scale = 1.0f;
+        printf("Dynamic resolution %s\n", enabled ? "on" : "off");
+    }
+
+    /**
+     * @brief Sets the frame time the scale is adapted to.
+     * @param ms The target in milliseconds.
+     */
+    void setTarget(float ms) {
+        targetMs = ms;
+    }
+
+    /**
+     * @brief Returns the current resolution scale.
+     */
+    float getScale() const {
+        return enabled ? scale : 1.0f;
+    }
+
+    /**
+     * @brief Returns the width of the render target of the scene.
+     * @param w Width of the window framebuffer.
+     */
+    int width(int w) const {
+        return enabled ? targetW : w;
+    }
+
+    /**
+     * @brief Returns the height of the render target of the scene.
+     * @param h Height of the window framebuffer.
+     */
+    int height(int h) const {
+        return enabled ? targetH : h;
+    }
+
+    /**
+     * @brief Adapts the scale to the last measured GPU time of the scene.
+     * @param gpuMs GPU time of the scene in milliseconds.
+     */
+    void adapt(float gpuMs) {
+        if (!enabled || gpuMs <= 0) return;
+        if (gpuMs > targetMs * 0.9f) scale *= 0.9f;
+        else if (gpuMs < targetMs * 0.6f) scale *= 1.05f;
+        if (scale < 0.25f) scale = 0.25f;
+        if (scale > 1.0f) scale = 1.0f;
+    }
+
+    /**
+     * @brief Binds the render target of the scene and sets the viewport.
+     * @param w Width of the window framebuffer.
+     * @param h Height of the window framebuffer.
+     */
+    void begin(int w, int h) {
+        if (!enabled) {
+            glViewport(0, 0, w, h);
+            return;
+        }
+        float q = ceilf(scale * 16) / 16;
+        int sw = (int) (w * q) > 0 ? (int) (w * q) : 1, sh = (int) (h * q) > 0 ? (int) (h * q) : 1;
+        if (fbo == 0) {
+            glGenFramebuffers(1, &fbo);
+            glGenRenderbuffers(1, &color);
+            glDebug.label(GL_FRAMEBUFFER, fbo, "dynamic resolution target");
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        if (sw != targetW || sh != targetH) {
+            gpuMemory.pin(GpuMemory::TARGETS, 4ll * (sw * sh - targetW * targetH));
+            targetW = sw;
+            targetH = sh;
+            glBindRenderbuffer(GL_RENDERBUFFER, color);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, targetW, targetH);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color);
+            GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+            if (status != GL_FRAMEBUFFER_COMPLETE) {
+                printf("Dynamic resolution target incomplete (0x%x), rendering directly\n", status);
+                release();
+                enabled = false;
+                glViewport(0, 0, w, h);
+                return;
+            }
+        }
+        glViewport(0, 0, targetW, targetH);
+        glPointSize(10.0f * q);
+        glLineWidth(3.0f * q > 1.0f ? 3.0f * q : 1.0f);
+    }
+
+    /**
+     * @brief Deletes the offscreen target and binds the default framebuffer.
+     */
+    void release() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glDeleteRenderbuffers(1, &color);
+        glDeleteFramebuffers(1, &fbo);
+        gpuMemory.pin(GpuMemory::TARGETS, -4ll * targetW * targetH);
+        fbo = color = 0;
+        targetW = targetH = 0;
+    }
+
+    /**
+     * @brief Upsamples the offscreen target to the window and restores the default framebuffer.
+     * @param w Width of the window framebuffer.
+     * @param h Height of the window framebuffer.
+     */
+    void end(int w, int h) {
+        if (!enabled) return;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, targetW, targetH, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, w, h);
+        glPointSize(10.0f);
+        glLineWidth(3.0f);
+    }
+};
+
+DynamicResolution dynamicResolution; /**< Offscreen scaling of the scene. */
+
+/**
+ * @struct Viewport
+ * @brief A rectangle of the window showing the scene through its own camera.
+ */
+struct Viewport {
+    float x; /**< Left edge as a fraction of the window width. */
+    float y; /**< Bottom edge as a fraction of the window height. */
+    float w; /**< Width as a fraction of the window width. */
+    float h; /**< Height as a fraction of the window height. */
+    dvec3 center; /**< World point shown in the middle of the viewport. */
+    float zoom; /**< Magnification, 1 shows the [-1, 1] square. */
+
+    /**
+     * @brief Returns the Model-View-Projection transformation of the camera.
+     */
+    mat4 MVP() const {
+        return TranslateMatrix(vec3((float) -center.x, (float) -center.y, 0)) * ScaleMatrix(vec3(zoom, zoom, 1));
+    }
+
+    /**
+     * @brief Returns the visible world rectangle (min x, min y, max x, max y).
+     * @param margin Extra border in world units at zoom 1.
+     */
+    vec4 visible(float margin) const {
+        float r = (1 + margin) / zoom;
+        return vec4((float) (center.x - r), (float) (center.y - r), (float) (center.x + r), (float) (center.y + r));
+    }
+
+    /**
+     * @brief Returns whether a pixel lies inside the viewport.
+     */
+    bool contains(int pX, int pY, int width, int height) const {
+        float fx = (float) pX / width, fy = 1.0f - (float) pY / height;
+        return fx >= x && fx <= x + w && fy >= y && fy <= y + h;
+    }
+
+    /**
+     * @brief Converts a pixel of the window to world coordinates through the camera.
+     */
+    dvec3 toWorld(int pX, int pY, int width, int height) const {
+        double ndcX = 2.0 * ((double) pX / width - x) / w - 1;
+        double ndcY = 2.0 * ((1.0 - (double) pY / height) - y) / h - 1;
+        return dvec3(ndcX / zoom + center.x, ndcY / zoom + center.y, 1);
+    }
+
+    /**
+     * @brief Returns the world size of a pixel.
+     * @param width Width of the window in pixels.
+     */
+    float pixelSize(int width) const {
+        return 2.0f / (w * width * zoom);
+    }
+};
+
+/**
+ * @class ViewportSet
+ * @brief The viewports of the window; all of them draw the same point and line buffers.
+ *
+ * In split mode the left half shows an overview and the right half a zoomed detail view.
+ * Mouse input goes to the viewport under the cursor at the button press and stays there
+ * until the next press, so drags are not cut at the border of a viewport.
+ */
+class ViewportSet {
+    std::vector<Viewport> views; /**< The viewports. */
+    size_t active = 0; /**< Viewport receiving the mouse input. */
+    bool split = false; /**< Whether the overview and detail views are shown. */
+
+public:
+    /**
+     * @brief Constructor for the ViewportSet class, starts with one full-window viewport.
+     */
+    ViewportSet() {
+        Viewport full = {0, 0, 1, 1, dvec3(0, 0, 0), 1};
+        views.push_back(full);
+    }
+
+    /**
+     * @brief Switches between the single view and the overview and detail views.
+     */
+    void toggle() {
+        split = !split;
+        dvec3 detailCenter = views.size() > 1 ? views[1].center : dvec3(0, 0, 0);
+        views.clear();
+        if (split) {
+            Viewport overview = {0, 0, 0.5f, 1, dvec3(0, 0, 0), 1};
+            Viewport detail = {0.5f, 0, 0.5f, 1, detailCenter, 4};
+            views.push_back(overview);
+            views.push_back(detail);
+        } else {
+            Viewport full = {0, 0, 1, 1, dvec3(0, 0, 0), 1};
+            views.push_back(full);
+        }
+        active = 0;
+        printf(split ? "Overview and detail views\n" : "Single view\n");
+    }
+
+    /**
+     * @brief Returns the number of viewports.
+     */
+    size_t size() const {
+        return views.size();
+    }
+
+    /**
+     * @brief Returns viewport v.
+     */
+    const Viewport &operator[](size_t v) const {
+        return views[v];
+    }
+
+    /**
+     * @brief Routes a button press to the viewport under the cursor and returns the world position.
+     */
+    dvec3 press(int pX, int pY, int width, int height) {
+        for (size_t v = 0; v < views.size(); v++) {
+            if (views[v].contains(pX, pY, width, height)) active = v;
+        }
+        return views[active].toWorld(pX, pY, width, height);
+    }
+
+    /**
+     * @brief Returns the viewport under the cursor, or the one that received the last press if there is none.
+     */
+    const Viewport &at(int pX, int pY, int width, int height) const {
+        for (size_t v = 0; v < views.size(); v++) {
+            if (views[v].contains(pX, pY, width, height)) return views[v];
+        }
+        return views[active];
+    }
+
+    /**
+     * @brief Returns the viewport that received the last press.
+     */
+    const Viewport &current() const {
+        return views[active];
+    }
+
+    /**
+     * @brief Converts a pixel to world coordinates through the viewport that received the last press.
+     */
+    dvec3 toWorld(int pX, int pY, int width, int height) const {
+        return views[active].toWorld(pX, pY, width, height);
+    }
+
+    /**
+     * @brief Centers the detail view on a world position.
+     */
+    void focus(const dvec3 &world) {
+        if (views.size() > 1) views[1].center = dvec3(world.x, world.y, 0);
+    }
+
+    /**
+     * @brief Multiplies the zoom of the viewport that received the last press.
+     */
+    void zoom(float factor) {
+        views[active].zoom *= factor;
+    }
+};
+
+ViewportSet viewports; /**< Viewports of the window. */
+
+/**
+ * @brief Moves the position of a file to a 64-bit offset.
+ */
+inline int seekFile(FILE *file, long long offset) {
+#if defined(_WIN32)
+    return _fseeki64(file, offset, SEEK_SET);
+#else
+    return fseeko(file, (off_t) offset, SEEK_SET);
+#endif
+}
+
+/**
+ * @class VirtualTextureFile
+ * @brief Tiled mip pyramid of an image on disk.
+ *
+ * The file holds a header (magic, width, height, tile size, levels) followed by the RGBA8 tiles
+ * of every level, finest first, row by row from the bottom; the offset of a tile is computed
+ * from its coordinates. Level L has ceil(size / 2^L) pixels, so one tile of level L covers
+ * tileSize * 2^L pixels of level 0.
+ */
+class VirtualTextureFile {
+    FILE *file = NULL; /**< The open pyramid. */
+    std::vector<long long> levelStart; /**< Index of the first tile of each level. */
+
+    /**
+     * @brief Computes the tile layout of the levels from the header fields.
+     */
+    void layout() {
+        levelStart.clear();
+        long long first = 0;
+        for (int L = 0; L < levels; L++) {
+            levelStart.push_back(first);
+            first += (long long) tilesX(L) * tilesY(L);
+        }
+        levelStart.push_back(first);
+    }
+
+public:
+    static const int headerSize = 20; /**< Bytes before the first tile. */
+    int width = 0; /**< Width of level 0 in pixels. */
+    int height = 0; /**< Height of level 0 in pixels. */
+    int tileSize = 0; /**< Width and height of a tile in pixels. */
+    int levels = 0; /**< Number of levels, the last one is a single tile. */
+
+    /**
+     * @brief Returns the number of tile columns of a level.
+     */
+    int tilesX(int L) const {
+        int w = (width + (1 << L) - 1) >> L;
+        return (w + tileSize - 1) / tileSize;
+    }
+
+    /**
+     * @brief Returns the number of tile rows of a level.
+     */
+    int tilesY(int L) const {
+        int h = (height + (1 << L) - 1) >> L;
+        return (h + tileSize - 1) / tileSize;
+    }
+
+    /**
+     * @brief Returns the index of a tile over all levels.
+     */
+    long long tileIndex(int L, int x, int y) const {
+        return levelStart[L] + (long long) y * tilesX(L) + x;
+    }
+
+    /**
+     * @brief Returns the number of tiles over all levels.
+     */
+    long long tileCount() const {
+        return levelStart.empty() ? 0 : levelStart.back();
+    }
+
+    /**
+     * @brief Opens a pyramid.
+     * @param path The file of the pyramid.
+     * @return True if the file is a valid pyramid.
+     */
+    bool open(const char *path) {
+        file = fopen(path, "rb");
+        if (!file) return false;
+        int header[5];
+        if (fread(header, sizeof(int), 5, file) != 5 || header[0] != 0x54565650) {    // "PVVT"
+            fclose(file);
+            file = NULL;
+            return false;
+        }
+        width = header[1];
+        height = header[2];
+        tileSize = header[3];
+        levels = header[4];
+        layout();
+        return true;
+    }
+
+    /**
+     * @brief Reads a tile.
+     * @param index Index of the tile over all levels.
+     * @param rgba Destination of tileSize * tileSize RGBA8 pixels.
+     * @return True if the tile could be read.
+     */
+    bool readTile(long long index, unsigned char *rgba) {
+        size_t bytes = (size_t) tileSize * tileSize * 4;
+        if (seekFile(file, headerSize + index * (long long) bytes) != 0) return false;
+        return fread(rgba, 1, bytes, file) == bytes;
+    }
+
+    /**
+     * @brief Builds a pyramid from a 24 bit BMP file without loading the whole image.
+     *
+     * Level 0 is cut from bands of tileSize rows, every further level is filtered from
+     * the four child tiles of the previous level, so memory use is a band plus five tiles.
+     * @param bmpPath The source image.
+     * @param path The pyramid to write.
+     * @param tile Width and height of a tile in pixels.
+     * @return True if the pyramid was written.
+     */
+    static bool build(const char *bmpPath, const char *path, int tile = 128) {
+        FILE *bmp = fopen(bmpPath, "rb");
+        if (!bmp) {
+            printf("%s does not exist\n", bmpPath);
+            return false;
+        }
+        unsigned char h[54];
+        if (fread(h, 1, 54, bmp) != 54 || h[0] != 'B' || h[1] != 'M' || h[28] != 24) {
+            printf("Only true color bmp files are supported\n");
+            fclose(bmp);
+            return false;
+        }
+        int dataOffset = h[10] | h[11] << 8 | h[12] << 16 | h[13] << 24;
+        int w = h[18] | h[19] << 8 | h[20] << 16 | h[21] << 24;
+        int hgt = h[22] | h[23] << 8 | h[24] << 16 | h[25] << 24;
+        int compression = h[30] | h[31] << 8 | h[32] << 16 | h[33] << 24;
+        if (compression != 0 || w <= 0 || hgt <= 0) {    // the bands are read bottom up, uncompressed
+            printf("Only uncompressed bottom-up bmp files are supported\n");
+            fclose(bmp);
+            return false;
+        }
+
+        VirtualTextureFile vt;
+        vt.width = w;
+        vt.height = hgt;
+        vt.tileSize = tile;
+        vt.levels = 1;
+        while (vt.tilesX(vt.levels - 1) > 1 || vt.tilesY(vt.levels - 1) > 1) vt.levels++;
+        vt.layout();
+        FILE *out = fopen(path, "w+b");
+        if (!out) {
+            fclose(bmp);
+            return false;
+        }
+        int header[5] = {0x54565650, w, hgt, tile, vt.levels};
+        fwrite(header, sizeof(int), 5, out);
+        size_t tileBytes = (size_t) tile * tile * 4;
+
+        // level 0 from bands of rows, BMP rows are stored bottom up like the tiles
+        size_t rowBytes = ((size_t) w * 3 + 3) & ~(size_t) 3;
+        std::vector<unsigned char> band(rowBytes * tile);
+        std::vector<unsigned char> rgba(tileBytes);
+        seekFile(bmp, dataOffset);
+        for (int ty = 0; ty < vt.tilesY(0); ty++) {
+            int rows = hgt - ty * tile < tile ? hgt - ty * tile : tile;
+            if (fread(&band[0], 1, rowBytes * rows, bmp) != rowBytes * rows) printf("Truncated bmp file\n");
+            for (int tx = 0; tx < vt.tilesX(0); tx++) {
+                std::fill(rgba.begin(), rgba.end(), 0);
+                for (int y = 0; y < rows; y++) {
+                    for (int x = 0; x < tile && tx * tile + x < w; x++) {
+                        const unsigned char *src = &band[y * rowBytes + (size_t) (tx * tile + x) * 3];
+                        unsigned char *dst = &rgba[((size_t) y * tile + x) * 4];
+                        dst[0] = src[2];    // BMP stores BGR
+                        dst[1] = src[1];
+                        dst[2] = src[0];
+                        dst[3] = 255;
+                    }
+                }
+                seekFile(out, headerSize + vt.tileIndex(0, tx, ty) * (long long) tileBytes);
+                fwrite(&rgba[0], 1, tileBytes, out);
+            }
+        }
+        fclose(bmp);
+
+        // coarser levels from the four children, ignoring the padding outside the image
+        vt.file = out;
+        std::vector<unsigned char> child(tileBytes);
+        for (int L = 1; L < vt.levels; L++) {
+            for (int ty = 0; ty < vt.tilesY(L); ty++) {
+                for (int tx = 0; tx < vt.tilesX(L); tx++) {
+                    std::vector<unsigned int> sum((size_t) tile * tile * 4, 0);
+                    for (int c = 0; c < 4; c++) {
+                        int cx = 2 * tx + (c & 1), cy = 2 * ty + (c >> 1);
+                        if (cx >= vt.tilesX(L - 1) || cy >= vt.tilesY(L - 1)) continue;
+                        vt.readTile(vt.tileIndex(L - 1, cx, cy), &child[0]);
+                        for (int y = 0; y < tile; y++) {
+                            for (int x = 0; x < tile; x++) {
+                                const unsigned char *src = &child[((size_t) y * tile + x) * 4];
+                                if (src[3] == 0) continue;
+                                unsigned int *dst = &sum[((size_t) ((c >> 1) * tile + y) / 2 * tile + ((c & 1) * tile + x) / 2) * 4];
+                                dst[0] += src[0];
+                                dst[1] += src[1];
+                                dst[2] += src[2];
+                                dst[3]++;
+                            }
+                        }
+                    }
+                    for (size_t p = 0; p < (size_t) tile * tile; p++) {
+                        unsigned int n = sum[p * 4 + 3];
+                        for (int k = 0; k < 3; k++) rgba[p * 4 + k] = (unsigned char) (n ? sum[p * 4 + k] / n : 0);
+                        rgba[p * 4 + 3] = n ? 255 : 0;
+                    }
+                    seekFile(out, headerSize + vt.tileIndex(L, tx, ty) * (long long) tileBytes);
+                    fwrite(&rgba[0], 1, tileBytes, out);
+                }
+            }
+        }
+        fclose(out);
+        vt.file = NULL;
+        printf("Virtual texture %s: %dx%d, %d levels, %lld tiles\n", path, w, hgt, vt.levels, vt.tileCount());
+        return true;
+    }
+
+    /**
+     * @brief Destructor, closes the file.
+     */
+    ~VirtualTextureFile() {
+        if (file) fclose(file);
+    }
+};
+
+/**
+ * @brief Vertex shader of the virtual texture background.
+ */
+const char *const virtualTextureVertexSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform mat4 MVP;
+    layout(location = 0) in vec2 vp;    // world position of the image corner
+    layout(location = 1) in vec2 vuv;   // texture coordinate of the image corner
+    out vec2 uv;
+
+    void main() {
+        gl_Position = vec4(vp.x, vp.y, 0, 1) * MVP;
+        uv = vuv;
+    }
+)";
+
+/**
+ * @brief Fragment shader of the virtual texture background.
+ * Selects the level from the screen-space derivatives, moves to coarser levels until the tile lies in
+ * the window of the indirection table, looks up the page of the tile (or of its finest resident
+ * ancestor) there, and samples the page cache.
+ */
+const char *const virtualTextureFragmentSource = R"(
+    #version 330
+    precision highp float;
+
+    uniform sampler2D pages;         // page cache
+    uniform sampler2D indirection;   // per window cell: page x, page y, level of the page
+    uniform vec2 imageSize;          // size of level 0 in pixels
+    uniform float tileSize;          // size of a tile in pixels
+    uniform float pagesPerSide;      // pages in a row of the page cache
+    uniform int levels;              // number of levels
+    uniform int window;              // tiles per side of the window of a level
+    uniform ivec2 windowOrigin[16];  // first tile of the window of each level
+    in vec2 uv;
+    out vec4 outColor;
+
+    void main() {
+        vec2 texel = clamp(uv * imageSize, vec2(0), imageSize - 0.5);
+        float lod = log2(max(max(length(dFdx(texel)), length(dFdy(texel))), 1.0));
+        int level = min(int(lod), levels - 1);
+        ivec2 tile = ivec2(texel / (tileSize * exp2(float(level))));
+        ivec2 cell = tile - windowOrigin[level];
+        while (level + 1 < levels && (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, ivec2(window))))) {
+            level++;
+            tile /= 2;
+            cell = tile - windowOrigin[level];
+        }
+        vec3 entry = floor(texelFetch(indirection, ivec2(cell.x, level * window + cell.y), 0).xyz * 255.0 + 0.5);
+        vec2 inPage = fract(texel / (tileSize * exp2(entry.z)));
+        outColor = vec4(texture(pages, (entry.xy + inPage) / pagesPerSide).rgb, 1);
+    }
+)";
+
+/**
+ * @class VirtualTexture
+ * @brief Background image of any size streamed tile by tile into a fixed GPU page cache.
+ *
+ * Each frame the tiles the cameras need are computed from the visible rectangle and the screen
+ * resolution of every viewport; missing ones are read from the pyramid, a few per frame, into the
+ * least recently used pages. The indirection table holds a window of window x window tiles per
+ * level, placed over the tiles the views need at that level; each cell refers to the page of its
+ * tile or of its finest resident ancestor, and the coarsest tile is always resident, so the image
+ * is never missing, only blurry while streaming. Resident tiles are found through a map bounded by
+ * the number of pages, so GPU and CPU memory are the page cache plus the window table, independent
+ * of the image size.
+ */
+class VirtualTexture {
+    static const int pagesPerSide = 16; /**< Pages in a row of the page cache. */
+    static const int tilesPerFrame = 8; /**< Tiles streamed in per frame. */
+    static const int maxLevels = 16; /**< Levels the shader supports. */
+    static const int window = 64; /**< Tiles per side of the window of a level in the indirection table. */
+
+    /**
+     * @struct Page
+     * @brief Slot of the page cache.
+     */
+    struct Page {
+        long long tile; /**< Tile in the page, -1 if empty. */
+        unsigned long lastUsed; /**< Frame in which the tile was last needed. */
+    };
+
+    /**
+     * @struct TileRange
+     * @brief Tiles of one level a viewport needs.
+     */
+    struct TileRange {
+        int level; /**< Level of the tiles. */
+        int x0, y0, x1, y1; /**< Inclusive tile bounds. */
+        bool finest; /**< Whether this is the level the viewport is drawn at. */
+    };
+
+    VirtualTextureFile pyramid; /**< Tiles on disk. */
+    GPUProgram program; /**< Program drawing the background. */
+    unsigned int pageTexture = 0; /**< Page cache. */
+    unsigned int indirectionTexture = 0; /**< Indirection table. */
+    unsigned int vao = 0; /**< VAO of the image quad. */
+    unsigned int vbo = 0; /**< Positions and texture coordinates of the image quad. */
+    std::vector<Page> pages; /**< Content of the page cache. */
+    std::unordered_map<long long, int> residentPage; /**< Page of every resident tile. */
+    std::vector<int> windowOrigin; /**< First tile x and y of the window of each level. */
+    std::vector<unsigned char> indirection; /**< CPU copy of the indirection table. */
+    std::vector<TileRange> ranges; /**< Tiles needed by the cameras this frame. */
+    std::vector<long long> requests; /**< Missing tiles needed by the cameras. */
+    std::vector<unsigned char> tileData; /**< Buffer of a tile read from disk. */
+    bool dirty = true; /**< Whether the indirection table must be rebuilt. */
+    unsigned long frame = 1; /**< Current frame number. */
+    float halfW = 1; /**< Half width of the image in world units. */
+    float halfH = 1; /**< Half height of the image in world units. */
+
+    /**
+     * @brief Returns the page of a tile, -1 if it is not resident.
+     */
+    int pageOf(long long tile) const {
+        std::unordered_map<long long, int>::const_iterator it = residentPage.find(tile);
+        return it == residentPage.end() ? -1 : it->second;
+    }
+
+    /**
+     * @brief Returns whether a tile lies in the window of its level.
+     */
+    bool inWindow(int L, int x, int y) const {
+        int cx = x - windowOrigin[2 * L], cy = y - windowOrigin[2 * L + 1];
+        return cx >= 0 && cy >= 0 && cx < window && cy < window;
+    }
+
+    /**
+     * @brief Loads a tile into the least recently used page.
+     */
+    void load(long long tile) {
+        int victim = 0;
+        for (int p = 1; p < (int) pages.size(); p++) {
+            if (pages[p].lastUsed < pages[victim].lastUsed) victim = p;
+        }
+        if (pages[victim].lastUsed == frame) return;    // every page is needed by this frame
+        if (!pyramid.readTile(tile, &tileData[0])) return;
+        if (pages[victim].tile >= 0) residentPage.erase(pages[victim].tile);
+        pages[victim].tile = tile;
+        pages[victim].lastUsed = frame;
+        residentPage[tile] = victim;
+        glBindTexture(GL_TEXTURE_2D, pageTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, (victim % pagesPerSide) * pyramid.tileSize,
+                        (victim / pagesPerSide) * pyramid.tileSize, pyramid.tileSize, pyramid.tileSize,
+                        GL_RGBA, GL_UNSIGNED_BYTE, &tileData[0]);
+        frameStats.uploadBytes += tileData.size();
+        dirty = true;
+    }
+
+    /**
+     * @brief Places the window of every level over the tiles the views need at that level.
+     *
+     * A level is centered on the views drawn at it if any, otherwise on all views needing it;
+     * tiles that do not fit are drawn from a coarser level.
+     */
+    void placeWindows() {
+        for (int L = 0; L < pyramid.levels; L++) {
+            int bounds[4] = {INT_MAX, INT_MAX, INT_MIN, INT_MIN};
+            for (int pass = 0; pass < 2 && bounds[0] == INT_MAX; pass++) {
+                for (size_t r = 0; r < ranges.size(); r++) {
+                    const TileRange &range = ranges[r];
+                    if (range.level != L || (pass == 0 && !range.finest)) continue;
+                    bounds[0] = std::min(bounds[0], range.x0);
+                    bounds[1] = std::min(bounds[1], range.y0);
+                    bounds[2] = std::max(bounds[2], range.x1);
+                    bounds[3] = std::max(bounds[3], range.y1);
+                }
+            }
+            if (bounds[0] == INT_MAX) continue;    // keep the window where it was
+            int limits[2] = {pyramid.tilesX(L), pyramid.tilesY(L)};
+            for (int a = 0; a < 2; a++) {
+                int origin = (bounds[a] + bounds[a + 2] + 1) / 2 - window / 2;
+                origin = std::max(0, std::min(origin, limits[a] - window));
+                if (windowOrigin[2 * L + a] != origin) {
+                    windowOrigin[2 * L + a] = origin;
+                    dirty = true;
+                }
+            }
+        }
+    }
+
+    /**
+     * @brief Rebuilds the indirection table, coarsest level first so a cell can inherit from its
+     * parent when the parent lies in the window of its level.
+     */
+    void rebuildIndirection() {
+        for (int L = pyramid.levels - 1; L >= 0; L--) {
+            for (int cy = 0; cy < window; cy++) {
+                int y = windowOrigin[2 * L + 1] + cy;
+                if (y >= pyramid.tilesY(L)) break;
+                for (int cx = 0; cx < window; cx++) {
+                    int x = windowOrigin[2 * L] + cx;
+                    if (x >= pyramid.tilesX(L)) break;
+                    unsigned char *e = &indirection[(((size_t) L * window + cy) * window + cx) * 4];
+                    int page = pageOf(pyramid.tileIndex(L, x, y)), pageLevel = L;
+                    if (page < 0 && L + 1 < pyramid.levels && inWindow(L + 1, x / 2, y / 2)) {
+                        const unsigned char *parent = &indirection[(((size_t) (L + 1) * window + y / 2 - windowOrigin[2 * L + 3]) * window
+                                                                    + x / 2 - windowOrigin[2 * L + 2]) * 4];
+                        e[0] = parent[0];
+                        e[1] = parent[1];
+                        e[2] = parent[2];
+                        e[3] = 255;
+                        continue;
+                    }
+                    for (int l = L + 1; page < 0 && l < pyramid.levels; l++) {
+                        page = pageOf(pyramid.tileIndex(l, x >> (l - L), y >> (l - L)));
+                        pageLevel = l;
+                    }
+                    e[0] = (unsigned char) (page % pagesPerSide);
+                    e[1] = (unsigned char) (page / pagesPerSide);
+                    e[2] = (unsigned char) pageLevel;
+                    e[3] = 255;
+                }
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, window, window * pyramid.levels, GL_RGBA, GL_UNSIGNED_BYTE,
+                        &indirection[0]);
+        dirty = false;
+    }
+
+public:
+    /**
+     * @brief Constructor for the VirtualTexture class.
+     */
+    VirtualTexture() : program(false) {}
+
+    /**
+     * @brief Opens a pyramid, building it first from a BMP file if needed, and creates the GPU objects.
+     * @param path A .vt pyramid or a 24 bit .bmp image.
+     * @return True if the background can be drawn.
+     */
+    bool open(const char *path) {
+        std::string vtPath = path;
+        if (vtPath.size() > 4 && vtPath.compare(vtPath.size() - 4, 4, ".bmp") == 0) {
+            vtPath.replace(vtPath.size() - 4, 4, ".vt");
+            FILE *existing = fopen(vtPath.c_str(), "rb");
+            if (existing) fclose(existing);
+            else if (!VirtualTextureFile::build(path, vtPath.c_str())) return false;
+        }
+        if (!pyramid.open(vtPath.c_str()) || pyramid.levels > maxLevels) {
+            printf("%s is not a virtual texture\n", vtPath.c_str());
+            return false;
+        }
+
+        float aspect = (float) pyramid.width / pyramid.height;
+        halfW = aspect >= 1 ? 1 : aspect;
+        halfH = aspect >= 1 ? 1 / aspect : 1;
+        float quad[] = {-halfW, -halfH, 0, 0, halfW, -halfH, 1, 0, -halfW, halfH, 0, 1, halfW, halfH, 1, 1};
+        glGenVertexArrays(1, &vao);
+        glBindVertexArray(vao);
+        glGenBuffers(1, &vbo);
+        glBindBuffer(GL_ARRAY_BUFFER, vbo);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), NULL);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void *) (2 * sizeof(float)));
+        glDebug.label(GL_VERTEX_ARRAY, vao, "background quad");
+
+        int cacheSize = pagesPerSide * pyramid.tileSize;
+        glGenTextures(1, &pageTexture);
+        glBindTexture(GL_TEXTURE_2D, pageTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, cacheSize, cacheSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glDebug.label(GL_TEXTURE, pageTexture, "background page cache");
+        gpuMemory.pin(GpuMemory::TEXTURES, 4ll * cacheSize * cacheSize);
+
+        windowOrigin.assign(2 * pyramid.levels, 0);
+        indirection.assign((size_t) window * window * pyramid.levels * 4, 0);
+        glGenTextures(1, &indirectionTexture);
+        glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, window, window * pyramid.levels, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glDebug.label(GL_TEXTURE, indirectionTexture, "background indirection");
+        gpuMemory.pin(GpuMemory::TEXTURES, (long long) indirection.size());
+
+        Page empty = {-1, 0};
+        pages.assign(pagesPerSide * pagesPerSide, empty);
+        residentPage.reserve(pages.size());
+        tileData.resize((size_t) pyramid.tileSize * pyramid.tileSize * 4);
+        long long coarsest = pyramid.tileIndex(pyramid.levels - 1, 0, 0);
+        load(coarsest);
+        if (pageOf(coarsest) < 0) {
+            printf("%s cannot be read\n", vtPath.c_str());
+            return false;
+        }
+        pages[pageOf(coarsest)].lastUsed = (unsigned long) -1;    // pinned fallback
+
+        bool built = program.create(virtualTextureVertexSource, virtualTextureFragmentSource, "outColor");
+        gpuProgram.Use();
+        if (!built) {
+            printf("Background program failed to build\n");
+            return false;
+        }
+        glDebug.label(GL_PROGRAM, program.getId(), "background program");
+        return true;
+    }
+
+    /**
+     * @brief Collects the tiles a viewport needs at its screen resolution.
+     * @param view The viewport.
+     * @param pixelsW Width of the viewport in pixels.
+     */
+    void request(const Viewport &view, int pixelsW) {
+        float imagePixelsPerScreenPixel = (pyramid.width / (2 * halfW)) * (2 / view.zoom) / pixelsW;
+        int level = 0;
+        while (level + 1 < pyramid.levels && (float) (2 << level) <= imagePixelsPerScreenPixel) level++;
+        vec4 visible = view.visible(0);
+        float u0 = (visible.x + halfW) / (2 * halfW), u1 = (visible.z + halfW) / (2 * halfW);
+        float v0 = (visible.y + halfH) / (2 * halfH), v1 = (visible.w + halfH) / (2 * halfH);
+        if (u1 < 0 || v1 < 0 || u0 > 1 || v0 > 1) return;
+        for (int L = pyramid.levels - 1; L >= level; L--) {
+            float span = (float) pyramid.tileSize * (1 << L);
+            TileRange range;
+            range.level = L;
+            range.x0 = (int) (fmaxf(u0, 0) * pyramid.width / span);
+            range.x1 = std::min((int) (fminf(u1, 1) * pyramid.width / span), pyramid.tilesX(L) - 1);
+            range.y0 = (int) (fmaxf(v0, 0) * pyramid.height / span);
+            range.y1 = std::min((int) (fminf(v1, 1) * pyramid.height / span), pyramid.tilesY(L) - 1);
+            range.finest = L == level;
+            ranges.push_back(range);
+        }
+    }
+
+    /**
+     * @brief Places the windows, streams in a few of the requested tiles that fall into them and
+     * updates the indirection table.
+     * @return True if tiles are still missing.
+     */
+    bool stream() {
+        placeWindows();
+        for (size_t r = 0; r < ranges.size(); r++) {
+            const TileRange &range = ranges[r];
+            int L = range.level;
+            int x0 = std::max(range.x0, windowOrigin[2 * L]), x1 = std::min(range.x1, windowOrigin[2 * L] + window - 1);
+            int y0 = std::max(range.y0, windowOrigin[2 * L + 1]), y1 = std::min(range.y1, windowOrigin[2 * L + 1] + window - 1);
+            for (int y = y0; y <= y1; y++) {
+                for (int x = x0; x <= x1; x++) {
+                    long long tile = pyramid.tileIndex(L, x, y);
+                    int page = pageOf(tile);
+                    if (page >= 0) {
+                        if (pages[page].lastUsed != (unsigned long) -1) pages[page].lastUsed = frame;
+                    } else {
+                        requests.push_back(tile);
+                    }
+                }
+            }
+        }
+        ranges.clear();
+
+        // coarser levels have higher tile indices, so they are streamed first
+        std::sort(requests.begin(), requests.end(), std::greater<long long>());
+        requests.erase(std::unique(requests.begin(), requests.end()), requests.end());
+        int loaded = 0;
+        for (size_t r = 0; r < requests.size() && loaded < tilesPerFrame; r++) {
+            load(requests[r]);
+            loaded++;
+        }
+        bool missing = requests.size() > (size_t) loaded;
+        requests.clear();
+        if (dirty) rebuildIndirection();
+        frame++;
+        return missing;
+    }
+
+    /**
+     * @brief Draws the image through the camera of a viewport.
+     * @param view The viewport.
+     */
+    void draw(const Viewport &view) {
+        program.Use();
+        program.setUniform(view.MVP(), "MVP");
+        program.setUniform(vec2((float) pyramid.width, (float) pyramid.height), "imageSize");
+        program.setUniform((float) pyramid.tileSize, "tileSize");
+        program.setUniform((float) pagesPerSide, "pagesPerSide");
+        program.setUniform(pyramid.levels, "levels");
+        program.setUniform(window, "window");
+        glUniform2iv(glGetUniformLocation(program.getId(), "windowOrigin"), pyramid.levels, &windowOrigin[0]);
+        program.setUniform(0, "pages");
+        program.setUniform(1, "indirection");
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, pageTexture);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, indirectionTexture);
+        glActiveTexture(GL_TEXTURE0);
+        glBindVertexArray(vao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        frameStats.drawCalls++;
+        gpuProgram.Use();
+    }
+};
+
+VirtualTexture *background = NULL; /**< Background reference image, NULL if none is given. */
+
+/**
+ * @class Selection
+ * @brief A set of selected lines that is dragged with a transform applied on the GPU.
+ *
+ * While a drag is in progress the selected lines are drawn from a copy of their vertices with
+ * the translation, or the rotation about their centroid, applied by the camera in the MVP
+ * matrix, so a motion event only changes a uniform. The transform is baked into the line storage once, when
+ * the button is released.
+ */
+class Selection {
+    /**
+     * @brief What the current drag does.
+     */
+    enum Drag {
+        NONE, TRANSLATE, ROTATE, BOX
+    };
+
+    std::vector<int> selected; /**< Indices of the selected lines. */
+    std::vector<bool> isSelected; /**< Whether a line is selected, by line index. */
+    std::vector<unsigned long> versions; /**< Line versions the highlight was built from. */
+    unsigned long epoch = 0; /**< Line collection epoch the highlight was built from. */
+    bool dirty = true; /**< Whether the highlight has to be rebuilt. */
+    Object *highlight = NULL; /**< Copy of the vertices of the selected lines. */
+    Object *band = NULL; /**< Rectangle of a box selection. */
+    Drag drag = NONE; /**< The current drag. */
+    dvec3 start; /**< World position where the drag started. */
+    dvec3 current; /**< Current world position of the drag. */
+    dvec3 pivot; /**< Centroid of the selection, the center of rotations. */
+
+    /**
+     * @brief Drops lines that no longer exist and rebuilds the highlight if the lines changed.
+     */
+    void validate() {
+        if (lines->getEpoch() != epoch) {
+            std::vector<int> kept;
+            for (size_t k = 0; k < selected.size(); k++) {
+                if (selected[k] < lines->size()) kept.push_back(selected[k]);
+            }
+            selected.swap(kept);
+            isSelected.assign(lines->size(), false);
+            for (size_t k = 0; k < selected.size(); k++) isSelected[selected[k]] = true;
+            epoch = lines->getEpoch();
+            dirty = true;
+        }
+        for (size_t k = 0; k < selected.size() && !dirty; k++) {
+            if (lines->version(selected[k]) != versions[k]) dirty = true;
+        }
+        if (!dirty) return;
+        if (!highlight) {
+            highlight = new Object();
+            highlight->setLabel("selection");
+        }
+        ChunkedArray<dvec3> &vtx = highlight->Vtx();
+        vtx = ChunkedArray<dvec3>();
+        versions.clear();
+        for (size_t k = 0; k < selected.size(); k++) {
+            for (int v = 0; v < 4; v++) vtx.push_back(lines->getLines().Vtx()[selected[k] * 4 + v]);
+            versions.push_back(lines->version(selected[k]));
+        }
+        highlight->updateGpu();
+        dirty = false;
+    }
+
+    /**
+     * @brief Adds a line to the selection or removes it.
+     */
+    void toggle(int lineId) {
+        if ((int) isSelected.size() < lines->size()) isSelected.resize(lines->size(), false);
+        if (isSelected[lineId]) {
+            selected.erase(std::find(selected.begin(), selected.end(), lineId));
+        } else {
+            selected.push_back(lineId);
+        }
+        isSelected[lineId] = !isSelected[lineId];
+        dirty = true;
+    }
+
+    /**
+     * @brief Adds the lines whose defining segment has its midpoint inside a rectangle.
+     */
+    void selectBox(const dvec3 &a, const dvec3 &b) {
+        double x0 = std::min(a.x, b.x), x1 = std::max(a.x, b.x), y0 = std::min(a.y, b.y), y1 = std::max(a.y, b.y);
+        ChunkedArray<dvec3> &vtx = lines->getLines().Vtx();
+        for (int l = 0; l < lines->size(); l++) {
+            dvec3 mid = (vtx[l * 4] + vtx[l * 4 + 1]) * 0.5;
+            if (mid.x >= x0 && mid.x <= x1 && mid.y >= y0 && mid.y <= y1 &&
+                (l >= (int) isSelected.size() || !isSelected[l])) {
+                toggle(l);
+            }
+        }
+    }
+
+    /**
+     * @brief Writes the transform of the drag into the line storage.
+     */
+    void bake() {
+        ChunkedArray<dvec3> &vtx = lines->getLines().Vtx();
+        for (size_t k = 0; k < selected.size(); k++) {
+            int l = selected[k];
+            Line line(apply(vtx[l * 4]), apply(vtx[l * 4 + 1]));
+            lines->setLine(l, line.getP1(), line.getP2(), line.getP3(), line.getP4());
+            replication.lineMoved(l);
+        }
+        lines->update();
+        printf("%d lines %s\n", (int) selected.size(), drag == ROTATE ? "rotated" : "moved");
+    }
+
+public:
+    /**
+     * @brief Returns the number of selected lines.
+     */
+    int size() const {
+        return (int) selected.size();
+    }
+
+    /**
+     * @brief Returns the rotation of the drag in progress about pivot.
+     */
+    float angle() const {
+        if (drag != ROTATE) return 0;
+        return (float) (atan2(current.y - pivot.y, current.x - pivot.x) - atan2(start.y - pivot.y, start.x - pivot.x));
+    }
+
+    /**
+     * @brief Returns the translation of the drag in progress.
+     */
+    dvec3 offset() const {
+        return drag == TRANSLATE ? dvec3(current.x - start.x, current.y - start.y, 0) : dvec3();
+    }
+
+    /**
+     * @brief Applies the transform of the drag in progress to a world position.
+     */
+    dvec3 apply(const dvec3 &p) const {
+        double c = cos(angle()), s = sin(angle());
+        dvec3 d = offset();
+        return dvec3(c * (p.x - pivot.x) - s * (p.y - pivot.y) + pivot.x + d.x,
+                     s * (p.x - pivot.x) + c * (p.y - pivot.y) + pivot.y + d.y, p.z);
+    }
+
+    /**
+     * @brief Handles a press of the left button in selection mode.
+     *
+     * Pressing on a selected line starts dragging the selection, rotating it if rotate is set.
+     * Pressing on another line toggles it, and pressing on empty space starts a box selection.
+     * @param world World position of the press.
+     * @param rotate Whether to rotate about the centroid instead of translating.
+     */
+    void press(const dvec3 &world, bool rotate) {
+        validate();
+        int idx = lines->findNearestLine(world);
+        start = current = world;
+        if (idx != -1 && idx / 4 < (int) isSelected.size() && isSelected[idx / 4]) {
+            history.record();
+            pivot = dvec3(0, 0, 0);
+            ChunkedArray<dvec3> &vtx = lines->getLines().Vtx();
+            for (size_t k = 0; k < selected.size(); k++) {
+                pivot = pivot + (vtx[selected[k] * 4] + vtx[selected[k] * 4 + 1]) * (0.5f / selected.size());
+            }
+            drag = rotate ? ROTATE : TRANSLATE;
+        } else if (idx != -1) {
+            toggle(idx / 4);
+            drag = NONE;
+        } else {
+            drag = BOX;
+        }
+        glutPostRedisplay();
+    }
+
+    /**
+     * @brief Follows the mouse during a drag; only the transform changes.
+     * @return Whether the selected lines moved, i.e. a translate or rotate drag is in progress.
+     */
+    bool motion(const dvec3 &world) {
+        if (drag == NONE) return false;
+        current = world;
+        glutPostRedisplay();
+        return drag == TRANSLATE || drag == ROTATE;
+    }
+
+    /**
+     * @brief Ends the drag, baking the transform or applying the box selection.
+     */
+    void release(const dvec3 &world) {
+        current = world;
+        if (drag == TRANSLATE || drag == ROTATE) {
+            bake();
+        } else if (drag == BOX) {
+            if (fabs(current.x - start.x) < 1e-3f && fabs(current.y - start.y) < 1e-3f) {
+                selected.clear();
+                isSelected.assign(lines->size(), false);
+                dirty = true;
+            } else {
+                selectBox(start, current);
+            }
+            printf("%d lines selected\n", size());
+        }
+        drag = NONE;
+        glutPostRedisplay();
+    }
+
+    /**
+     * @brief Abandons the drag in progress without changing the lines.
+     */
+    void cancel() {
+        drag = NONE;
+    }
+
+    /**
+     * @brief Draws the selection highlight and the selection box through the camera.
+     */
+    void draw() {
+        validate();
+        if (!selected.empty()) {
+            camera.setTransform(angle(), pivot, offset());
+            highlight->Draw(GL_LINES, vec3(1, 1, 0));
+            camera.clearTransform();
+        }
+        if (drag == BOX) {
+            if (!band) {
+                band = new Object();
+                band->setLabel("selection box");
+            }
+            band->Vtx() = ChunkedArray<dvec3>();
+            band->Vtx().push_back(dvec3(start.x, start.y, 1));
+            band->Vtx().push_back(dvec3(current.x, start.y, 1));
+            band->Vtx().push_back(dvec3(current.x, current.y, 1));
+            band->Vtx().push_back(dvec3(start.x, current.y, 1));
+            band->updateGpu();
+            band->Draw(GL_LINE_LOOP, vec3(1, 1, 0));
+        }
+    }
+};
+
+Selection selection; /**< Lines selected in selection mode. */
+
+/**
+ * @class Snapper
+ * @brief Snaps a position to points, feet of perpendiculars on lines and line intersections.
+ *
+ * Points and lines are kept in uniform grids over a square region around the queries (a line
+ * is entered into every cell its clipped extent crosses), so a query only looks at the cells
+ * within the tolerance. The world is unbounded, so the region is placed where the cursor is,
+ * with cells a few tolerances wide, and moved when a query leaves it or the zoom changes the
+ * tolerance a lot; elements outside the region are not indexed. Intersections are computed
+ * between the lines found there. Points rank before intersections and intersections before
+ * feet, then the nearer candidate wins. The grids are extended when elements are appended and
+ * rebuilt when existing lines change.
+ */
+class Snapper {
+public:
+    static const int gridSize = 64; /**< Cells per side of the grids. */
+    static constexpr double cellTolerances = 8; /**< Width of a cell in tolerances when the region is placed. */
+    static const int maxPairLines = 64; /**< Lines near the cursor intersected with each other. */
+
+    /**
+     * @brief Kind of a snap target, in ranking order.
+     */
+    enum Kind {
+        POINT, INTERSECTION, FOOT, NONE
+    };
+
+    /**
+     * @struct Candidate
+     * @brief A snap target.
+     */
+    struct Candidate {
+        Kind kind; /**< Kind of the target. */
+        dvec3 pos; /**< Snapped position. */
+        float distance; /**< Distance from the queried position. */
+
+        bool before(const Candidate &o) const {
+            return kind != o.kind ? kind < o.kind : distance < o.distance;
+        }
+    };
+
 private:
-    Object lines; /**< Object storing the lines. */
-    bool firstClick = false; /**< Flag indicating the first click when drawing a line. */
-    vec3 startPoint; /**< Start point of the line when drawing. */
+    std::vector<std::vector<int> > pointCells; /**< Point indices per cell. */
+    std::vector<std::vector<int> > lineCells; /**< Line indices per cell. */
+    dvec3 regionMin; /**< Lower left corner of the indexed region. */
+    double cellSize = 0; /**< Width of a cell in world units, 0 before the region is placed. */
+    int indexedPoints = 0; /**< Number of points in the grid. */
+    int indexedLines = 0; /**< Number of lines in the grid. */
+    unsigned long pointEpoch = 0; /**< Point collection epoch the grid was built from. */
+    unsigned long lineEpoch = 0; /**< Line collection epoch the grid was built from. */
+    unsigned long lineChanges = 0; /**< Line collection change count the grid was built from. */
+    std::vector<int> lineMark; /**< Query stamp per line, to visit each line once. */
+    int queryStamp = 0; /**< Stamp of the current query. */
+    bool hovering = false; /**< Whether the hover preview is shown. */
+    Candidate preview; /**< Target under the cursor. */
+    Object *marker = NULL; /**< Vertices of the hover preview. */
+
+    /**
+     * @brief Returns the column or row of a coordinate, possibly outside the grid.
+     * @param v The coordinate.
+     * @param min The coordinate of the region's lower left corner on the same axis.
+     */
+    long long cell(double v, double min) const {
+        return (long long) floor((v - min) / cellSize);
+    }
+
+    /**
+     * @brief Returns the cell index of a position, or -1 outside the region.
+     */
+    int cellIndex(const dvec3 &q) const {
+        long long cx = cell(q.x, regionMin.x), cy = cell(q.y, regionMin.y);
+        if (cx < 0 || cy < 0 || cx >= gridSize || cy >= gridSize) return -1;
+        return (int) (cy * gridSize + cx);
+    }
+
+    /**
+     * @brief Returns whether the region contains the query box and its cells suit the tolerance.
+     */
+    bool covers(const dvec3 &pos, double tolerance) const {
+        if (cellSize <= 0 || cellSize > 4 * cellTolerances * tolerance || cellSize < cellTolerances / 4 * tolerance) return false;
+        double side = cellSize * gridSize;
+        return pos.x - tolerance >= regionMin.x && pos.y - tolerance >= regionMin.y &&
+               pos.x + tolerance < regionMin.x + side && pos.y + tolerance < regionMin.y + side;
+    }
+
+    /**
+     * @brief Centers the region on a query and empties the grids.
+     */
+    void place(const dvec3 &pos, double tolerance) {
+        cellSize = cellTolerances * tolerance;
+        regionMin = dvec3(pos.x - cellSize * gridSize / 2, pos.y - cellSize * gridSize / 2, 1);
+        for (size_t c = 0; c < pointCells.size(); c++) pointCells[c].clear();
+        for (size_t c = 0; c < lineCells.size(); c++) lineCells[c].clear();
+        indexedPoints = 0;
+        indexedLines = 0;
+    }
+
+    /**
+     * @brief Enters a line into the cells its extent inside the region crosses.
+     */
+    void indexLine(int l) {
+        Line line = lines->line(l);
+        dvec3 p = line.getP1(), d = line.getP2() - line.getP1();
+        if (d.x == 0 && d.y == 0) return;
+        double t0 = -1e300, t1 = 1e300, side = cellSize * gridSize;
+        double origin[2] = {p.x, p.y}, dir[2] = {d.x, d.y}, low[2] = {regionMin.x, regionMin.y};
+        for (int axis = 0; axis < 2; axis++) {    // clip to the region slab by slab
+            if (dir[axis] == 0) {
+                if (origin[axis] < low[axis] || origin[axis] > low[axis] + side) return;
+                continue;
+            }
+            double ta = (low[axis] - origin[axis]) / dir[axis], tb = (low[axis] + side - origin[axis]) / dir[axis];
+            t0 = std::max(t0, std::min(ta, tb));
+            t1 = std::min(t1, std::max(ta, tb));
+        }
+        if (t0 > t1) return;
+        dvec3 a = p + d * t0, b = p + d * t1;
+        int steps = (int) (sqrt((b.x - a.x) * (b.x - a.x) + (b.y - a.y) * (b.y - a.y)) / cellSize * 4) + 1;    // a quarter cell per step
+        int last = -1;
+        for (int k = 0; k <= steps; k++) {
+            int c = cellIndex(a + (b - a) * ((double) k / steps));
+            if (c >= 0 && c != last) {
+                if (lineCells[c].empty() || lineCells[c].back() != l) lineCells[c].push_back(l);
+                last = c;
+            }
+        }
+    }
+
+    /**
+     * @brief Brings the grids up to date with the collections.
+     */
+    void sync(const dvec3 &pos, double tolerance) {
+        if (pointCells.empty()) {
+            pointCells.resize(gridSize * gridSize);
+            lineCells.resize(gridSize * gridSize);
+        }
+        if (!covers(pos, tolerance)) place(pos, tolerance);
+        if (points->getEpoch() != pointEpoch || indexedPoints > points->size()) {
+            for (size_t c = 0; c < pointCells.size(); c++) pointCells[c].clear();
+            indexedPoints = 0;
+            pointEpoch = points->getEpoch();
+        }
+        for (; indexedPoints < points->size(); indexedPoints++) {
+            int c = cellIndex(points->getPoints().Vtx()[indexedPoints]);
+            if (c >= 0) pointCells[c].push_back(indexedPoints);
+        }
+        if (lines->getEpoch() != lineEpoch || lines->getChanges() != lineChanges) {
+            for (size_t c = 0; c < lineCells.size(); c++) lineCells[c].clear();
+            indexedLines = 0;
+            lineEpoch = lines->getEpoch();
+            lineChanges = lines->getChanges();
+        }
+        for (; indexedLines < lines->size(); indexedLines++) indexLine(indexedLines);
+        lineMark.resize(lines->size(), 0);
+    }
+
+public:
+    /**
+     * @brief Returns the snap targets within a tolerance, best first.
+     * @param pos The queried world position.
+     * @param tolerance Maximum distance in world units.
+     */
+    std::vector<Candidate> candidates(const dvec3 &pos, float tolerance) {
+        std::vector<Candidate> found;
+        if (!(tolerance > 0)) return found;
+        sync(pos, tolerance);
+        std::vector<int> near;
+        queryStamp++;
+        int x0 = (int) cell(pos.x - tolerance, regionMin.x), x1 = (int) cell(pos.x + tolerance, regionMin.x);
+        int y0 = (int) cell(pos.y - tolerance, regionMin.y), y1 = (int) cell(pos.y + tolerance, regionMin.y);
+        for (int cy = y0; cy <= y1; cy++) {
+            for (int cx = x0; cx <= x1; cx++) {
+                const std::vector<int> &pc = pointCells[cy * gridSize + cx];
+                for (size_t k = 0; k < pc.size(); k++) {
+                    const dvec3 &q = points->getPoints().Vtx()[pc[k]];
+                    double d = sqrt((q.x - pos.x) * (q.x - pos.x) + (q.y - pos.y) * (q.y - pos.y));
+                    if (d <= tolerance) found.push_back(Candidate{POINT, q, (float) d});
+                }
+                const std::vector<int> &lc = lineCells[cy * gridSize + cx];
+                for (size_t k = 0; k < lc.size(); k++) {
+                    if (lineMark[lc[k]] == queryStamp) continue;
+                    lineMark[lc[k]] = queryStamp;
+                    Line line = lines->line(lc[k]);
+                    double a = line.getA(), b = line.getB(), c = line.getC(), n2 = a * a + b * b;
+                    double side = (a * pos.x + b * pos.y + c) / n2;
+                    double d = fabs(side) * sqrt(n2);
+                    if (d > tolerance) continue;
+                    found.push_back(Candidate{FOOT, dvec3(pos.x - side * a, pos.y - side * b, 1), (float) d});
+                    if ((int) near.size() < maxPairLines) near.push_back(lc[k]);
+                }
+            }
+        }
+        for (size_t i = 0; i < near.size(); i++) {
+            Line l1 = lines->line(near[i]);
+            for (size_t j = i + 1; j < near.size(); j++) {
+                Line l2 = lines->line(near[j]);
+                double determinant = l1.getA() * l2.getB() - l2.getA() * l1.getB();
+                if (determinant == 0) continue;
+                dvec3 q((l1.getB() * l2.getC() - l2.getB() * l1.getC()) / determinant,
+                        (l2.getA() * l1.getC() - l1.getA() * l2.getC()) / determinant, 1);
+                double d = sqrt((q.x - pos.x) * (q.x - pos.x) + (q.y - pos.y) * (q.y - pos.y));
+                if (d <= tolerance) found.push_back(Candidate{INTERSECTION, q, (float) d});
+            }
+        }
+        std::sort(found.begin(), found.end(), [](const Candidate &a, const Candidate &b) { return a.before(b); });
+        return found;
+    }
+
+    /**
+     * @brief Returns the best snap target, or the position itself if there is none.
+     * @param pos The queried world position.
+     * @param tolerance Maximum distance in world units.
+     */
+    Candidate snap(const dvec3 &pos, float tolerance) {
+        std::vector<Candidate> found = candidates(pos, tolerance);
+        return found.empty() ? Candidate{NONE, pos, 0} : found[0];
+    }
+
+    /**
+     * @brief Updates the hover preview for the cursor position.
+     */
+    void hover(const dvec3 &pos, float tolerance) {
+        preview = snap(pos, tolerance);
+        hovering = true;
+    }
+
+    /**
+     * @brief Hides the hover preview.
+     * @return True if it was shown.
+     */
+    bool clearHover() {
+        bool was = hovering;
+        hovering = false;
+        return was;
+    }
+
+    /**
+     * @brief Draws the hover preview: the target and the line being drawn to it.
+     */
+    void draw() {
+        if (!hovering) return;
+        if (!marker) {
+            marker = new Object();
+            marker->setLabel("snap preview");
+        }
+        ChunkedArray<dvec3> &vtx = marker->Vtx();
+        vtx = ChunkedArray<dvec3>();
+        vtx.push_back(preview.pos);
+        if (lines->isFirst()) {
+            vtx.push_back(lines->getStartPoint());
+            vtx.push_back(preview.pos);
+        }
+        marker->updateGpu();
+        static const vec3 colors[] = {vec3(1, 1, 0), vec3(1, 0, 1), vec3(1, 1, 1), vec3(0.5f, 0.5f, 0.5f)};
+        if (vtx.size() > 1) marker->Draw(GL_LINES, vec3(1, 1, 1));
+        marker->Draw(GL_POINTS, colors[preview.kind]);
+    }
+};
+
+Snapper snapper; /**< Snapping of the line end points. */
+float snapTolerancePx = 10; /**< Snap tolerance in pixels. */
+
+/**
+ * @class PerfCounters
+ * @brief Hardware performance counters of the calling thread, read with perf_event_open.
+ *
+ * Every event is opened on its own so that an event the CPU or the virtual machine does not
+ * support only leaves its column empty. Counts are scaled by the enabled and running times when
+ * the kernel multiplexes the counters. Without perf_event_open (other platforms, or a
+ * perf_event_paranoid setting that forbids it) only the time is measured.
+ */
+class PerfCounters {
+public:
+    /**
+     * @brief The measured events.
+     */
+    enum Event {
+        CYCLES, INSTRUCTIONS, L1D_MISSES, LLC_MISSES, BRANCH_MISSES, EVENT_COUNT
+    };
+
+private:
+    int fds[EVENT_COUNT]; /**< File descriptor of each event, -1 if unavailable. */
+    double values[EVENT_COUNT]; /**< Counts of the last region, negative if unavailable. */
+    std::chrono::steady_clock::time_point started; /**< Start time of the region. */
+    double ms = 0; /**< Duration of the last region. */
+    const char *unavailable = NULL; /**< Why no event could be opened. */
+
+#if defined(__linux__)
+    static int open(unsigned int type, unsigned long long config) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+#endif
+
 public:
-    bool firstCLick = false;
     /**
-     * @brief Returns the number of lines in the collection.
-     * @return The number of lines.
+     * @brief Constructor for the PerfCounters class, opens the events.
      */
-    Object &getLines() {
-        return lines;
+    PerfCounters() {
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            fds[e] = -1;
+            values[e] = -1;
+        }
+#if defined(__linux__)
+        fds[CYCLES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+        if (fds[CYCLES] < 0) unavailable = strerror(errno);
+        fds[INSTRUCTIONS] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+        fds[L1D_MISSES] = open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                                   (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+        fds[LLC_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+        fds[BRANCH_MISSES] = open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+#else
+        unavailable = "perf_event_open is only available on Linux";
+#endif
     }
 
     /**
-     * @brief Returns whether the first click has occurred when drawing a line.
-     * @return True if the first click has occurred, false otherwise.
+     * @brief Destructor for the PerfCounters class, closes the events.
      */
-    int index(Line l1) {
-        for (int i = 0; i < lines.Vtx().size(); i += 4) {
-            bool isSameLine = (lines.Vtx()[i].x == l1.getP1().x && lines.Vtx()[i].y == l1.getP1().y &&
-                               lines.Vtx()[i + 1].x == l1.getP2().x && lines.Vtx()[i + 1].y == l1.getP2().y) ||
-                              (lines.Vtx()[i].x == l1.getP2().x && lines.Vtx()[i].y == l1.getP2().y &&
-                               lines.Vtx()[i + 1].x == l1.getP1().x && lines.Vtx()[i + 1].y == l1.getP1().y);
-
-            if (isSameLine) {
-                return i;
-            }
+    ~PerfCounters() {
+#if defined(__linux__)
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            if (fds[e] >= 0) close(fds[e]);
         }
-        return -1;
+#endif
     }
 
     /**
-     * @brief Adds a line to the collection.
-     * @param l The line to add.
+     * @brief Returns why the counters are unavailable, or NULL if at least cycles are counted.
      */
-    void addLine(Line l) {
-        float a, b, c, px, py;
-        lines.Vtx().push_back(l.getP1());
-        lines.Vtx().push_back(l.getP2());
-        lines.Vtx().push_back(l.getP3());
-        lines.Vtx().push_back(l.getP4());
-        a = l.getA();
-        b = l.getB();
-        c = -a * l.getP1().x - b * l.getP1().y;
-        px = l.getPx();
-        py = l.getPy();
-        printf("Line added\n");
-        printf("\tImplicit: %3.2f x + %3.2f y + %3.2f = 0\n", a, b, c);
-        printf("\tParametric: r<t> = <%3.2f, %3.2f> + <%3.2f, %3.2f>t\n", l.getP1().x, l.getP1().y, px, py);
-        update();
+    const char *whyUnavailable() const {
+        return fds[CYCLES] >= 0 ? NULL : unavailable;
     }
 
     /**
-     * @brief Starts drawing a line from a given point.
-     * @param startPoint The starting point of the line.
+     * @brief Starts a measured region.
      */
-    void startDrawing(vec3 startPoint) {
-        firstCLick = true;
-        this->startPoint = startPoint;
-
+    void start() {
+#if defined(__linux__)
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            if (fds[e] < 0) continue;
+            ioctl(fds[e], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[e], PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+        started = std::chrono::steady_clock::now();
     }
 
     /**
-     * @brief Finishes drawing a line to a given point.
-     * @param endPoint The end point of the line.
+     * @brief Ends the measured region and reads the counts.
      */
-    void finishDrawing(vec3 endPoint) {
-        firstCLick = false;
-        addLine(Line(startPoint, endPoint));
+    void stop() {
+        ms = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count() / 1000.0;
+        for (int e = 0; e < EVENT_COUNT; e++) {
+            values[e] = -1;
+#if defined(__linux__)
+            if (fds[e] < 0) continue;
+            ioctl(fds[e], PERF_EVENT_IOC_DISABLE, 0);
+            unsigned long long data[3];    // value, time enabled, time running
+            if (read(fds[e], data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+            values[e] = (double) data[0] * ((double) data[1] / data[2]);
+#endif
+        }
     }
 
     /**
-     * @brief Checks if the drawing is in the first click phase.
-     * @return True if in the first click phase, false otherwise.
+     * @brief Returns the duration of the last region in milliseconds.
      */
-    bool isFirst() const {
-        return firstCLick;
+    double elapsedMs() const {
+        return ms;
     }
 
     /**
-     * @brief Updates the GPU buffers with the current line data.
+     * @brief Returns the count of an event in the last region, negative if unavailable.
      */
-    void update() {
-        lines.updateGpu();
+    double value(Event e) const {
+        return values[e];
     }
+};
 
-    /**
-    * @brief Draws the lines in the collection.
-    * @param type The type of drawing (e.g., GL_LINES, GL_LINE_STRIP, etc.).
-    * @param color The color of the lines.
-    */
-    void Draw(int type, vec3 color) {
-        lines.Draw(type, color);
+/**
+ * @brief Prints the header of the kernel benchmark table.
+ */
+void printKernelBenchHeader() {
+    printf("\t%-24s %10s %12s %9s %6s %10s %10s %10s\n", "region", "ms", "elements", "ns/elem", "IPC",
+           "L1D/elem", "LLC/elem", "brmiss/elem");
+}
+
+/**
+ * @brief Prints a row of the kernel benchmark table, "-" for unavailable counters and per-element
+ * figures of empty regions.
+ */
+void printKernelBenchRow(const char *region, const PerfCounters &perf, double elements) {
+    char perElement[16] = "-", ipc[16] = "-", l1[16] = "-", llc[16] = "-", branches[16] = "-";
+    double cycles = perf.value(PerfCounters::CYCLES), instructions = perf.value(PerfCounters::INSTRUCTIONS);
+    if (cycles > 0 && instructions >= 0) snprintf(ipc, sizeof(ipc), "%.2f", instructions / cycles);
+    if (elements > 0) {
+        snprintf(perElement, sizeof(perElement), "%.2f", perf.elapsedMs() * 1e6 / elements);
+        if (perf.value(PerfCounters::L1D_MISSES) >= 0) snprintf(l1, sizeof(l1), "%.4f", perf.value(PerfCounters::L1D_MISSES) / elements);
+        if (perf.value(PerfCounters::LLC_MISSES) >= 0) snprintf(llc, sizeof(llc), "%.4f", perf.value(PerfCounters::LLC_MISSES) / elements);
+        if (perf.value(PerfCounters::BRANCH_MISSES) >= 0) {
+            snprintf(branches, sizeof(branches), "%.4f", perf.value(PerfCounters::BRANCH_MISSES) / elements);
+        }
     }
+    printf("\t%-24s %10.1f %12.0f %9s %6s %10s %10s %10s\n", region, perf.elapsedMs(), elements,
+           perElement, ipc, l1, llc, branches);
+}
 
-    /**
-     * @brief Finds the nearest line to a given position.
-     * @param clickP The position to search around.
-     * @return The index of the nearest line.
-     */
-    int findNearestLine(vec3 clickP) {
-        float minDistance = 20;
-        int nearestLine = -1;
-        for (size_t i = 0; i < lines.Vtx().size(); i += 4) {
-            vec3 firstPoint = lines.Vtx()[i];
-            vec3 secPoint = lines.Vtx()[i + 1];
-            vec3 lineVector = secPoint - firstPoint;
-            vec3 pointVector = clickP - firstPoint;
+/**
+ * @brief Compares every kernel of a table with the scalar reference on generated data.
+ *
+ * The data has odd sizes and is entered at varying offsets so the remainder loops are covered,
+ * and contains a degenerate line and a pair of parallel lines. Results within rounding of the
+ * reference are accepted, in case a compiler fuses multiplies and adds in the wide versions
+ * (the build turns that off for GCC and Clang).
+ * @param kernels The table to check.
+ * @return The name of the first kernel that disagrees, or NULL.
+ */
+const char *crossCheckKernels(const GeometryKernels &kernels) {
+    const GeometryKernels &reference = KernelDispatch::table(0);
+    VectorSink scene;
+    SceneGenerator(99).generate(SceneGenerator::UNIFORM, 1003, 1003, scene);
+    std::vector<dvec3> vtx;
+    std::vector<double> a, b, c;
+    for (size_t i = 0; i + 1 < scene.lineEnds.size(); i += 2) {
+        dvec3 p1 = scene.lineEnds[i], p2 = i == 10 ? p1 : scene.lineEnds[i + 1];    // line 5 is degenerate
+        vtx.push_back(p1);
+        vtx.push_back(p2);
+        vtx.push_back(p1);
+        vtx.push_back(p2);
+        a.push_back(p2.y - p1.y);
+        b.push_back(p1.x - p2.x);
+        c.push_back((p2.y - p1.y) * p1.x + (p1.x - p2.x) * p1.y);
+    }
+    a[7] = a[3];    // line 7 is parallel to line 3
+    b[7] = b[3];
+    size_t lineCount = vtx.size() / 4;
+    double bounds[] = {INFINITY, 0.01};
+    for (size_t q = 0; q < 64; q++) {
+        size_t skip = q % 11;
+        double x = scene.points[q].x, y = scene.points[q].y;
+        for (int k = 0; k < 2; k++) {
+            double bestReference = bounds[k], best = bounds[k];
+            size_t expected = reference.nearestPoint(scene.points.data() + skip, scene.points.size() - skip, x, y, bestReference);
+            size_t found = kernels.nearestPoint(scene.points.data() + skip, scene.points.size() - skip, x, y, best);
+            if (found != expected && !(fabs(best - bestReference) <= 1e-12 * bestReference)) return "nearestPoint";
 
-            float distanceLine = length(cross(lineVector, pointVector)) / length(lineVector);
+            bestReference = best = bounds[k];
+            expected = reference.nearestLine(vtx.data() + 4 * skip, lineCount - skip, x, y, bestReference);
+            found = kernels.nearestLine(vtx.data() + 4 * skip, lineCount - skip, x, y, best);
+            if (found != expected && !(fabs(best - bestReference) <= 1e-12 * bestReference)) return "nearestLine";
+        }
+
+        std::vector<dvec3> expectedPoints, foundPoints;
+        reference.intersectRow(a[q], b[q], c[q], a.data() + skip, b.data() + skip, c.data() + skip, a.size() - skip, expectedPoints);
+        kernels.intersectRow(a[q], b[q], c[q], a.data() + skip, b.data() + skip, c.data() + skip, a.size() - skip, foundPoints);
+        if (foundPoints.size() != expectedPoints.size()) return "intersectRow";
+        for (size_t i = 0; i < foundPoints.size(); i++) {
+            if (fabs(foundPoints[i].x - expectedPoints[i].x) > 1e-12 || fabs(foundPoints[i].y - expectedPoints[i].y) > 1e-12) return "intersectRow";
+        }
+    }
 
-            if (distanceLine < minDistance && distanceLine < 0.01) {
-                minDistance = distanceLine;
-                nearestLine = i;
+    mat4 m = RotationMatrix(0.7f, vec3(0, 0, 1)) * ScaleMatrix(vec3(3, 0.5f, 1)) * TranslateMatrix(vec3(-2, 5, 0.25f));
+    std::vector<vec4> in, expected(scene.points.size()), found(scene.points.size());
+    for (size_t i = 0; i < scene.points.size(); i++) in.push_back(vec4((float) scene.points[i].x, (float) scene.points[i].y, 1, 1));
+    for (size_t skip = 0; skip < 4; skip++) {
+        reference.transform(m, in.data() + skip, expected.data(), in.size() - skip);
+        kernels.transform(m, in.data() + skip, found.data(), in.size() - skip);
+        for (size_t i = 0; i + skip < in.size(); i++) {
+            for (int j = 0; j < 4; j++) {
+                if (fabs(found[i][j] - expected[i][j]) > 1e-5f * (1 + fabs(expected[i][j]))) return "transform";
             }
         }
+    }
+    return NULL;
+}
 
-        return nearestLine;
+/**
+ * @brief Measures the geometry kernels on the current scene, or on a generated one.
+ *
+ * Every region reports its time, IPC and cache and branch misses per element visited.
+ * @param elementCount Number of uniform points and lines to generate first, 0 to use the scene as it is.
+ */
+void runKernelBenchmark(int elementCount) {
+    if (elementCount > 0) {
+        CollectionSink sink;
+        SceneGenerator(2024).generate(SceneGenerator::UNIFORM, elementCount, elementCount, sink);
     }
+    const int queries = 200;
+    VectorSink random;
+    SceneGenerator(7).generate(SceneGenerator::UNIFORM, queries, 0, random);
+    std::vector<vec3> probes(random.points.begin(), random.points.end());
 
-};
+    std::vector<dvec3> block = lineCoefficients(*lines);
+    if (block.size() > 2048) block.resize(2048);
+    std::vector<vec4> vectors;
+    for (int i = 0; i < points->size() && i < (1 << 20); i++) {
+        dvec3 p = points->getPoints().Vtx()[i];
+        vectors.push_back(vec4((float) p.x, (float) p.y, 1, 1));
+    }
+    std::vector<vec4> transformed(vectors.size());
+    mat4 transform = ScaleMatrix(vec3(2, 2, 1)) * TranslateMatrix(vec3(0.5f, -0.25f, 0));
 
-PointCollection *points; /**< Pointer to a PointCollection object. */
-LineCollection *lines; /**< Pointer to a LineCollection object. */
+    // every table the CPU supports, or only the one forced by POINTSLINES_KERNELS
+    std::vector<const GeometryKernels *> tables;
+    const char *forced = getenv("POINTSLINES_KERNELS");
+    for (int t = 0; t < KernelDispatch::count(); t++) {
+        const GeometryKernels &kernels = KernelDispatch::table(t);
+        if (forced && strcmp(forced, kernels.name) != 0) continue;
+        if (!KernelDispatch::supported(kernels)) {
+            printf("%s kernels: not supported by this CPU\n", kernels.name);
+            continue;
+        }
+        const char *failed = crossCheckKernels(kernels);
+        if (failed) printf("%s kernels: %s disagrees with the scalar reference\n", kernels.name, failed);
+        else printf("%s kernels: match the scalar reference\n", kernels.name);
+        tables.push_back(&kernels);
+    }
+    std::string selected = kernelDispatch.kernels().name;
+
+    PerfCounters perf;
+    printf("Kernel benchmark: %d points, %d lines, %d queries\n", points->size(), lines->size(), queries);
+    if (perf.whyUnavailable()) printf("\thardware counters unavailable (%s), reporting time only\n", perf.whyUnavailable());
+    printKernelBenchHeader();
+    volatile float sink = 0;
+    char region[64];
+
+    for (size_t t = 0; t < tables.size(); t++) {
+        kernelDispatch.force(tables[t]->name);
+
+        perf.start();
+        for (int q = 0; q < queries; q++) sink = sink + points->searchNearestP(probes[q]).x;
+        perf.stop();
+        snprintf(region, sizeof(region), "searchNearestP [%s]", tables[t]->name);
+        printKernelBenchRow(region, perf, (double) queries * points->size());
+
+        perf.start();
+        for (int q = 0; q < queries; q++) sink = sink + (float) lines->findNearestLine(probes[q]);
+        perf.stop();
+        snprintf(region, sizeof(region), "findNearestLine [%s]", tables[t]->name);
+        printKernelBenchRow(region, perf, (double) queries * lines->size());
+
+        std::vector<dvec3> found;
+        perf.start();
+        intersectBlocks(block, block, true, found);
+        perf.stop();
+        sink = sink + (float) found.size();
+        snprintf(region, sizeof(region), "intersectRow [%s]", tables[t]->name);
+        printKernelBenchRow(region, perf, (double) block.size() * (block.size() - 1) / 2);
+
+        perf.start();
+        tables[t]->transform(transform, vectors.data(), transformed.data(), vectors.size());
+        perf.stop();
+        sink = sink + (transformed.empty() ? 0 : transformed.back().x);
+        snprintf(region, sizeof(region), "transform [%s]", tables[t]->name);
+        printKernelBenchRow(region, perf, vectors.size());
+    }
+    kernelDispatch.force(selected.c_str());
+
+    snapper.candidates(probes[0], 0.01f);    // builds the grids outside the measured region
+    perf.start();
+    for (int q = 0; q < queries; q++) sink = sink + (float) snapper.candidates(probes[q], 0.01f).size();
+    perf.stop();
+    printKernelBenchRow("snap candidates", perf, queries);
+
+    perf.start();
+    PointJoin join(points->getPoints().Vtx(), joinRadius);
+    sink = sink + (float) join.count(1);
+    perf.stop();
+    printKernelBenchRow("point join (1 thread)", perf, points->size());
+}
+
+/**
+ * @brief Measures the read bandwidth from every NUMA node to the memory of every node, and the
+ * latency of random reads with small and with huge pages.
+ * @param megabytes Size of the buffers.
+ */
+void runMemoryBenchmark(int megabytes) {
+#if defined(__linux__)
+    size_t bytes = ((size_t) (megabytes > 0 ? megabytes : 1) << 20) + MemoryPolicy::hugePage - 1;
+    bytes &= ~(MemoryPolicy::hugePage - 1);
+    size_t words = bytes / sizeof(unsigned long long);
+    int nodes = memoryPolicy.nodes();
+    printf("Memory benchmark: %d MB buffers, %d NUMA node(s), policy: %s\n", (int) (bytes >> 20), nodes, memoryPolicy.describe().c_str());
+    printf("\tread bandwidth in GB/s, rows: node of the thread, columns: node of the memory\n\t%8s", "");
+    for (int m = 0; m < nodes; m++) printf("   node %d", m);
+    printf("\n");
+    for (int c = 0; c < nodes; c++) {
+        printf("\t  node %d", c);
+        for (int m = 0; m < nodes; m++) {
+            double gbPerSecond = 0;
+            std::thread worker([&]() {
+                memoryPolicy.pinToNode(c);
+                void *raw = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (raw == MAP_FAILED) return;
+                unsigned long long *buffer = (unsigned long long *) raw;
+                if (nodes > 1) {
+                    unsigned long mask = 1UL << m;
+                    syscall(SYS_mbind, buffer, bytes, MPOL_BIND, &mask, 8 * sizeof(unsigned long), 0);
+                }
+                memset(buffer, 1, bytes);
+                volatile unsigned long long sink = 0;
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                for (int pass = 0; pass < 3; pass++) {
+                    unsigned long long sum = 0;
+                    for (size_t i = 0; i < words; i++) sum += buffer[i];
+                    sink = sink + sum;
+                }
+                double seconds = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1e6;
+                gbPerSecond = 3.0 * bytes / seconds / 1e9;
+                munmap(buffer, bytes);
+            });
+            worker.join();
+            printf(" %8.2f", gbPerSecond);
+        }
+        printf("%s\n", nodes > 1 ? "" : "    (single node, no remote memory)");
+    }
+
+    const int reads = 1 << 22;
+    for (int huge = 0; huge < 2; huge++) {
+        void *raw = mmap(NULL, bytes + MemoryPolicy::hugePage, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED) return;
+        unsigned long long *buffer = (unsigned long long *) (((size_t) raw + MemoryPolicy::hugePage - 1) & ~(MemoryPolicy::hugePage - 1));
+#if defined(MADV_HUGEPAGE) && defined(MADV_NOHUGEPAGE)
+        madvise(buffer, bytes, huge ? MADV_HUGEPAGE : MADV_NOHUGEPAGE);
+#endif
+        memset(buffer, 0, bytes);
+        // every read depends on the previous one, so the latency of the TLB misses is not hidden
+        size_t index = 0;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int r = 0; r < reads; r++) index = (index * 6364136223846793005ULL + 1442695040888963407ULL + buffer[index]) % words;
+        double ns = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() * 1e3 / reads;
+        volatile size_t last = index;    // keeps the chain from being optimized away
+        (void) last;
+        printf("\trandom dependent reads with %s: %.1f ns\n", huge ? "2 MB pages" : "4 KB pages", ns);
+        munmap(raw, bytes + MemoryPolicy::hugePage);
+    }
+    FILE *file = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+    char mode[128] = "";
+    if (file) {
+        if (!fgets(mode, sizeof(mode), file)) mode[0] = 0;
+        fclose(file);
+    }
+    if (strstr(mode, "[never]")) printf("\ttransparent huge pages are disabled on this system, both rows use 4 KB pages\n");
+#else
+    printf("The memory benchmark needs Linux\n");
+#endif
+}
+
+/**
+ * @class StartupTimer
+ * @brief Prints the duration of the phases of the startup.
+ */
+class StartupTimer {
+    std::chrono::steady_clock::time_point last; /**< End of the previous phase. */
+    std::chrono::steady_clock::time_point start; /**< Start of the first phase. */
+
+public:
+    /**
+     * @brief Constructor for the StartupTimer class, starts the first phase.
+     */
+    StartupTimer() {
+        start = last = std::chrono::steady_clock::now();
+        printf("Startup: window and context %d ms\n", glutGet(GLUT_ELAPSED_TIME));
+    }
+
+    /**
+     * @brief Ends a phase and prints its duration.
+     * @param name Name of the phase.
+     */
+    void phase(const char *name) {
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        printf("Startup: %-16s %7.2f ms\n", name,
+               std::chrono::duration_cast<std::chrono::microseconds>(now - last).count() / 1000.0);
+        last = now;
+    }
+
+    /**
+     * @brief Prints the total duration of the phases.
+     */
+    void total() {
+        printf("Startup: %-16s %7.2f ms\n", "total",
+               std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count() / 1000.0);
+    }
+};
 
 /**
  * @brief Initializes the OpenGL context.
  */
  void onInitialization() {
-    glViewport(0, 0, windowWidth, windowHeight);
+    StartupTimer startup;
+    GLint initialViewport[4];   // the default viewport covers the whole framebuffer, which is larger than the window on high-DPI displays
+    glGetIntegerv(GL_VIEWPORT, initialViewport);
+    int initialWindowWidth = glutGet(GLUT_WINDOW_WIDTH);
+    if (initialViewport[2] > 0 && initialViewport[3] > 0 && initialWindowWidth > 0) {
+        pixelRatio = (float) initialViewport[2] / initialWindowWidth;
+        screenWidth = initialViewport[2];
+        screenHeight = initialViewport[3];
+    }
+    glViewport(0, 0, screenWidth, screenHeight);
 
     glGenVertexArrays(1, &vao);    // get 1 vao id
     glBindVertexArray(vao);        // make it active
@@ -456,18 +7524,86 @@ LineCollection *lines; /**< Pointer to a LineCollection object. */
                           0, NULL);             // stride, offset: tightly packed
 
 
+    glDebug.install();
+    GPUProgram::enableParallelCompile();
+    // start building the programs for the GPU, the driver may compile them while the rest is set up
+    gpuProgram.begin(vertexSource, fragmentSource, "outColor");
+    glDebug.label(GL_PROGRAM, gpuProgram.getId(), "scene program");
+    hud = new Hud();
+    startup.phase(gpuProgram.isFromCache() ? "programs cached" : "programs started");
+    if (getenv("POINTSLINES_TARGET_FRAME_MS")) {
+        dynamicResolution.setTarget((float) atof(getenv("POINTSLINES_TARGET_FRAME_MS")));
+    }
+    if (getenv("POINTSLINES_GPU_BUDGET_MB")) {
+        gpuMemory.setBudget((size_t) (atof(getenv("POINTSLINES_GPU_BUDGET_MB")) * 1048576));
+    }
+    if (getenv("POINTSLINES_JOB_BUDGET_MS")) jobs.setBudget((float) atof(getenv("POINTSLINES_JOB_BUDGET_MS")));
+    if (getenv("POINTSLINES_MEMORY")) {
+        memoryPolicy.configure(getenv("POINTSLINES_MEMORY"));
+        printf("Memory policy: %s\n", memoryPolicy.describe().c_str());
+    }
+    kernelDispatch.select();
+    if (const char *failed = crossCheckKernels(kernelDispatch.kernels())) {
+        fprintf(stderr, "%s kernels: %s disagrees with the scalar reference, using the scalar kernels\n", kernelDispatch.kernels().name, failed);
+        kernelDispatch.force("scalar");
+    }
+    printf("Geometry kernels: %s\n", kernelDispatch.kernels().name);
     points = new PointCollection();
     lines = new LineCollection();
-    // create program for the GPU
-    gpuProgram.create(vertexSource, fragmentSource, "outColor");
+    points->getPoints().setLabel("points");
+    lines->getLines().setLabel("lines");
     glPointSize(10.0f);
     glLineWidth(3.0f);
+    startup.phase("scene objects");
+    if (!hud->finishProgram()) printf("Overlay disabled\n");
+    if (!gpuProgram.finish()) {
+        printf("Scene program failed to build\n");
+        exit(1);
+    }
+    startup.phase("programs ready");
+    if (getenv("POINTSLINES_BACKGROUND")) {
+        background = new VirtualTexture();
+        if (!background->open(getenv("POINTSLINES_BACKGROUND"))) {
+            delete background;
+            background = NULL;
+        }
+        startup.phase("background");
+    }
+    if (getenv("POINTSLINES_SCENE")) SceneFile::load(getenv("POINTSLINES_SCENE"));
+    if (getenv("POINTSLINES_IMPORT")) importScenes(getenv("POINTSLINES_IMPORT"));
+    if (getenv("POINTSLINES_JOIN_RADIUS")) joinRadius = atof(getenv("POINTSLINES_JOIN_RADIUS"));
+    if (getenv("POINTSLINES_SNAP_PX")) snapTolerancePx = (float) atof(getenv("POINTSLINES_SNAP_PX"));
+    if (getenv("POINTSLINES_SHARE")) replication.start(getenv("POINTSLINES_SHARE"));
+    startup.total();
+
+    if (getenv("POINTSLINES_ALLOC_TEST")) exit(runAllocationTest() ? 0 : 1);
+    if (getenv("POINTSLINES_KERNEL_BENCH")) {
+        runKernelBenchmark(atoi(getenv("POINTSLINES_KERNEL_BENCH")));
+        exit(0);
+    }
+    if (getenv("POINTSLINES_MEMORY_BENCH")) {
+        runMemoryBenchmark(atoi(getenv("POINTSLINES_MEMORY_BENCH")));
+        exit(0);
+    }
+    if (getenv("POINTSLINES_SHARD_BENCH")) {
+        runShardBenchmark(atoi(getenv("POINTSLINES_SHARD_BENCH")));
+        exit(0);
+    }
+    if (getenv("POINTSLINES_LATENCY_REPLAY")) {
+        runLatencyReplay();
+        exit(0);
+    }
 }
 
 /**
  * @brief Handles the display event.
  */
 void onDisplay() {
+    ALLOC_SCOPE("onDisplay");
+    latency.poll();
+    jobs.beginFrame();
+    dynamicResolution.adapt(hud->gpuTime());
+    dynamicResolution.begin(screenWidth, screenHeight);
     glClearColor(128 / 255.0f, 128 / 255.0f, 128 / 255.0f, 1.0f);     // background color
     glClear(GL_COLOR_BUFFER_BIT); // clear frame buffer
 
@@ -481,29 +7617,81 @@ void onDisplay() {
                              0, 0, 0, 1};
 
     location = glGetUniformLocation(gpuProgram.getId(), "MVP");    // Get the GPU location of uniform variable MVP
-    glUniformMatrix4fv(location, 1, GL_TRUE,
-                       &MVPtransf[0][0]);    // Load a 4x4 row-major float matrix to the specified location
 
     glBindVertexArray(vao);  // Draw call
 
 
-    lines->Draw(GL_LINES, vec3(0, 1, 1));
-    points->Draw(vec3(1, 0, 0));
+    hud->beginScene();
+    {
+        DebugGroup group("Scene");
+        int targetW = dynamicResolution.width(screenWidth), targetH = dynamicResolution.height(screenHeight);
+        if (background) {
+            for (size_t v = 0; v < viewports.size(); v++) background->request(viewports[v], (int) (viewports[v].w * targetW));
+            if (background->stream()) glutPostRedisplay();
+        }
+        camera.beginFrame();
+        for (size_t v = 0; v < viewports.size(); v++) {
+            const Viewport &view = viewports[v];
+            camera.addView(view.center, view.zoom, (int) (view.w * targetW), view.visible(20.0f / (view.w * targetW)));
+        }
+        for (size_t v = 0; v < viewports.size(); v++) {
+            const Viewport &view = viewports[v];
+            glViewport((int) (view.x * targetW), (int) (view.y * targetH), (int) (view.w * targetW), (int) (view.h * targetH));
+            if (background) background->draw(view);
+            camera.begin(view.center, view.zoom, (int) (view.w * targetW), location);
+            vec4 visible = view.visible(20.0f / (view.w * targetW));    // margin of two point sizes
+            lines->Draw(GL_LINES, vec3(0, 1, 1), visible);
+            selection.draw();
+            points->Draw(vec3(1, 0, 0), visible);
+            snapper.draw();
+        }
+        camera.end();
+        glViewport(0, 0, targetW, targetH);
+        glUniformMatrix4fv(location, 1, GL_TRUE,
+                           &MVPtransf[0][0]);    // Load a 4x4 row-major float matrix to the specified location
+    }
+    hud->endScene();
+    dynamicResolution.end(screenWidth, screenHeight);
+    hud->draw(points->size(), lines->size());
 
     glutSwapBuffers(); // exchange buffers for double buffering
+    latency.present();
+    replication.flush();
+    frameStats.endFrame();
+    gpuMemory.endFrame();
+#ifdef TRACK_ALLOCATIONS
+    allocTracker.endFrame();
+#endif
 }
 
 enum Key {
 
-    p, l, m, i
+    p, l, m, i, s
 };
 Key current = p;
 
+Line moved; /**< Line being moved. */
+int idx; /**< Index of the line being moved. */
+int firstIdx; /**< Index of the first line for intersection calculation. */
+bool firstLine = false; /**< Flag indicating the first line for intersection calculation. */
+
+/**
+ * @brief Abandons the interactions in progress, whose line indices a restored scene may not have.
+ */
+void cancelInteractions() {
+    idx = -1;
+    firstIdx = -1;
+    firstLine = false;
+    moved = Line(dvec3(0, 0, 0), dvec3(0, 0, 0));
+    lines->cancelDrawing();
+    selection.cancel();
+}
 
 /**
  * @brief Handles the keyboard event when a key is pressed.
  */
  void onKeyboard(unsigned char key, int pX, int pY) {
+    ALLOC_SCOPE("onKeyboard");
     if (key == 'p') {
         current = p;
         printf("Define points\n");
@@ -521,6 +7709,89 @@ Key current = p;
         current = i;
         printf("Intersect\n");
     }
+    if (key == 's') {
+        current = s;
+        printf("Select and drag lines (Ctrl rotates)\n");
+    }
+    if (key == 'o') {
+        hud->toggle();
+        glutPostRedisplay();
+    }
+    if (key == 'b') {
+        gpuMemory.print();
+    }
+    if (key == 'g') {
+        glDebug.print();
+    }
+    if (key == 'h') {
+        latency.print();
+    }
+    if (key == 'c') {
+        intersections.printStats();
+    }
+    if (key == 'k') {
+        lineGroups.print();
+    }
+    if (key == 'j') {
+        reportNearDuplicates();
+    }
+    if (key == 'w') {
+        const char *path = getenv("POINTSLINES_SCENE_OUT") ? getenv("POINTSLINES_SCENE_OUT") : "scene.pls";
+        if (SceneFile::save(path)) printf("Scene written to %s\n", path);
+    }
+#ifdef TRACK_ALLOCATIONS
+    if (key == 'a') {
+        allocTracker.print();
+    }
+#endif
+    if (key == 'X' && lines->size() >= 2) {
+        history.record();
+        jobs.add(new ShardedIntersectionJob(*lines));
+    }
+    if (key == 'x' && lines->size() >= 2) {
+        history.record();
+        jobs.add(new AllPairsIntersectionJob(*lines));
+    }
+    if (key == 'T' && lines->size() >= 2) {
+        history.record();
+        runThreadedIntersection();
+    }
+    if (key == 'r') {
+        dynamicResolution.toggle();
+        glutPostRedisplay();
+    }
+    if (key == 'v') {
+        viewports.toggle();
+        glutPostRedisplay();
+    }
+    if (key == '+' || key == '-') {
+        viewports.zoom(key == '+' ? 1.25f : 0.8f);
+        glutPostRedisplay();
+    }
+    if (key == 'n') {
+        replication.print();
+    }
+    if ((key == 'z' || key == 'y') && replication.active()) {
+        printf("Undo and redo are not available while the scene is shared\n");
+        return;
+    }
+    if ((key == 'z' || key == 'y') && backgroundProducers > 0) {
+        printf("Undo and redo are not available while points and lines are being added in the background\n");
+        return;
+    }
+    if (key == 'z' || key == 'y') {    // what the finished producers left is part of the recorded edit
+        points->publish();
+        lines->publish();
+        cancelInteractions();
+    }
+    if (key == 'z') {
+        if (history.undo()) printf("Undo\n");
+        glutPostRedisplay();
+    }
+    if (key == 'y') {
+        if (history.redo()) printf("Redo\n");
+        glutPostRedisplay();
+    }
 }
 
 
@@ -540,15 +7811,12 @@ Key current = p;
     if (key == 'i') {
         current = i;
     }
+    if (key == 's') {
+        current = s;
+    }
 
 }
 
-Line l1; /**< First line for intersection calculation. */
-Line l2; /**< Second line for intersection calculation. */
-Line moved; /**< Line being moved. */
-int idx; /**< Index of the line being moved. */
-bool firstLine = false; /**< Flag indicating the first line for intersection calculation. */
-
 
 /**
  * @brief Handles the mouse motion event.
@@ -556,13 +7824,33 @@ bool firstLine = false; /**< Flag indicating the first line for intersection cal
  void onMouseMotion(int pX,
                    int pY) {    // pX, pY are the pixel coordinates of the cursor in the coordinate system of the operation system
     // Convert to normalized device space
-    float cX = 2.0f * pX / windowWidth - 1;    // flip y axis
-    float cY = 1.0f - 2.0f * pY / windowHeight;
+    dvec3 world = viewports.toWorld(pX, pY, clientWidth, clientHeight);    // flip y axis and apply the camera
+    double cX = world.x;
+    double cY = world.y;
+    std::chrono::steady_clock::time_point eventStamp = LatencyTracker::now();
+    ALLOC_SCOPE("onMouseMotion");
     if (idx != -1 && current == m) {
-        moved.move(vec3(cX, cY, 1));
-        lines->getLines().Vtx()[idx] = lines->getLines().Vtx()[idx + 2] = moved.getP1();
-        lines->getLines().Vtx()[idx + 1] = lines->getLines().Vtx()[idx + 3] = moved.getP2();;
+        moved.move(dvec3(cX, cY, 1));
+        lines->setLine(idx / 4, moved.getP1(), moved.getP2(), moved.getP3(), moved.getP4());
         lines->update();
+        replication.lineMoved(idx / 4);
+        latency.input(LatencyTracker::DRAG, eventStamp);
+        glutPostRedisplay();
+    }
+    if (current == s) {
+        if (selection.motion(world)) latency.input(LatencyTracker::DRAG, eventStamp);
+    }
+}
+
+/**
+ * @brief Handles the mouse motion event without a pressed button.
+ */
+void onMousePassiveMotion(int pX, int pY) {
+    if (current == l) {
+        const Viewport &view = viewports.at(pX, pY, clientWidth, clientHeight);
+        snapper.hover(view.toWorld(pX, pY, clientWidth, clientHeight), snapTolerancePx * view.pixelSize(clientWidth));
+        glutPostRedisplay();
+    } else if (snapper.clearHover()) {
         glutPostRedisplay();
     }
 }
@@ -573,8 +7861,12 @@ bool firstLine = false; /**< Flag indicating the first line for intersection cal
  void onMouse(int button, int state, int pX,
              int pY) { // pX, pY are the pixel coordinates of the cursor in the coordinate system of the operation system
     // Convert to normalized device space
-    float cX = 2.0f * pX / windowWidth - 1;    // flip y axis
-    float cY = 1.0f - 2.0f * pY / windowHeight;
+    dvec3 world = state == GLUT_DOWN ? viewports.press(pX, pY, clientWidth, clientHeight)
+                                     : viewports.toWorld(pX, pY, clientWidth, clientHeight);    // flip y axis and apply the camera
+    double cX = world.x;
+    double cY = world.y;
+    std::chrono::steady_clock::time_point eventStamp = LatencyTracker::now();
+    ALLOC_SCOPE("onMouse");
     char *buttonStat;
     switch (state) {
         case GLUT_DOWN: {
@@ -590,53 +7882,77 @@ bool firstLine = false; /**< Flag indicating the first line for intersection cal
     switch (button) {
         case GLUT_LEFT_BUTTON: {
             if (current == p && state == GLUT_DOWN) {
-                points->addPoint(vec3(cX, cY, 1));
+                history.record();
+                points->addPoint(dvec3(cX, cY, 1));
                 points->update();
+                latency.input(LatencyTracker::CLICK, eventStamp);
                 glutPostRedisplay();
             }
-            if (current == l && state == GLUT_DOWN && points->size()>=2) {
+            if (current == l && state == GLUT_DOWN) {
+                dvec3 snapped = snapper.snap(world, snapTolerancePx * viewports.current().pixelSize(clientWidth)).pos;
                 if (!lines->isFirst()) {
-                    lines->startDrawing(points->searchNearestP(vec3(cX, cY, 1)));
+                    lines->startDrawing(snapped);
 
                 } else {
-                    lines->finishDrawing(points->searchNearestP(vec3(cX, cY, 1)));
+                    history.record();
+                    lines->finishDrawing(snapped);
                     lines->update();
+                    latency.input(LatencyTracker::CLICK, eventStamp);
                     glutPostRedisplay();
                 }
             }
 
             if (current == i && state == GLUT_DOWN) {
-                vec3 clickPos = vec3(cX, cY, 1);
+                dvec3 clickPos = dvec3(cX, cY, 1);
                 idx = lines->findNearestLine(clickPos);
                 if (idx != -1) {
                     if (!firstLine) {
-                        l1 = Line(lines->getLines().Vtx()[idx], lines->getLines().Vtx()[idx + 1]);
+                        firstIdx = idx;
                         firstLine = true;
+                        printf("%d other lines are parallel to this one\n", (int) lineGroups.parallelTo(idx / 4).size() - 1);
                     } else {
-                        l2 = Line(lines->getLines().Vtx()[idx], lines->getLines().Vtx()[idx + 1]);
-                        points->addPoint(l1.findIntersectionPoint(l2));
-                        points->update();
-                        glutPostRedisplay();
-                        l1 = l2 = Line(vec3(0, 0, 0), vec3(0, 0, 0));
+                        if (lineGroups.parallel(firstIdx / 4, idx / 4)) {
+                            printf(lineGroups.coincident(firstIdx / 4, idx / 4) ? "The lines coincide\n" : "The lines are parallel\n");
+                        } else {
+                            history.record();
+                            points->addPoint(intersections.intersect(*lines, firstIdx / 4, idx / 4));
+                            points->update();
+                            latency.input(LatencyTracker::CLICK, eventStamp);
+                            glutPostRedisplay();
+                        }
                         firstLine = false;
                         idx = -1;
                     }
                 }
             }
             if (current == m && state == GLUT_DOWN) {
-                idx = lines->findNearestLine(vec3(cX, cY, 1));
-                moved = Line(lines->getLines().Vtx()[idx], lines->getLines().Vtx()[idx + 1]);
+                idx = lines->findNearestLine(dvec3(cX, cY, 1));
+                if (idx != -1) {
+                    history.record();
+                    moved = Line(lines->getLines().Vtx()[idx], lines->getLines().Vtx()[idx + 1]);
+                }
             } else if (current == m && state != GLUT_DOWN) {
                 idx = -1;
                 moved = Line(vec3(0, 0, 0), vec3(0, 0, 0));
 
             }
+            if (current == s) {
+                if (state == GLUT_DOWN) {
+                    selection.press(world, (glutGetModifiers() & GLUT_ACTIVE_CTRL) != 0);
+                } else {
+                    selection.release(world);
+                }
+            }
 
         }
             break;
 
         case GLUT_MIDDLE_BUTTON:
             printf("Middle button %s at (%3.2f, %3.2f)\n", buttonStat, cX, cY);
+            if (state == GLUT_DOWN) {
+                viewports.focus(world);
+                glutPostRedisplay();
+            }
             break;
         case GLUT_RIGHT_BUTTON:
             printf("Right button %s at (%3.2f, %3.2f)\n", buttonStat, cX, cY);
@@ -645,9 +7961,175 @@ bool firstLine = false; /**< Flag indicating the first line for intersection cal
 
 }
 
+/**
+ * @brief Handles the resize of the window.
+ * @param w New width of the window in the coordinates of mouse events.
+ * @param h New height of the window in the coordinates of mouse events.
+ */
+void onReshape(int w, int h) {
+    clientWidth = w > 0 ? w : 1;
+    clientHeight = h > 0 ? h : 1;
+    screenWidth = (int) (clientWidth * pixelRatio + 0.5f);
+    screenHeight = (int) (clientHeight * pixelRatio + 0.5f);
+    glViewport(0, 0, screenWidth, screenHeight);
+    glutPostRedisplay();
+}
+
 /**
  * @brief Handles the idle event.
  */
  void onIdle() {
     long time = glutGet(GLUT_ELAPSED_TIME); // elapsed time since the start of the program
+    latency.poll();
+    replication.poll();
+    bool published = points->publish();
+    published = lines->publish() || published;
+    if (published || backgroundProducers > 0) glutPostRedisplay();
+    if (jobs.busy()) {
+        jobs.run();
+        glutPostRedisplay();
+    }
+    if (hud->isVisible()) glutPostRedisplay();
+}
+
+/**
+ * @struct InputEvent
+ * @brief A recorded GLUT input event.
+ */
+struct InputEvent {
+    enum Type { KEY, MOUSE, MOTION } type; /**< Handler the event is dispatched to. */
+    int button; /**< Mouse button, or the key for KEY events. */
+    int state; /**< Mouse button state. */
+    int x; /**< Cursor x in pixels. */
+    int y; /**< Cursor y in pixels. */
+};
+
+/**
+ * @class InputReplay
+ * @brief Replays a recorded sequence of input events through the GLUT handlers.
+ */
+class InputReplay {
+    std::vector<InputEvent> events; /**< The recorded events. */
+
+public:
+    /**
+     * @brief Records a key press.
+     */
+    void key(unsigned char k) {
+        InputEvent e = {InputEvent::KEY, k, 0, 0, 0};
+        events.push_back(e);
+    }
+
+    /**
+     * @brief Records a left click (press and release) at a pixel.
+     */
+    void click(int x, int y) {
+        InputEvent down = {InputEvent::MOUSE, GLUT_LEFT_BUTTON, GLUT_DOWN, x, y};
+        InputEvent up = {InputEvent::MOUSE, GLUT_LEFT_BUTTON, GLUT_UP, x, y};
+        events.push_back(down);
+        events.push_back(up);
+    }
+
+    /**
+     * @brief Records a left-button drag along a straight path.
+     * @param steps Number of motion events between the two ends.
+     */
+    void drag(int x0, int y0, int x1, int y1, int steps) {
+        InputEvent down = {InputEvent::MOUSE, GLUT_LEFT_BUTTON, GLUT_DOWN, x0, y0};
+        events.push_back(down);
+        for (int s = 1; s <= steps; s++) {
+            InputEvent motion = {InputEvent::MOTION, 0, 0, x0 + (x1 - x0) * s / steps, y0 + (y1 - y0) * s / steps};
+            events.push_back(motion);
+        }
+        InputEvent up = {InputEvent::MOUSE, GLUT_LEFT_BUTTON, GLUT_UP, x1, y1};
+        events.push_back(up);
+    }
+
+    /**
+     * @brief Returns the number of recorded events.
+     */
+    size_t size() const {
+        return events.size();
+    }
+
+    /**
+     * @brief Dispatches event i to its handler and renders a frame.
+     */
+    void play(size_t i) {
+        const InputEvent &e = events[i];
+        switch (e.type) {
+            case InputEvent::KEY:
+                onKeyboard((unsigned char) e.button, e.x, e.y);
+                onKeyboardUp((unsigned char) e.button, e.x, e.y);
+                break;
+            case InputEvent::MOUSE:
+                onMouse(e.button, e.state, e.x, e.y);
+                break;
+            case InputEvent::MOTION:
+                onMouseMotion(e.x, e.y);
+                break;
+        }
+        onDisplay();
+    }
+
+    /**
+     * @brief Dispatches all events in order.
+     */
+    void playAll() {
+        for (size_t i = 0; i < events.size(); i++) play(i);
+    }
+};
+
+/**
+ * @brief Replays the construction of two points and a horizontal line through them, then enters move mode.
+ */
+void replaySetupScene() {
+    InputReplay setup;
+    setup.key('p');
+    setup.click(150, 300);
+    setup.click(450, 300);
+    setup.key('l');
+    setup.click(150, 300);
+    setup.click(450, 300);
+    setup.key('m');
+    setup.playAll();
+}
+
+/**
+ * @brief Replays a line drag and checks that the steady-state frames do not allocate.
+ * The first motion event may copy the chunk shared with the undo snapshot, so it is not counted.
+ * @return True if the test passed.
+ */
+bool runAllocationTest() {
+#ifdef TRACK_ALLOCATIONS
+    replaySetupScene();
+
+    InputReplay drag;
+    drag.drag(300, 300, 300, 100, 200);
+    drag.play(0);
+    drag.play(1);
+    AllocStats before = threadAllocs;    // background producers may be allocating meanwhile
+    for (size_t e = 2; e + 1 < drag.size(); e++) drag.play(e);
+    unsigned long count = threadAllocs.count - before.count;
+    unsigned long bytes = threadAllocs.bytes - before.bytes;
+    drag.play(drag.size() - 1);
+    allocTracker.print();
+    printf("Allocation test: %lu allocations (%lu bytes) during the drag: %s\n",
+           count, bytes, count == 0 ? "PASSED" : "FAILED");
+    return count == 0;
+#else
+    printf("Allocation test needs a build with TRACK_ALLOCATIONS\n");
+    return false;
+#endif
+}
+
+/**
+ * @brief Replays the scene construction and a line drag and prints the latency histograms.
+ */
+void runLatencyReplay() {
+    replaySetupScene();
+    InputReplay drag;
+    drag.drag(300, 300, 300, 100, 200);
+    drag.playAll();
+    latency.print();
 }
@@ -4,6 +4,7 @@
 // Do not change it if you want to submit a homework.
 //=============================================================================================
 #include "framework.h"
+#include <string.h>
 
 // Initialization
 void onInitialization();
@@ -20,14 +21,29 @@ void onKeyboardUp(unsigned char key, int pX, int pY);
 // Move mouse with key pressed
 void onMouseMotion(int pX, int pY);
 
+// Move mouse without a pressed button
+void onMousePassiveMotion(int pX, int pY);
+
 // Mouse click event
 void onMouse(int button, int state, int pX, int pY);
 
+// Window has been resized
+void onReshape(int w, int h);
+
 // Idle event indicating that some time elapsed: do animation here
 void onIdle();
 
+// Entry point of a worker process of the sharded batch jobs
+int runShardWorker();
+
+// Writes a synthetic scene file without opening a window
+int runSceneGenerator();
+
 // Entry point of the application
 int main(int argc, char * argv[]) {
+    if (argc > 1 && strcmp(argv[1], "--shard-worker") == 0) return runShardWorker();	// no window in worker processes
+    if (getenv("POINTSLINES_GENERATE")) return runSceneGenerator();
+
     // Initialize GLUT, Glew and OpenGL
     glutInit(&argc, argv);
 
@@ -35,6 +51,7 @@ int main(int argc, char * argv[]) {
     int majorVersion = 3, minorVersion = 3;
 #if !defined(__APPLE__)
     glutInitContextVersion(majorVersion, minorVersion);
+    if (getenv("POINTSLINES_GL_DEBUG")) glutInitContextFlags(GLUT_DEBUG);	// drivers report more messages in debug contexts
 #endif
     glutInitWindowSize(windowWidth, windowHeight);				// Application window is initially of resolution 600x600
     glutInitWindowPosition(100, 100);							// Relative location of the application window
@@ -66,6 +83,8 @@ int main(int argc, char * argv[]) {
     glutKeyboardFunc(onKeyboard);
     glutKeyboardUpFunc(onKeyboardUp);
     glutMotionFunc(onMouseMotion);
+    glutPassiveMotionFunc(onMousePassiveMotion);
+    glutReshapeFunc(onReshape);
 
     glutMainLoop();
     return 1;
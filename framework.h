@@ -250,6 +250,64 @@ inline vec3 cross(const vec3& v1, const vec3& v2) {
  */
 inline vec3 operator*(float a, const vec3& v) { return vec3(v.x * a, v.y * a, v.z * a); }
 
+/**
+ * @struct dvec3
+ * @brief A structure to represent a 3D vector in double precision.
+ *
+ * This structure stores world positions that must keep their precision far from the origin.
+ * It converts implicitly from vec3; the conversion to vec3 loses precision and must be explicit.
+ */
+struct dvec3 {
+    double x; ///< The x-coordinate of the vector.
+    double y; ///< The y-coordinate of the vector.
+    double z; ///< The z-coordinate of the vector.
+
+    /**
+     * @brief Construct a new dvec3 object.
+     *
+     * @param x0 The initial x-coordinate. Default is 0.
+     * @param y0 The initial y-coordinate. Default is 0.
+     * @param z0 The initial z-coordinate. Default is 0.
+     */
+    dvec3(double x0 = 0, double y0 = 0, double z0 = 0) { x = x0; y = y0; z = z0; }
+
+    /**
+     * @brief Construct a new dvec3 object from a vec3.
+     *
+     * @param v The vec3 to construct from.
+     */
+    dvec3(const vec3& v) { x = v.x; y = v.y; z = v.z; }
+
+    /**
+     * @brief Convert the vector to single precision, only where it is written as a cast.
+     */
+    explicit operator vec3() const { return vec3((float)x, (float)y, (float)z); }
+
+    /**
+     * @brief Multiply the vector by a scalar.
+     *
+     * @param a The scalar to multiply by.
+     * @return The result of the multiplication.
+     */
+    dvec3 operator*(double a) const { return dvec3(x * a, y * a, z * a); }
+
+    /**
+     * @brief Add another vector to this vector.
+     *
+     * @param v The vector to add.
+     * @return The result of the addition.
+     */
+    dvec3 operator+(const dvec3& v) const { return dvec3(x + v.x, y + v.y, z + v.z); }
+
+    /**
+     * @brief Subtract another vector from this vector.
+     *
+     * @param v The vector to subtract.
+     * @return The result of the subtraction.
+     */
+    dvec3 operator-(const dvec3& v) const { return dvec3(x - v.x, y - v.y, z - v.z); }
+};
+
 /**
  * @struct vec4
  * @brief A structure to represent a 4D vector.
@@ -620,6 +678,88 @@ class GPUProgram {
     unsigned int geometryShader = 0; ///< The ID of the geometry shader.
     unsigned int fragmentShader = 0; ///< The ID of the fragment shader.
     bool waitError = true; ///< Flag to indicate whether to wait for an error.
+    bool fromCache = false; ///< Flag to indicate whether the program was loaded from the binary cache.
+    std::string cacheFile; ///< File of the program binary in the cache, empty if caching is not possible.
+
+    /**
+     * @brief Get the cache file of a program binary.
+     *
+     * The name is a hash of the sources and of the vendor, renderer and version of the driver,
+     * so a driver update invalidates the cache.
+     * @return The file name, or an empty string if the driver cannot return program binaries.
+     */
+    std::string binaryCacheFile(const char * vs, const char * fs, const char * out, const char * gs) {
+#if !defined(__APPLE__)
+        if (!GLEW_ARB_get_program_binary || getenv("POINTSLINES_NO_SHADER_CACHE")) return std::string();
+        const char * parts[] = { vs, fs, out, gs ? gs : "",
+                                 (const char *)glGetString(GL_VENDOR), (const char *)glGetString(GL_RENDERER),
+                                 (const char *)glGetString(GL_VERSION) };
+        unsigned long long hash = 1469598103934665603ull;
+        for (int p = 0; p < 7; p++) {
+            for (const char * c = parts[p]; c && *c; c++) hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+            hash = (hash ^ 0xff) * 1099511628211ull;
+        }
+        char name[64];
+        snprintf(name, sizeof(name), "shadercache_%016llx.bin", hash);
+        return name;
+#else
+        return std::string();
+#endif
+    }
+
+    /**
+     * @brief Load the program from the binary cache.
+     * @return True if a valid binary was found and accepted by the driver.
+     */
+    bool loadBinary() {
+#if !defined(__APPLE__)
+        if (cacheFile.empty()) return false;
+        FILE * file = fopen(cacheFile.c_str(), "rb");
+        if (!file) return false;
+        unsigned int format = 0;
+        std::vector<char> binary;
+        bool ok = fread(&format, sizeof(format), 1, file) == 1;
+        if (ok) {
+            fseek(file, 0, SEEK_END);
+            long size = ftell(file) - (long)sizeof(format);
+            fseek(file, sizeof(format), SEEK_SET);
+            ok = size > 0;
+            if (ok) {
+                binary.resize(size);
+                ok = fread(&binary[0], 1, size, file) == (size_t)size;
+            }
+        }
+        fclose(file);
+        if (!ok) return false;
+        glProgramBinary(shaderProgramId, format, &binary[0], (GLsizei)binary.size());
+        int linked = 0;
+        glGetProgramiv(shaderProgramId, GL_LINK_STATUS, &linked);
+        return linked != 0;	// a rejected binary falls back to compilation
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * @brief Store the binary of the linked program in the cache.
+     */
+    void saveBinary() {
+#if !defined(__APPLE__)
+        if (cacheFile.empty()) return;
+        int length = 0;
+        glGetProgramiv(shaderProgramId, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0) return;
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(shaderProgramId, length, NULL, &format, &binary[0]);
+        FILE * file = fopen(cacheFile.c_str(), "wb");
+        if (!file) return;
+        unsigned int f = format;
+        fwrite(&f, sizeof(f), 1, file);
+        fwrite(&binary[0], 1, binary.size(), file);
+        fclose(file);
+#endif
+    }
 
     /**
      * @brief Get error information.
@@ -721,6 +861,37 @@ public:
                 const char * const fragmentShaderSource, const char * const fragmentShaderOutputName,
                 const char * const geometryShaderSource = nullptr)
     {
+        begin(vertexShaderSource, fragmentShaderSource, fragmentShaderOutputName, geometryShaderSource);
+        return finish();
+    }
+
+    /**
+     * @brief Start creating a GPU program without waiting for the driver.
+     *
+     * The program is loaded from the binary cache if a binary for the same sources and driver
+     * exists; otherwise compilation and linking are started and checked only in finish(), so
+     * drivers with parallel shader compilation can build several programs concurrently.
+     * @param vertexShaderSource The source code of the vertex shader.
+     * @param fragmentShaderSource The source code of the fragment shader.
+     * @param fragmentShaderOutputName The output name of the fragment shader.
+     * @param geometryShaderSource The source code of the geometry shader.
+     */
+    void begin(const char * const vertexShaderSource,
+               const char * const fragmentShaderSource, const char * const fragmentShaderOutputName,
+               const char * const geometryShaderSource = nullptr)
+    {
+        shaderProgramId = glCreateProgram();
+        if (!shaderProgramId) {
+            printf("Error in shader program creation\n");
+            exit(1);
+        }
+        fromCache = false;
+        cacheFile = binaryCacheFile(vertexShaderSource, fragmentShaderSource, fragmentShaderOutputName, geometryShaderSource);
+        if (loadBinary()) {
+            fromCache = true;
+            return;
+        }
+
         // Create vertex shader from string
         if (vertexShader == 0) vertexShader = glCreateShader(GL_VERTEX_SHADER);
         if (!vertexShader) {
@@ -729,7 +900,6 @@ public:
         }
         glShaderSource(vertexShader, 1, (const GLchar**)&vertexShaderSource, NULL);
         glCompileShader(vertexShader);
-        if (!checkShader(vertexShader, "Vertex shader error")) return false;
 
         // Create geometry shader from string if given
         if (geometryShaderSource != nullptr) {
@@ -740,7 +910,6 @@ public:
             }
             glShaderSource(geometryShader, 1, (const GLchar**)&geometryShaderSource, NULL);
             glCompileShader(geometryShader);
-            if (!checkShader(geometryShader, "Geometry shader error")) return false;
         }
 
         // Create fragment shader from string
@@ -752,13 +921,7 @@ public:
 
         glShaderSource(fragmentShader, 1, (const GLchar**)&fragmentShaderSource, NULL);
         glCompileShader(fragmentShader);
-        if (!checkShader(fragmentShader, "Fragment shader error")) return false;
 
-        shaderProgramId = glCreateProgram();
-        if (!shaderProgramId) {
-            printf("Error in shader program creation\n");
-            exit(1);
-        }
         glAttachShader(shaderProgramId, vertexShader);
         glAttachShader(shaderProgramId, fragmentShader);
         if (geometryShader > 0) glAttachShader(shaderProgramId, geometryShader);
@@ -766,15 +929,46 @@ public:
         // Connect the fragmentColor to the frame buffer memory
         glBindFragDataLocation(shaderProgramId, 0, fragmentShaderOutputName);	// this output goes to the frame buffer memory
 
+#if !defined(__APPLE__)
+        if (GLEW_ARB_get_program_binary) glProgramParameteri(shaderProgramId, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+#endif
         // program packaging
         glLinkProgram(shaderProgramId);
-        if (!checkLinking(shaderProgramId)) return false;
+    }
+
+    /**
+     * @brief Wait for the program started by begin(), check it and store its binary in the cache.
+     * @return True if the program was created successfully, false otherwise.
+     */
+    bool finish() {
+        if (!fromCache) {
+            if (!checkShader(vertexShader, "Vertex shader error")) return false;
+            if (geometryShader > 0 && !checkShader(geometryShader, "Geometry shader error")) return false;
+            if (!checkShader(fragmentShader, "Fragment shader error")) return false;
+            if (!checkLinking(shaderProgramId)) return false;
+            saveBinary();
+        }
 
         // make this program run
         glUseProgram(shaderProgramId);
         return true;
     }
 
+    /**
+     * @brief Check whether the program was loaded from the binary cache.
+     * @return True if no compilation was needed.
+     */
+    bool isFromCache() const { return fromCache; }
+
+    /**
+     * @brief Let the driver compile shaders on as many threads as it likes, if supported.
+     */
+    static void enableParallelCompile() {
+#if !defined(__APPLE__)
+        if (GLEW_ARB_parallel_shader_compile) glMaxShaderCompilerThreadsARB(0xFFFFFFFF);
+#endif
+    }
+
     /**
      * @brief Use the GPU program.
      */